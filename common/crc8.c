@@ -26,7 +26,7 @@ uint8_t crc8_table[256];
 bool initialized = false;
 bool crc8_debug = false;
 
-void generate_crc8_table() {
+void generate_crc8_table(void) {
     for (int i = 0; i < 256; i++) {
         uint8_t crc = i;
         for (int j = 0; j < 8; j++) {
@@ -52,6 +52,17 @@ uint8_t crc8(const uint8_t *data, size_t len) {
     return crc;
 }
 
+// Continues a CRC over one more run of bytes, for data that arrives in pieces
+uint8_t crc8_update(uint8_t crc, const uint8_t *data, size_t len) {
+    if (!initialized) {
+        generate_crc8_table();
+    }
+    for (size_t i = 0; i < len; i++) {
+        crc = crc8_table[crc ^ data[i]];
+    }
+    return crc;
+}
+
 void create_command_crc8(Payload *payload) {
     if (!initialized) {
         generate_crc8_table();
@@ -150,3 +161,108 @@ bool is_valid_data_crc8(const Payload *payload) {
         return false;
     }
 }
+
+// CRC-16/CCITT (polynomial 0x1021, initial 0xFFFF, MSB first). The Victor
+// works a byte at a time from one 512 byte table. The Pico also has the tables
+// for the byte after 1, 2 and 3 more, and takes 4 bytes per step.
+#define CRC16_POLYNOMIAL 0x1021
+#ifdef __WATCOMC__
+#define CRC16_SLICES 1
+#else
+#define CRC16_SLICES 4
+#endif
+
+uint16_t crc16_table[CRC16_SLICES][256];
+static bool crc16_initialized = false;
+
+void generate_crc16_table(void) {
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = (uint16_t)(i << 8);
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ CRC16_POLYNOMIAL) : (uint16_t)(crc << 1);
+        }
+        crc16_table[0][i] = crc;
+    }
+    for (int slice = 1; slice < CRC16_SLICES; slice++) {
+        for (int i = 0; i < 256; i++) {
+            uint16_t crc = crc16_table[slice - 1][i];
+            crc16_table[slice][i] = (uint16_t)(crc << 8) ^ crc16_table[0][crc >> 8];
+        }
+    }
+    crc16_initialized = true;
+}
+
+static uint16_t crc16_update(uint16_t crc, const uint8_t DATA_FAR *data, size_t len) {
+    if (!crc16_initialized) {
+        generate_crc16_table();
+    }
+#if CRC16_SLICES == 4
+    for (; len >= 4; len -= 4, data += 4) {
+        crc = crc16_table[3][(crc >> 8) ^ data[0]] ^ crc16_table[2][(crc & 0xFF) ^ data[1]] ^
+              crc16_table[1][data[2]] ^ crc16_table[0][data[3]];
+    }
+#endif
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint16_t)(crc << 8) ^ crc16_table[0][(crc >> 8) ^ data[i]];
+    }
+    return crc;
+}
+
+// The check a framed link sends at the end of each frame, agreed in the
+// startup handshake. A new kind only needs its cases here.
+uint8_t integrity_size(IntegrityKind kind) {
+    return kind == INTEGRITY_CRC16 ? 2 : 1;
+}
+
+uint16_t integrity_update(IntegrityKind kind, uint16_t check, const uint8_t DATA_FAR *data, size_t len) {
+    switch (kind) {
+        case INTEGRITY_CRC16:
+            return crc16_update(check, data, len);
+        default:
+            if (!initialized) {
+                generate_crc8_table();
+            }
+            for (size_t i = 0; i < len; i++) {
+                check = crc8_table[(uint8_t)check ^ data[i]];
+            }
+            return check;
+    }
+}
+
+// Builds the tables once, so loops using the step macros can skip the check
+void integrity_tables_ready(void) {
+    if (!initialized) {
+        generate_crc8_table();
+    }
+    if (!crc16_initialized) {
+        generate_crc16_table();
+    }
+}
+
+// Check over a frame's header alone, for a receiver that continues it over
+// params and data as they arrive. frame_integrity_start adds the params and
+// frame_integrity the data. The bytes go in the order they cross the link.
+uint16_t frame_header_integrity(IntegrityKind kind, uint8_t sequence, const Payload *payload) {
+    uint8_t header[FRAME_HEADER_SIZE];
+    header[0] = sequence;
+    header[1] = (uint8_t)payload->protocol;
+    header[2] = payload->command;
+    header[3] = (payload->params_size >> 8) & 0xFF;
+    header[4] = payload->params_size & 0xFF;
+    header[5] = (payload->data_size >> 8) & 0xFF;
+    header[6] = payload->data_size & 0xFF;
+    return integrity_update(kind, kind == INTEGRITY_CRC16 ? 0xFFFF : 0x00, header, FRAME_HEADER_SIZE);
+}
+
+// A segment frame's check starts over its sequence byte, the data follows
+uint16_t segment_header_integrity(IntegrityKind kind, uint8_t sequence) {
+    return integrity_update(kind, kind == INTEGRITY_CRC16 ? 0xFFFF : 0x00, &sequence, 1);
+}
+
+uint16_t frame_integrity_start(IntegrityKind kind, uint8_t sequence, const Payload *payload) {
+    return integrity_update(kind, frame_header_integrity(kind, sequence, payload), payload->params, payload->params_size);
+}
+
+uint16_t frame_integrity(IntegrityKind kind, uint8_t sequence, const Payload *payload) {
+    return integrity_update(kind, frame_integrity_start(kind, sequence, payload), payload->data, payload->data_size);
+}
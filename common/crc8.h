@@ -11,12 +11,40 @@
     void cdprintf (char *msg, ...);
 #endif
 
-void generateCrc8Table(void);
+// Payload data is far on the Victor
+#ifdef __WATCOMC__
+#define DATA_FAR far
+#else
+#define DATA_FAR
+#endif
+
+typedef enum {
+    INTEGRITY_CRC8,     // CRC-8 polynomial 0x07, 1 byte on the wire
+    INTEGRITY_CRC16,    // CRC-16/CCITT, 2 bytes on the wire, high byte first
+} IntegrityKind;
+
+// One byte of each check, for loops that fold it into moving the bytes.
+// They need integrity_tables_ready() first.
+extern uint8_t crc8_table[256];
+extern uint16_t crc16_table[][256];
+#define CRC8_STEP(crc, byte) (crc8_table[(uint8_t)((crc) ^ (byte))])
+#define CRC16_STEP(crc, byte) ((uint16_t)((crc) << 8) ^ crc16_table[0][(uint8_t)(((crc) >> 8) ^ (byte))])
+
+void generate_crc8_table(void);
+void generate_crc16_table(void);
+void integrity_tables_ready(void);
 uint8_t crc8(const uint8_t *data, size_t len);
+uint8_t crc8_update(uint8_t crc, const uint8_t *data, size_t len);
 void create_command_crc8(Payload *payload);
 void create_data_crc8(Payload *payload);
 void create_payload_crc8(Payload *payload);
 bool is_valid_command_crc8(const Payload *payload);
 bool is_valid_data_crc8(const Payload *payload);
+uint8_t integrity_size(IntegrityKind kind);
+uint16_t integrity_update(IntegrityKind kind, uint16_t check, const uint8_t DATA_FAR *data, size_t len);
+uint16_t frame_header_integrity(IntegrityKind kind, uint8_t sequence, const Payload *payload);
+uint16_t segment_header_integrity(IntegrityKind kind, uint8_t sequence);
+uint16_t frame_integrity_start(IntegrityKind kind, uint8_t sequence, const Payload *payload);
+uint16_t frame_integrity(IntegrityKind kind, uint8_t sequence, const Payload *payload);
 
 #endif /* _CRC8_H_ */
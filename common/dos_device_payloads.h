@@ -246,6 +246,17 @@ typedef struct {
     uint8_t drive_number;     /*  Drive Image Number  */ 
 } WriteParams;
 
+// One sub-command of an SD_BLOCK_BATCH request. The request params are an
+// array of these and its data holds the sectors of the write entries back to
+// back. The response params have one status byte per entry and its data holds
+// the sectors of the read entries back to back, both in entry order.
+typedef struct {
+    uint8_t command;          /*  READ_BLOCK, WRITE_NO_VERIFY or WRITE_VERIFY */
+    ReadParams params;        /*  WriteParams has the same layout */
+} BatchEntry;
+
+#define BATCH_MAX_ENTRIES 8
+
 
 #pragma pack(pop)
 
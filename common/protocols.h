@@ -20,7 +20,8 @@ typedef enum {
     FLOPPY = 12, 
     VGA_DISPLAY = 13, 
     SOUND = 14, 
-    HANDSHAKE =15 
+    HANDSHAKE =15,
+    SD_BLOCK_BATCH = 16     // several block reads and writes in one request, see BatchEntry
   } V9KProtocol;
 
 #define MAX_IMG_FILES 9
@@ -30,6 +31,63 @@ typedef enum {
 #define BUFFER_SECTOR_SIZE 10
 #define STARTUP_HANDSHAKE 0x0F  // Handshake byte to start communication ASCII SI  (shift in)
 #define HANDSHAKE_RESPONSE 0x0E // Handshake byte to acknowledge communication ASCII SO (shift out)
+#define STARTUP_HANDSHAKE_FRAMED 0x12  // Handshake byte offering single frame requests ASCII DC2
+#define HANDSHAKE_RESPONSE_FRAMED 0x11 // Handshake byte accepting single frame requests ASCII DC1
+#define STARTUP_HANDSHAKE_FRAMED_CRC16 0x13  // Handshake byte offering frames checked by CRC-16 ASCII DC3
+#define HANDSHAKE_RESPONSE_FRAMED_CRC16 0x14 // Handshake byte accepting frames checked by CRC-16 ASCII DC4
+#define STARTUP_HANDSHAKE_CAPS 0x16   // Handshake byte offering a capability exchange ASCII SYN
+#define HANDSHAKE_RESPONSE_CAPS 0x17  // Handshake byte accepting a capability exchange ASCII ETB
+#define HANDSHAKE_RESPONSE_BUSY 0x15  // Any handshake while the card is still mounting, retry the same offer ASCII NAK
+
+// Capability exchange. Once the Pico accepts STARTUP_HANDSHAKE_CAPS the Victor
+// sends its LinkCapabilities as a block of version, size, the fields after
+// version and a CRC-8 over all of it, and the Pico answers with a block of
+// what both support. A reader takes the fields it knows and leaves the rest,
+// so a later version only appends. An answer of version 0 refuses a block
+// that did not check out. A Pico that predates the exchange ignores the
+// offer and the Victor goes on to the single byte handshakes.
+#define CAPABILITY_VERSION 1
+#define CAPABILITY_BLOCK_MAX 32
+#define CAP_FRAMED 0x01         // single frame requests, otherwise stop-and-wait packets
+#define CAP_BLOCK_BATCH 0x02    // SD_BLOCK_BATCH requests
+#define CAP_FILL_SECTORS 0x04   // sector data coded as below, framed links only
+#define CAP_ANY 0xFF            // in an offer, leaves the setting to the Pico
+
+typedef struct {
+    uint8_t version;
+    uint8_t features;               // CAP_ flags
+    uint8_t integrity;              // one bit per IntegrityKind, the answer has only the one agreed
+    uint8_t max_request_sectors;    // past SEGMENT_SECTORS a request goes in segments
+    uint8_t window;                 // frames sent before an ack is waited for
+    uint8_t write_policy;           // the Pico's write cache policy, or CAP_ANY
+    uint8_t pio_clock_mhz;          // the Pico's PIO sample clock, or CAP_ANY
+} LinkCapabilities;
+
+// Framed link: a request or response is one frame of sequence, protocol,
+// command, params_size, data_size, params, data and a CRC-8 or CRC-16 over all
+// of it, answered by one ack of status and sequence. A NAK resends that frame.
+#define FRAME_SEQUENCE_FLAG 0x80    // always set in a sequence number, so it never reads as a handshake
+#define FRAME_HEADER_SIZE 7
+#define FRAME_MAX_ATTEMPTS 3        // both sides give up on a frame after this many NAKs
+#define NEXT_FRAME_SEQUENCE(seq) (FRAME_SEQUENCE_FLAG | (((seq) + 1) & ~FRAME_SEQUENCE_FLAG))
+
+// A block transfer of more than SEGMENT_SECTORS, up to a whole 64 KB DOS
+// request, carries the first SEGMENT_SECTORS in its request or response frame.
+// The rest follow straight after as segment frames of sequence, up to
+// SEGMENT_SECTORS of data and the check, each acked like a frame and taking
+// the next sequence. Both sides know the sizes from the request's sector_count.
+#define SEGMENT_SECTORS 16
+#define SEGMENT_SIZE (SEGMENT_SECTORS * SECTOR_SIZE)
+#define MAX_REQUEST_SECTORS 128
+
+// Once CAP_FILL_SECTORS is agreed the data of READ_BLOCK response frames and
+// WRITE request frames, and of their segments, goes sector by sector as a
+// coding byte and its body: SECTOR_LITERAL and the 512 bytes, or SECTOR_FILL
+// and the one value every byte of the sector holds. The sizes in the header
+// stay those of the sectors and the check covers the bytes as they cross.
+#define SECTOR_LITERAL 0x00
+#define SECTOR_FILL 0x01
+#define CODED_SEGMENT_MAX (SEGMENT_SIZE + SEGMENT_SECTORS)
 
 // Define status codes
 typedef enum {
@@ -45,6 +103,7 @@ typedef enum {
     FILE_SEEK_ERROR = 9,
     MEMORY_ALLOCATION_ERROR = 10,
     PORT_NOT_INITIALIZED = 11,
+    LINK_RESTARTED = 12,      // a startup handshake arrived in place of a request
   // Additional status codes as needed
 } ResponseStatus;
 
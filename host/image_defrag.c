@@ -0,0 +1,165 @@
+// Rewrites fragmented disk images on an SD card into one contiguous
+// allocation, so the Pico can read and write them with raw sector access
+// instead of going through FatFs. Runs FatFs over the same disk layer as the
+// simulator, so CARD can be a dd image of the card or its block device.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "ff.h"
+#include "f_util.h"
+#include "sim_card.h"
+
+#define COPY_SECTORS 64
+#define LINK_MAP_INITIAL_ENTRIES 16
+#define TEMP_NAME "defrag.tmp"
+
+// Fragments in an open file, from a FatFs fast-seek table, or -1 on error
+static long count_fragments(FIL *file) {
+#if FF_USE_FASTSEEK
+    DWORD size = LINK_MAP_INITIAL_ENTRIES;
+    DWORD *table = NULL;
+    FRESULT fr;
+    do {
+        free(table);
+        table = malloc(size * sizeof(DWORD));
+        if (table == NULL) {
+            return -1;
+        }
+        table[0] = size;
+        file->cltbl = table;
+        fr = f_lseek(file, CREATE_LINKMAP);
+        size = table[0];
+    } while (fr == FR_NOT_ENOUGH_CORE);
+    file->cltbl = NULL;
+    free(table);
+    return fr == FR_OK ? (long)(size - 2) / 2 : -1;
+#else
+    (void)file;
+    return -1;
+#endif
+}
+
+static bool copy_file(FIL *from, FIL *to) {
+    static BYTE buffer[COPY_SECTORS * 512];
+    UINT moved;
+    do {
+        if (f_read(from, buffer, sizeof(buffer), &moved) != FR_OK) {
+            return false;
+        }
+        UINT written;
+        if (moved > 0 && (f_write(to, buffer, moved, &written) != FR_OK || written != moved)) {
+            return false;
+        }
+    } while (moved == sizeof(buffer));
+    return true;
+}
+
+// Copies the image into a contiguous preallocation, then swaps it in for the
+// original. The original stays untouched until the copy is complete.
+static bool defragment(const char *name) {
+#if FF_USE_EXPAND
+    FIL image, copy;
+    FRESULT fr = f_open(&image, name, FA_OPEN_EXISTING | FA_READ);
+    if (fr != FR_OK) {
+        printf("%s: %s\n", name, FRESULT_str(fr));
+        return false;
+    }
+    FSIZE_t size = f_size(&image);
+    fr = f_open(&copy, TEMP_NAME, FA_CREATE_ALWAYS | FA_WRITE);
+    if (fr == FR_OK) {
+        fr = f_expand(&copy, size, 1);
+        if (fr == FR_DENIED) {
+            printf("%s: no contiguous free space for %llu bytes\n", name, (unsigned long long)size);
+        }
+    }
+    bool copied = fr == FR_OK && copy_file(&image, &copy);
+    f_close(&image);
+    f_close(&copy);
+    if (!copied) {
+        printf("%s: copy failed: %s\n", name, FRESULT_str(fr));
+        f_unlink(TEMP_NAME);
+        return false;
+    }
+    fr = f_unlink(name);
+    if (fr == FR_OK) {
+        fr = f_rename(TEMP_NAME, name);
+    }
+    if (fr != FR_OK) {
+        printf("%s: swapping in the copy failed, it is left as %s: %s\n", name, TEMP_NAME, FRESULT_str(fr));
+        return false;
+    }
+    return true;
+#else
+    printf("%s: built without FF_USE_EXPAND, can only --check\n", name);
+    return false;
+#endif
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s --card CARD [--check] IMAGE...\n"
+        "  --card CARD   SD card block device or an image of the whole card\n"
+        "  --check       only report how many fragments each image has\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        { "card", required_argument, NULL, 'c' },
+        { "check", no_argument, NULL, 'k' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *card = NULL;
+    bool check_only = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': card = optarg; break;
+            case 'k': check_only = true; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (card == NULL || optind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!sim_card_open(card)) {
+        return 1;
+    }
+    FATFS fs;
+    FRESULT fr = f_mount(&fs, "", 1);
+    if (fr != FR_OK) {
+        fprintf(stderr, "f_mount: %s\n", FRESULT_str(fr));
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = optind; i < argc; i++) {
+        const char *name = argv[i];
+        FIL image;
+        fr = f_open(&image, name, FA_OPEN_EXISTING | FA_READ);
+        if (fr != FR_OK) {
+            printf("%s: %s\n", name, FRESULT_str(fr));
+            failures++;
+            continue;
+        }
+        long fragments = count_fragments(&image);
+        f_close(&image);
+        printf("%s: %ld fragments\n", name, fragments);
+        if (check_only || fragments == 1) {
+            continue;
+        }
+        if (!defragment(name)) {
+            failures++;
+            continue;
+        }
+        f_open(&image, name, FA_OPEN_EXISTING | FA_READ);
+        printf("%s: rewritten, now %ld fragments\n", name, count_fragments(&image));
+        f_close(&image);
+    }
+    f_unmount("");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,9 @@
+#ifndef HOST_CONIO_H
+#define HOST_CONIO_H
+
+#include <stdint.h>
+
+static inline uint8_t inp(unsigned port) { (void)port; return 0; }
+static inline void outp(unsigned port, uint8_t value) { (void)port; (void)value; }
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef HOST_DOS_H
+#define HOST_DOS_H
+
+// Host stand-in for the Open Watcom DOS headers used by the Victor driver.
+// Far/near/interrupt qualifiers vanish and segment:offset addresses map into
+// a 64k scratch window so memory mapped registers have somewhere to land.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define far
+#define near
+#define interrupt
+#define __far
+#define __near
+#define __interrupt
+
+extern uint8_t sim_mmio[0x10000];
+
+#define MK_FP(seg, off) ((void *)&sim_mmio[((((uint32_t)(seg)) << 4) + (off)) & 0xFFFF])
+#define FP_SEG(p) ((unsigned)(((uintptr_t)(p)) >> 4) & 0xFFFF)
+#define FP_OFF(p) ((unsigned)((uintptr_t)(p)) & 0x000F)
+
+#define _fmemcpy memcpy
+#define _fmemset memset
+
+static inline void _chain_intr(void (*isr)()) { (void)isr; }
+static inline void (*_dos_getvect(unsigned intno))() { (void)intno; return NULL; }
+static inline void _dos_setvect(unsigned intno, void (*isr)()) { (void)intno; (void)isr; }
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HOST_HARDWARE_CLOCKS_H
+#define HOST_HARDWARE_CLOCKS_H
+
+#include "pico/stdlib.h"
+
+enum clock_index {
+    clk_sys = 5,
+};
+
+// RP2350 default system clock
+static inline uint32_t clock_get_hz(enum clock_index clk_index) {
+    (void)clk_index;
+    return 150000000;
+}
+
+#endif
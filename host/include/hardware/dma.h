@@ -0,0 +1,105 @@
+#ifndef HOST_HARDWARE_DMA_H
+#define HOST_HARDWARE_DMA_H
+
+// Host stand-in for the DMA controller. Channels paced by a PIO DREQ move bytes
+// through the simulated link FIFOs on a background engine thread, see sim_dma.c.
+
+#include "pico/stdlib.h"
+
+#define NUM_DMA_CHANNELS 16
+#define DREQ_FORCE 0x3f
+#define DMA_IRQ_0 10
+#define DMA_IRQ_1 11
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+// Channel register block. Registers are pointer sized on the host so control
+// blocks holding { count, read address } keep the device's two-register layout;
+// the engine treats DMA_SIZE_32 writes into this block as register writes.
+typedef struct {
+    volatile uintptr_t read_addr;
+    volatile uintptr_t write_addr;
+    volatile uintptr_t transfer_count;
+    volatile uintptr_t ctrl_trig;
+    volatile uintptr_t al1_ctrl;
+    volatile uintptr_t al1_read_addr;
+    volatile uintptr_t al1_write_addr;
+    volatile uintptr_t al1_transfer_count_trig;
+    volatile uintptr_t al2_ctrl;
+    volatile uintptr_t al2_transfer_count;
+    volatile uintptr_t al2_read_addr;
+    volatile uintptr_t al2_write_addr_trig;
+    volatile uintptr_t al3_ctrl;
+    volatile uintptr_t al3_write_addr;
+    volatile uintptr_t al3_transfer_count;
+    volatile uintptr_t al3_read_addr_trig;
+} dma_channel_hw_t;
+
+typedef struct {
+    dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+} dma_hw_t;
+
+extern dma_hw_t sim_dma_hw;
+#define dma_hw (&sim_dma_hw)
+
+typedef struct {
+    enum dma_channel_transfer_size size;
+    bool read_increment;
+    bool write_increment;
+    uint dreq;
+    uint chain_to;
+    bool irq_quiet;
+    bool enable;
+    bool ring_write;
+    uint ring_size_bits;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+dma_channel_config dma_channel_get_default_config(uint channel);
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) { c->size = size; }
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr) { c->read_increment = incr; }
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr) { c->write_increment = incr; }
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) { c->dreq = dreq; }
+static inline void channel_config_set_chain_to(dma_channel_config *c, uint chain_to) { c->chain_to = chain_to; }
+static inline void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet) { c->irq_quiet = irq_quiet; }
+static inline void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits) {
+    c->ring_write = write;
+    c->ring_size_bits = size_bits;
+}
+static inline void channel_config_set_enable(dma_channel_config *c, bool enable) { c->enable = enable; }
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_set_config(uint channel, const dma_channel_config *config, bool trigger);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger);
+void dma_channel_start(uint channel);
+void dma_start_channel_mask(uint32_t chan_mask);
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_wait_for_finish_blocking(uint channel);
+
+static inline dma_channel_hw_t *dma_channel_hw_addr(uint channel) { return &dma_hw->ch[channel]; }
+
+// The sniffer only models CRC-16/CCITT over 8 bit transfers, all the link uses
+#define DMA_SNIFF_CTRL_CALC_VALUE_CRC16 0x2
+void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable);
+void dma_sniffer_disable(void);
+void dma_sniffer_set_data_accumulator(uint32_t seed_value);
+uint32_t dma_sniffer_get_data_accumulator(void);
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq0_status(uint channel);
+void dma_channel_acknowledge_irq0(uint channel);
+void dma_channel_set_irq1_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq1_status(uint channel);
+void dma_channel_acknowledge_irq1(uint channel);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef HOST_HARDWARE_PIO_H
+#define HOST_HARDWARE_PIO_H
+
+// Host stand-in for the PIO block. The receive state machine reads from the
+// Victor-to-Pico byte FIFO and the transmit state machine writes the
+// Pico-to-Victor FIFO, see sim_link.c.
+
+#include "pico/stdlib.h"
+
+typedef struct {
+    uint32_t txf[4];
+    uint32_t rxf[4];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio_hw[2];
+#define pio0 (&sim_pio_hw[0])
+#define pio1 (&sim_pio_hw[1])
+
+typedef struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+typedef struct {
+    uint32_t clkdiv;
+    uint32_t execctrl;
+    uint32_t shiftctrl;
+    uint32_t pinctrl;
+} pio_sm_config;
+
+enum pio_fifo_join {
+    PIO_FIFO_JOIN_NONE = 0,
+    PIO_FIFO_JOIN_TX = 1,
+    PIO_FIFO_JOIN_RX = 2,
+};
+
+int pio_claim_unused_sm(PIO pio, bool required);
+bool pio_sm_is_claimed(PIO pio, uint sm);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+
+// DREQ numbering follows the RP2040 / RP2350 layout for PIO0 and PIO1
+static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return (pio == pio0 ? 0 : 8) + (is_tx ? 0 : 4) + sm;
+}
+
+static inline void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) { (void)pio; (void)sm; (void)enabled; }
+static inline void pio_sm_clear_fifos(PIO pio, uint sm) { (void)pio; (void)sm; }
+static inline void pio_sm_restart(PIO pio, uint sm) { (void)pio; (void)sm; }
+static inline void pio_sm_set_clkdiv(PIO pio, uint sm, float div) { (void)pio; (void)sm; (void)div; }
+static inline void pio_gpio_init(PIO pio, uint pin) { (void)pio; (void)pin; }
+static inline void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin, uint count, bool is_out) {
+    (void)pio; (void)sm; (void)pin; (void)count; (void)is_out;
+}
+static inline void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {
+    (void)pio; (void)sm; (void)initial_pc; (void)config;
+}
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_I86_H
+#define HOST_I86_H
+
+#include "dos.h"
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_PICO_MULTICORE_H
+#define HOST_PICO_MULTICORE_H
+
+#include "pico/stdlib.h"
+
+// core 1 is a detached thread
+void multicore_launch_core1(void (*entry)(void));
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+// Host stand-in for the parts of the Pico SDK used by pico/lib, so the firmware
+// logic runs unmodified inside the link simulator. Hardware calls are no-ops.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#define PICO_ON_DEVICE 0
+
+#define __not_in_flash_func(func_name) func_name
+#define __noinline __attribute__((noinline))
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+enum gpio_function {
+    GPIO_FUNC_SIO = 5,
+    GPIO_FUNC_PIO0 = 6,
+    GPIO_FUNC_PIO1 = 7,
+};
+
+enum gpio_drive_strength {
+    GPIO_DRIVE_STRENGTH_2MA = 0,
+    GPIO_DRIVE_STRENGTH_4MA = 1,
+    GPIO_DRIVE_STRENGTH_8MA = 2,
+    GPIO_DRIVE_STRENGTH_12MA = 3,
+};
+
+static inline void stdio_init_all(void) {}
+static inline void gpio_init(uint gpio) { (void)gpio; }
+static inline void gpio_set_dir(uint gpio, bool out) { (void)gpio; (void)out; }
+static inline void gpio_put(uint gpio, bool value) { (void)gpio; (void)value; }
+static inline void gpio_set_function(uint gpio, enum gpio_function fn) { (void)gpio; (void)fn; }
+static inline void gpio_set_input_enabled(uint gpio, bool enabled) { (void)gpio; (void)enabled; }
+static inline void gpio_set_drive_strength(uint gpio, enum gpio_drive_strength drive) { (void)gpio; (void)drive; }
+// the cores and the DMA engine are threads, a spinning core lets them run
+static inline void tight_loop_contents(void) { sched_yield(); }
+
+uint64_t time_us_64(void);
+static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+
+typedef uint64_t absolute_time_t;
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+// a yield, like __wfe, the caller loops until its deadline or event
+static inline bool best_effort_wfe_or_timeout(absolute_time_t timeout) {
+    sched_yield();
+    return time_us_64() >= timeout;
+}
+
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+void busy_wait_us(uint64_t us);
+void panic(const char *fmt, ...) __attribute__((noreturn));
+
+#endif
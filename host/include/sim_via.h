@@ -0,0 +1,28 @@
+#ifndef HOST_SIM_VIA_H
+#define HOST_SIM_VIA_H
+
+// Host simulator replacements for the user port VIA data path. Bytes written
+// by the Victor side land in the Pico's receive FIFO, and bytes the Pico
+// transmits are read back here, see sim_link.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dos.h"
+
+void sim_via_write(uint8_t value);
+bool sim_via_data_taken(void);
+bool sim_via_data_ready(void);
+uint8_t sim_via_read(void);
+void sim_delay_us(unsigned int n);
+
+#define VIA_WRITE_DATA(value)  sim_via_write(value)
+#define VIA_DATA_TAKEN()       sim_via_data_taken()
+#define VIA_DATA_READY()       sim_via_data_ready()
+#define VIA_READ_DATA()        sim_via_read()
+
+#define delay_us(n) sim_delay_us(n)
+#define Enable()
+#define Disable()
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HOST_TRANSMIT_FIFO_PIO_H
+#define HOST_TRANSMIT_FIFO_PIO_H
+
+// Host stand-in for the header pioasm generates from pico/lib/transmit_fifo.pio
+
+#include "hardware/pio.h"
+
+static const struct pio_program transmit_fifo_program = {
+    .instructions = NULL,
+    .length = 0,
+    .origin = -1,
+};
+
+static inline void transmit_fifo_init(PIO pio, uint sm, uint offset, float clk_div) {
+    (void)pio; (void)sm; (void)offset; (void)clk_div;
+}
+
+#endif
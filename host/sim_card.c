@@ -0,0 +1,135 @@
+// FatFs disk I/O layer backed by a FAT formatted card image on the host, in
+// place of the SDIO driver. The latency model charges a fixed cost per card
+// command plus a per sector transfer cost, roughly a 4-bit SDIO bus.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ff.h"
+#include "diskio.h"
+#include "f_util.h"
+#include "sim_link.h"
+#include "sim_card.h"
+
+#define CARD_SECTOR_SIZE 512
+
+static int card_fd = -1;
+static LBA_t card_sectors;
+static uint32_t card_command_us;
+static uint32_t card_sector_us;
+static SimCardStats card_stats;
+
+bool sim_card_open(const char *image_path) {
+    card_fd = open(image_path, O_RDWR);
+    if (card_fd < 0) {
+        perror(image_path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(card_fd, &st) != 0) {
+        perror(image_path);
+        return false;
+    }
+    card_sectors = st.st_size / CARD_SECTOR_SIZE;
+    return true;
+}
+
+void sim_card_set_latency(uint32_t command_us, uint32_t sector_us) {
+    card_command_us = command_us;
+    card_sector_us = sector_us;
+}
+
+void sim_card_stats(SimCardStats *stats) {
+    *stats = card_stats;
+}
+
+static void card_delay(UINT count) {
+    sim_spin_ns(((uint64_t)card_command_us + (uint64_t)card_sector_us * count) * 1000);
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+    return (pdrv == 0 && card_fd >= 0) ? 0 : STA_NOINIT;
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+    return disk_status(pdrv);
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
+    if (disk_status(pdrv) != 0) {
+        return RES_NOTRDY;
+    }
+    ssize_t length = (ssize_t)count * CARD_SECTOR_SIZE;
+    if (pread(card_fd, buff, length, (off_t)sector * CARD_SECTOR_SIZE) != length) {
+        return RES_ERROR;
+    }
+    card_delay(count);
+    card_stats.reads++;
+    card_stats.sectors_read += count;
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count) {
+    if (disk_status(pdrv) != 0) {
+        return RES_NOTRDY;
+    }
+    ssize_t length = (ssize_t)count * CARD_SECTOR_SIZE;
+    if (pwrite(card_fd, buff, length, (off_t)sector * CARD_SECTOR_SIZE) != length) {
+        return RES_ERROR;
+    }
+    card_delay(count);
+    card_stats.writes++;
+    card_stats.sectors_written += count;
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    if (disk_status(pdrv) != 0) {
+        return RES_NOTRDY;
+    }
+    switch (cmd) {
+        case CTRL_SYNC:
+            return fsync(card_fd) == 0 ? RES_OK : RES_ERROR;
+        case GET_SECTOR_COUNT:
+            *(LBA_t *)buff = card_sectors;
+            return RES_OK;
+        case GET_SECTOR_SIZE:
+            *(WORD *)buff = CARD_SECTOR_SIZE;
+            return RES_OK;
+        case GET_BLOCK_SIZE:
+            *(DWORD *)buff = 1;
+            return RES_OK;
+        default:
+            return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void) {
+    // 2024-01-01 00:00:00, keeps image contents reproducible between runs
+    return ((DWORD)(2024 - 1980) << 25) | ((DWORD)1 << 21) | ((DWORD)1 << 16);
+}
+
+const char *FRESULT_str(FRESULT i) {
+    static const char *const names[] = {
+        "Succeeded", "A hard error occurred in the low level disk I/O layer",
+        "Assertion failed", "The physical drive cannot work", "Could not find the file",
+        "Could not find the path", "The path name format is invalid",
+        "Access denied due to prohibited access or directory full",
+        "Access denied due to prohibited access", "The file/directory object is invalid",
+        "The physical drive is write protected", "The logical drive number is invalid",
+        "The volume has no work area", "There is no valid FAT volume",
+        "The f_mkfs() aborted due to any problem",
+        "Could not get a grant to access the volume within defined period",
+        "The operation is rejected according to the file sharing policy",
+        "LFN working buffer could not be allocated",
+        "Number of open files > FF_FS_LOCK", "Given parameter is invalid",
+    };
+    if ((unsigned)i < sizeof(names) / sizeof(names[0])) {
+        return names[i];
+    }
+    return "Unknown";
+}
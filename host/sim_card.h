@@ -0,0 +1,19 @@
+#ifndef SIM_CARD_H
+#define SIM_CARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Access counters and latency model for the simulated SD card
+typedef struct {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+} SimCardStats;
+
+bool sim_card_open(const char *image_path);
+void sim_card_set_latency(uint32_t command_us, uint32_t sector_us);
+void sim_card_stats(SimCardStats *stats);
+
+#endif
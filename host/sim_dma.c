@@ -0,0 +1,432 @@
+// DMA controller model. A background thread plays the part of the DMA engine:
+// triggered channels move one element at a time, paced by their DREQ, so a
+// PIO paced channel only advances while the simulated link has bytes (RX) or
+// FIFO room (TX). Completion clears busy, fires chain_to and raises the
+// channel's DMA_IRQ_0 / DMA_IRQ_1 lines. Writes into the alias registers of
+// dma_hw reprogram and trigger the target channel, which is what control block
+// chains rely on. transfer_count in dma_hw reads back the count still to go,
+// and the sniffer runs CRC-16/CCITT over the bytes of the channel it watches.
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "sim_link.h"
+
+typedef struct {
+    bool claimed;
+    dma_channel_config config;
+    volatile uint8_t *read_addr;
+    volatile uint8_t *write_addr;
+    uint32_t trans_count;       // reload value, as written by the firmware
+    uint32_t remaining;
+    _Atomic bool busy;
+    bool irq_enabled[2];
+    _Atomic bool irq_status[2];
+} SimDmaChannel;
+
+#define MAX_IRQ_HANDLERS 4
+
+typedef struct {
+    irq_handler_t handlers[MAX_IRQ_HANDLERS];
+    int handler_count;
+    bool enabled;
+} SimDmaIrq;
+
+dma_hw_t sim_dma_hw;
+
+static SimDmaChannel channels[NUM_DMA_CHANNELS];
+static SimDmaIrq dma_irqs[2];
+
+static void dma_raise_irq(SimDmaChannel *channel);
+static struct {
+    bool enabled;
+    uint channel;
+    _Atomic uint32_t accumulator;
+} sniffer;
+
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t engine_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t engine_thread;
+static bool engine_started;
+
+static bool is_pio_fifo(const volatile void *addr, bool tx) {
+    for (int p = 0; p < 2; p++) {
+        const volatile void *fifo = tx ? (const volatile void *)sim_pio_hw[p].txf : (const volatile void *)sim_pio_hw[p].rxf;
+        if ((const volatile uint8_t *)addr >= (const volatile uint8_t *)fifo &&
+            (const volatile uint8_t *)addr < (const volatile uint8_t *)fifo + sizeof(sim_pio_hw[p].txf)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_dma_register(const volatile void *addr) {
+    return (const volatile uint8_t *)addr >= (const volatile uint8_t *)&sim_dma_hw &&
+           (const volatile uint8_t *)addr < (const volatile uint8_t *)&sim_dma_hw + sizeof(sim_dma_hw);
+}
+
+// Applies a write into the register block, only the registers firmware uses
+static void dma_register_written(const volatile uintptr_t *reg) {
+    size_t offset = (size_t)((const volatile uint8_t *)reg - (const volatile uint8_t *)&sim_dma_hw);
+    uint index = offset / sizeof(dma_channel_hw_t);
+    dma_channel_hw_t *hw = &sim_dma_hw.ch[index];
+    SimDmaChannel *channel = &channels[index];
+
+    if (reg == &hw->read_addr || reg == &hw->al1_read_addr || reg == &hw->al2_read_addr) {
+        channel->read_addr = (volatile uint8_t *)*reg;
+    } else if (reg == &hw->write_addr || reg == &hw->al1_write_addr || reg == &hw->al3_write_addr) {
+        channel->write_addr = (volatile uint8_t *)*reg;
+    } else if (reg == &hw->transfer_count || reg == &hw->al2_transfer_count || reg == &hw->al3_transfer_count) {
+        channel->trans_count = (uint32_t)*reg;
+    } else if (reg == &hw->al3_read_addr_trig) {
+        channel->read_addr = (volatile uint8_t *)*reg;
+        if (*reg == 0) {
+            // null trigger: nothing starts, an IRQ_QUIET channel raises its interrupt
+            if (channel->config.irq_quiet) {
+                dma_raise_irq(channel);
+            }
+        } else {
+            dma_channel_start(index);
+        }
+    } else if (reg == &hw->al1_transfer_count_trig) {
+        channel->trans_count = (uint32_t)*reg;
+        dma_channel_start(index);
+    } else if (reg == &hw->al2_write_addr_trig) {
+        channel->write_addr = (volatile uint8_t *)*reg;
+        dma_channel_start(index);
+    } else {
+        panic("sim_dma: unmodelled DMA register write at offset %zu\n", offset);
+    }
+}
+
+static volatile uint8_t *dma_advance(volatile uint8_t *addr, uint32_t size, bool ring, uint ring_size_bits) {
+    if (!ring || ring_size_bits == 0) {
+        return addr + size;
+    }
+    uintptr_t mask = ((uintptr_t)1 << ring_size_bits) - 1;
+    uintptr_t base = (uintptr_t)addr & ~mask;
+    return (volatile uint8_t *)(base | (((uintptr_t)addr + size) & mask));
+}
+
+static void dma_sniff(uint8_t byte) {
+    uint32_t crc = atomic_load_explicit(&sniffer.accumulator, memory_order_relaxed) ^ ((uint32_t)byte << 8);
+    for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    atomic_store_explicit(&sniffer.accumulator, crc & 0xFFFF, memory_order_relaxed);
+}
+
+// Moves one element for the channel, returns false when its DREQ holds it back
+static bool dma_step(SimDmaChannel *channel) {
+    uint32_t size = 1u << channel->config.size;
+    bool register_write = is_dma_register(channel->write_addr);
+    if (register_write && channel->config.size == DMA_SIZE_32) {
+        size = sizeof(uintptr_t);
+    }
+    uint8_t element[sizeof(uintptr_t)] = {0};
+
+    if (is_pio_fifo(channel->read_addr, false)) {
+        uint8_t value;
+        if (!sim_link_pico_rx(&value)) {
+            return false;
+        }
+        element[0] = value;
+    } else {
+        memcpy(element, (const void *)channel->read_addr, size);
+    }
+
+    if (is_pio_fifo(channel->write_addr, true)) {
+        if (!sim_link_pico_tx(element[0])) {
+            return false;   // a PIO source never pairs with a PIO sink, nothing is lost here
+        }
+    } else {
+        memcpy((void *)channel->write_addr, element, size);
+    }
+    volatile uint8_t *written = channel->write_addr;
+
+    if (channel->config.read_increment) {
+        channel->read_addr = dma_advance(channel->read_addr, size,
+                                         !channel->config.ring_write, channel->config.ring_size_bits);
+    }
+    if (channel->config.write_increment) {
+        channel->write_addr = dma_advance(channel->write_addr, size,
+                                          channel->config.ring_write, channel->config.ring_size_bits);
+    }
+    if (register_write) {
+        dma_register_written((const volatile uintptr_t *)written);
+    }
+    uint index = (uint)(channel - channels);
+    if (sniffer.enabled && sniffer.channel == index && channel->config.size == DMA_SIZE_8) {
+        dma_sniff(element[0]);
+    }
+    channel->remaining--;
+    sim_dma_hw.ch[index].transfer_count = channel->remaining;
+    return true;
+}
+
+static void dma_complete(uint index) {
+    SimDmaChannel *channel = &channels[index];
+    atomic_store_explicit(&channel->busy, false, memory_order_release);
+    if (channel->config.chain_to != index) {
+        dma_channel_start(channel->config.chain_to);
+    }
+    if (!channel->config.irq_quiet) {
+        dma_raise_irq(channel);
+    }
+}
+
+static void dma_raise_irq(SimDmaChannel *channel) {
+    for (int line = 0; line < 2; line++) {
+        if (!channel->irq_enabled[line]) {
+            continue;
+        }
+        atomic_store(&channel->irq_status[line], true);
+        if (dma_irqs[line].enabled) {
+            for (int h = 0; h < dma_irqs[line].handler_count; h++) {
+                dma_irqs[line].handlers[h]();
+            }
+        }
+    }
+}
+
+static void *dma_engine(void *arg) {
+    (void)arg;
+    while (true) {
+        bool any_busy = false;
+        bool progressed = false;
+        for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+            SimDmaChannel *channel = &channels[i];
+            if (!atomic_load_explicit(&channel->busy, memory_order_acquire)) {
+                continue;
+            }
+            any_busy = true;
+            // a burst per pass keeps the engine from starving the other threads
+            for (int burst = 0; burst < 64 && channel->remaining > 0; burst++) {
+                if (!dma_step(channel)) {
+                    break;
+                }
+                progressed = true;
+            }
+            if (channel->remaining == 0) {
+                dma_complete(i);
+            }
+        }
+        if (!any_busy) {
+            pthread_mutex_lock(&engine_lock);
+            bool idle = true;
+            for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+                if (atomic_load(&channels[i].busy)) {
+                    idle = false;
+                }
+            }
+            if (idle) {
+                pthread_cond_wait(&engine_wake, &engine_lock);
+            }
+            pthread_mutex_unlock(&engine_lock);
+        } else if (!progressed) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+int dma_claim_unused_channel(bool required) {
+    pthread_mutex_lock(&engine_lock);
+    if (!engine_started) {
+        pthread_create(&engine_thread, NULL, dma_engine, NULL);
+        pthread_detach(engine_thread);
+        engine_started = true;
+    }
+    int found = -1;
+    for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (!channels[i].claimed) {
+            channels[i].claimed = true;
+            found = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&engine_lock);
+    if (found < 0 && required) {
+        panic("No DMA channels are available\n");
+    }
+    return found;
+}
+
+void dma_channel_unclaim(uint channel) {
+    channels[channel].claimed = false;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    dma_channel_config config = {
+        .size = DMA_SIZE_32,
+        .read_increment = true,
+        .write_increment = false,
+        .dreq = DREQ_FORCE,
+        .chain_to = channel,
+        .irq_quiet = false,
+        .enable = true,
+    };
+    return config;
+}
+
+void dma_channel_start(uint channel) {
+    SimDmaChannel *ch = &channels[channel];
+    ch->remaining = ch->trans_count;
+    sim_dma_hw.ch[channel].transfer_count = ch->remaining;
+    if (ch->remaining == 0) {
+        dma_complete(channel);
+        return;
+    }
+    pthread_mutex_lock(&engine_lock);
+    atomic_store_explicit(&ch->busy, true, memory_order_release);
+    pthread_cond_signal(&engine_wake);
+    pthread_mutex_unlock(&engine_lock);
+}
+
+void dma_start_channel_mask(uint32_t chan_mask) {
+    for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (chan_mask & (1u << i)) {
+            dma_channel_start(i);
+        }
+    }
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger) {
+    SimDmaChannel *ch = &channels[channel];
+    ch->config = *config;
+    ch->write_addr = (volatile uint8_t *)write_addr;
+    ch->read_addr = (volatile uint8_t *)read_addr;
+    ch->trans_count = transfer_count;
+    if (trigger) {
+        dma_channel_start(channel);
+    }
+}
+
+void dma_channel_set_config(uint channel, const dma_channel_config *config, bool trigger) {
+    channels[channel].config = *config;
+    if (trigger) {
+        dma_channel_start(channel);
+    }
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger) {
+    channels[channel].read_addr = (volatile uint8_t *)read_addr;
+    if (trigger) {
+        dma_channel_start(channel);
+    }
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger) {
+    channels[channel].write_addr = (volatile uint8_t *)write_addr;
+    if (trigger) {
+        dma_channel_start(channel);
+    }
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger) {
+    channels[channel].trans_count = trans_count;
+    if (trigger) {
+        dma_channel_start(channel);
+    }
+}
+
+void dma_channel_abort(uint channel) {
+    atomic_store(&channels[channel].busy, false);
+}
+
+bool dma_channel_is_busy(uint channel) {
+    return atomic_load_explicit(&channels[channel].busy, memory_order_acquire);
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel) {
+    while (dma_channel_is_busy(channel)) {
+        sched_yield();
+    }
+}
+
+// Only read and reseeded between transfers, so the engine needs no lock
+void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable) {
+    (void)mode;
+    (void)force_channel_enable;
+    sniffer.channel = channel;
+    sniffer.enabled = true;
+}
+
+void dma_sniffer_disable(void) {
+    sniffer.enabled = false;
+}
+
+void dma_sniffer_set_data_accumulator(uint32_t seed_value) {
+    atomic_store(&sniffer.accumulator, seed_value);
+}
+
+uint32_t dma_sniffer_get_data_accumulator(void) {
+    return atomic_load(&sniffer.accumulator);
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+    channels[channel].irq_enabled[0] = enabled;
+}
+
+bool dma_channel_get_irq0_status(uint channel) {
+    return atomic_load(&channels[channel].irq_status[0]);
+}
+
+void dma_channel_acknowledge_irq0(uint channel) {
+    atomic_store(&channels[channel].irq_status[0], false);
+}
+
+void dma_channel_set_irq1_enabled(uint channel, bool enabled) {
+    channels[channel].irq_enabled[1] = enabled;
+}
+
+bool dma_channel_get_irq1_status(uint channel) {
+    return atomic_load(&channels[channel].irq_status[1]);
+}
+
+void dma_channel_acknowledge_irq1(uint channel) {
+    atomic_store(&channels[channel].irq_status[1], false);
+}
+
+static SimDmaIrq *dma_irq(uint num) {
+    if (num == DMA_IRQ_0) {
+        return &dma_irqs[0];
+    }
+    if (num == DMA_IRQ_1) {
+        return &dma_irqs[1];
+    }
+    return NULL;
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+    SimDmaIrq *irq = dma_irq(num);
+    if (irq != NULL) {
+        if (irq->handler_count != 0) {
+            panic("Exclusive handler on an IRQ that already has one\n");
+        }
+        irq->handlers[irq->handler_count++] = handler;
+    }
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority) {
+    (void)order_priority;
+    SimDmaIrq *irq = dma_irq(num);
+    if (irq != NULL && irq->handler_count < MAX_IRQ_HANDLERS) {
+        irq->handlers[irq->handler_count++] = handler;
+    }
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+    SimDmaIrq *irq = dma_irq(num);
+    if (irq != NULL) {
+        irq->enabled = enabled;
+    }
+}
@@ -0,0 +1,250 @@
+// Simulated user port cable between the Victor driver and the Pico firmware.
+// Each direction is a single producer, single consumer byte ring standing in
+// for the PIO FIFO; the Victor end is polled through the VIA_* macros and the
+// Pico end through pio_sm_get_blocking / pio_sm_put_blocking.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "pico/multicore.h"
+#include "dos.h"
+#include "sim_via.h"
+#include "sim_link.h"
+
+#define RING_SIZE 4096  // power of two, larger than any fifo_depth
+
+typedef struct {
+    uint8_t data[RING_SIZE];
+    _Atomic uint32_t head;  // written by the producer
+    _Atomic uint32_t tail;  // written by the consumer
+    _Atomic uint64_t count;
+} ByteRing;
+
+uint8_t sim_mmio[0x10000];
+pio_hw_t sim_pio_hw[2];
+
+static ByteRing victor_to_pico;
+static ByteRing pico_to_victor;
+static SimLinkConfig link_config = { 0, 2000, 8 };
+static uint8_t claimed_sm[2];
+
+uint64_t sim_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Waits yield so the two sides share a single host core fairly
+void sim_spin_ns(uint64_t ns) {
+    if (ns == 0) {
+        return;
+    }
+    uint64_t until = sim_now_ns() + ns;
+    while (sim_now_ns() < until) {
+        sched_yield();
+    }
+}
+
+void sim_link_init(const SimLinkConfig *config) {
+    link_config = *config;
+    if (link_config.fifo_depth == 0 || link_config.fifo_depth > RING_SIZE) {
+        link_config.fifo_depth = RING_SIZE;
+    }
+}
+
+void sim_link_stats(SimLinkStats *stats) {
+    stats->victor_to_pico = atomic_load(&victor_to_pico.count);
+    stats->pico_to_victor = atomic_load(&pico_to_victor.count);
+}
+
+static uint32_t ring_level(ByteRing *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+static bool ring_try_put(ByteRing *ring, uint8_t value) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= link_config.fifo_depth) {
+        return false;
+    }
+    ring->data[head & (RING_SIZE - 1)] = value;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    atomic_fetch_add_explicit(&ring->count, 1, memory_order_relaxed);
+    return true;
+}
+
+static bool ring_try_get(ByteRing *ring, uint8_t *value) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+        return false;
+    }
+    *value = ring->data[tail & (RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static void ring_put(ByteRing *ring, uint8_t value) {
+    while (!ring_try_put(ring, value)) {
+        sched_yield();
+    }
+}
+
+static uint8_t ring_get(ByteRing *ring) {
+    uint8_t value;
+    while (!ring_try_get(ring, &value)) {
+        sched_yield();
+    }
+    return value;
+}
+
+bool sim_link_pico_rx(uint8_t *value) {
+    return ring_try_get(&victor_to_pico, value);
+}
+
+bool sim_link_pico_tx(uint8_t value) {
+    return ring_try_put(&pico_to_victor, value);
+}
+
+// Victor side, reached through the VIA_* macros in v9_communication.h
+
+void sim_via_write(uint8_t value) {
+    sim_spin_ns(link_config.byte_ns);
+    ring_put(&victor_to_pico, value);
+}
+
+bool sim_via_data_taken(void) {
+    // the PIO acks as soon as it has latched the byte into its FIFO
+    if (ring_level(&victor_to_pico) < link_config.fifo_depth) {
+        return true;
+    }
+    sim_spin_ns(link_config.poll_ns);
+    return false;
+}
+
+bool sim_via_data_ready(void) {
+    if (ring_level(&pico_to_victor) > 0) {
+        return true;
+    }
+    sim_spin_ns(link_config.poll_ns);
+    return false;
+}
+
+uint8_t sim_via_read(void) {
+    sim_spin_ns(link_config.byte_ns);
+    return ring_get(&pico_to_victor);
+}
+
+void sim_delay_us(unsigned int n) {
+    sim_spin_ns((uint64_t)n * 1000);
+}
+
+// Pico side, the pieces of the SDK that pico_communication.c calls
+
+uint64_t time_us_64(void) {
+    static uint64_t boot_ns;
+    if (boot_ns == 0) {
+        boot_ns = sim_now_ns();
+    }
+    return (sim_now_ns() - boot_ns) / 1000;
+}
+
+void sleep_us(uint64_t us) {
+    struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_us((uint64_t)ms * 1000);
+}
+
+void busy_wait_us(uint64_t us) {
+    sim_spin_ns(us * 1000);
+}
+
+void panic(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    exit(1);
+}
+
+static void *core1_thread(void *arg) {
+    void (*entry)(void) = (void (*)(void))arg;
+    entry();
+    return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, core1_thread, (void *)entry) != 0) {
+        panic("Failed to start core 1\n");
+    }
+    pthread_detach(thread);
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    int index = (pio == pio0) ? 0 : 1;
+    if (claimed_sm[index] >= 4) {
+        if (required) {
+            panic("No PIO state machines are available\n");
+        }
+        return -1;
+    }
+    return claimed_sm[index]++;
+}
+
+bool pio_sm_is_claimed(PIO pio, uint sm) {
+    int index = (pio == pio0) ? 0 : 1;
+    return sm < claimed_sm[index];
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+    (void)pio;
+    (void)program;
+    return 0;
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+    (void)pio;
+    (void)sm;
+    return ring_get(&victor_to_pico);
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    (void)pio;
+    (void)sm;
+    ring_put(&pico_to_victor, (uint8_t)data);
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    (void)pio;
+    (void)sm;
+    return ring_level(&victor_to_pico) == 0;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) {
+    (void)pio;
+    (void)sm;
+    return ring_level(&pico_to_victor) >= link_config.fifo_depth;
+}
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) {
+    (void)pio;
+    (void)sm;
+    return ring_level(&victor_to_pico);
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm) {
+    (void)pio;
+    (void)sm;
+    return ring_level(&pico_to_victor);
+}
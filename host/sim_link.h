@@ -0,0 +1,28 @@
+#ifndef SIM_LINK_H
+#define SIM_LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Timing knobs for the simulated user port cable
+typedef struct {
+    uint32_t byte_ns;       // wire time for each byte written or read by the Victor
+    uint32_t poll_ns;       // cost of one VIA flag poll that finds nothing, ~8088 loop
+    uint32_t fifo_depth;    // depth of each PIO FIFO, 8 when joined
+} SimLinkConfig;
+
+typedef struct {
+    uint64_t victor_to_pico;
+    uint64_t pico_to_victor;
+} SimLinkStats;
+
+void sim_link_init(const SimLinkConfig *config);
+void sim_link_stats(SimLinkStats *stats);
+void sim_spin_ns(uint64_t ns);
+
+// Non blocking access to the Pico end of the link for the DMA engine
+bool sim_link_pico_rx(uint8_t *value);
+bool sim_link_pico_tx(uint8_t value);
+uint64_t sim_now_ns(void);
+
+#endif
@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pico_communication.h"
+#include "sd_block_device.h"
+#include "storage_core.h"
+#include "boot_timeline.h"
+#include "sim_pico.h"
+
+static atomic_bool pico_ready;
+
+// Same order as main on the Pico: the card mounts on core 1 while PIO comes
+// up, and the Victor may get busy answers until it is done
+static void *pico_main(void *arg) {
+    (void)arg;
+    boot_mark(BOOT_CONSOLE);
+    storage_core_start("");
+    PIO_state *pio_state = init_pio();
+    atomic_store(&pico_ready, true);
+    wait_for_startup_handshake(pio_state);
+    process_incoming_commands(pio_state);
+    return NULL;
+}
+
+void sim_pico_start(void) {
+    pthread_t pico_thread;
+    pthread_create(&pico_thread, NULL, pico_main, NULL);
+    pthread_detach(pico_thread);
+    while (!atomic_load(&pico_ready)) {
+        sleep_ms(1);
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef SIM_PICO_H
+#define SIM_PICO_H
+
+// Starts the Pico firmware main loop on its own thread and returns once it is
+// waiting for the Victor's startup handshake.
+void sim_pico_start(void);
+
+#endif
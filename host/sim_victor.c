@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "protocols.h"
+#include "dos_device_payloads.h"
+#include "crc8.h"
+#include "v9_communication.h"
+#include "v9_metadata_cache.h"
+#include "sim_victor.h"
+
+// Receive mode of reads and writes, the other requests use interrupts as the
+// driver does
+static ReceiveMode sector_receive_mode = RECEIVE_POLLED;
+
+void sim_victor_sector_receive(ReceiveMode mode) {
+    sector_receive_mode = mode;
+}
+
+// Stands in for the init code memory the driver gives its cache
+static uint8_t cache_buffer[METADATA_CACHE_MAX_SECTORS * SECTOR_SIZE];
+static uint16_t cache_kb = 0;
+
+void sim_victor_metadata_cache(uint16_t kb) {
+    cache_kb = kb;
+}
+
+static void reserve_metadata_cache(const InitPayload *init_payload) {
+    if (metadata_cache_init(cache_buffer, cache_kb * (1024 / SECTOR_SIZE)) == 0) {
+        return;
+    }
+    for (uint8_t i = 0; i < init_payload->num_units; i++) {
+        const VictorBPB *bpb = &init_payload->bpb_array[i];
+        metadata_cache_add_unit(i, metadata_sectors(bpb->bytes_per_sector, bpb->reserved_sectors,
+            bpb->num_fats, bpb->sectors_per_fat, bpb->root_entry_count));
+    }
+}
+
+ResponseStatus sim_victor_init(InitPayload *init_payload, bool framed, IntegrityKind integrity) {
+    set_link_framing(framed);
+    set_link_integrity(integrity);
+    ResponseStatus status = initialize_user_port();
+    if (status != STATUS_OK) {
+        return status;
+    }
+    status = send_startup_handshake();
+    if (status != STATUS_OK) {
+        printf("Error sending startup handshake %u\n", status);
+        return status;
+    }
+
+    Payload request = {0};
+    request.protocol = SD_BLOCK_DEVICE;
+    request.command = DEVICE_INIT;
+    uint8_t init_params[1] = {0};
+    request.params_size = sizeof(init_params);
+    request.params = &init_params[0];
+    uint8_t data[1] = {0};
+    request.data = &data[0];
+    request.data_size = sizeof(data);
+
+    set_receive_mode(RECEIVE_INTERRUPT);
+    status = send_command_payload(&request);
+    if (status != STATUS_OK) {
+        printf("Error: Failed to send DEVICE_INIT command %u\n", status);
+        return status;
+    }
+
+    Payload response = {0};
+    uint8_t response_params[3] = {0};
+    response.params = &response_params[0];
+    response.params_size = sizeof(response_params);
+    response.data = (uint8_t *)init_payload;
+    response.data_size = sizeof(InitPayload);
+    status = receive_response(&response);
+    if (status == STATUS_OK) {
+        reserve_metadata_cache(init_payload);
+    }
+    return status;
+}
+
+// Reads and writes split a transfer as the driver does, whole on a framed link
+// and max_request_sectors() at a time on a stop-and-wait one, with cached
+// metadata sectors copied in place
+static uint16_t request_sectors(uint16_t left) {
+    uint16_t per_request = max_request_sectors();
+    return left > per_request ? per_request : left;
+}
+
+ResponseStatus sim_victor_read(uint8_t unit, uint16_t start_sector, uint16_t sector_count, uint8_t *buffer) {
+    Payload request = {0};
+    request.protocol = SD_BLOCK_DEVICE;
+    request.command = READ_BLOCK;
+
+    ReadParams params = {0};
+    params.drive_number = unit;
+    request.params_size = sizeof(params);
+    request.params = (uint8_t *)&params;
+    uint8_t data[1] = {0};
+    request.data = &data[0];
+    request.data_size = sizeof(data);
+
+    ResponseStatus status = STATUS_OK;
+    for (uint16_t done = 0; done < sector_count && status == STATUS_OK; ) {
+        done += metadata_cache_read(unit, start_sector + done, sector_count - done, buffer + done * SECTOR_SIZE);
+        if (done == sector_count) {
+            break;
+        }
+        uint16_t sectors = metadata_cache_misses(unit, start_sector + done, request_sectors(sector_count - done));
+        params.sector_count = sectors;
+        params.start_sector = start_sector + done;
+        set_receive_mode(sector_receive_mode);
+        status = send_command_payload(&request);
+        if (status != STATUS_OK) {
+            printf("Error: Failed to send READ_BLOCK command %u\n", status);
+            return status;
+        }
+
+        Payload response = {0};
+        uint8_t response_params[3] = {0};
+        response.params = &response_params[0];
+        response.params_size = sizeof(response_params);
+        response.data = buffer + done * SECTOR_SIZE;
+        status = receive_sectors_response(&response, sectors);
+        if (status == STATUS_OK) {
+            metadata_cache_fill(unit, start_sector + done, sectors, response.data);
+        }
+        done += sectors;
+    }
+    return status;
+}
+
+ResponseStatus sim_victor_write(uint8_t unit, uint16_t start_sector, uint16_t sector_count, uint8_t *buffer) {
+    Payload request = {0};
+    request.protocol = SD_BLOCK_DEVICE;
+    request.command = WRITE_NO_VERIFY;
+
+    WriteParams params = {0};
+    params.drive_number = unit;
+    request.params_size = sizeof(params);
+    request.params = (uint8_t *)&params;
+
+    ResponseStatus status = STATUS_OK;
+    for (uint16_t done = 0; done < sector_count && status == STATUS_OK; ) {
+        uint16_t sectors = request_sectors(sector_count - done);
+        params.sector_count = sectors;
+        params.start_sector = start_sector + done;
+        request.data = buffer + done * SECTOR_SIZE;
+        set_receive_mode(sector_receive_mode);
+        status = send_sectors_payload(&request, sectors);
+        if (status != STATUS_OK) {
+            printf("Error: Failed to send WRITE_NO_VERIFY command %u\n", status);
+            metadata_cache_drop(unit, start_sector + done, sectors);
+            return status;
+        }
+
+        Payload response = {0};
+        uint8_t response_params[3] = {0};
+        uint8_t response_data[1] = {0};
+        response.params = &response_params[0];
+        response.params_size = sizeof(response_params);
+        response.data = &response_data[0];
+        response.data_size = sizeof(response_data);
+        status = receive_response(&response);
+        if (status == STATUS_OK && response.params_size > 0) {
+            status = (ResponseStatus)response_params[0];
+        }
+        if (status == STATUS_OK) {
+            metadata_cache_fill(unit, start_sector + done, sectors, request.data);
+        } else {
+            metadata_cache_drop(unit, start_sector + done, sectors);
+        }
+        done += sectors;
+    }
+    return status;
+}
+
+ResponseStatus sim_victor_flush(void) {
+    Payload request = {0};
+    request.protocol = SD_BLOCK_DEVICE;
+    request.command = OUTPUT_FLUSH;
+
+    uint8_t params[1] = {0};
+    request.params_size = sizeof(params);
+    request.params = &params[0];
+    uint8_t data[1] = {0};
+    request.data = &data[0];
+    request.data_size = sizeof(data);
+
+    set_receive_mode(RECEIVE_INTERRUPT);
+    ResponseStatus status = send_command_payload(&request);
+    if (status != STATUS_OK) {
+        printf("Error: Failed to send OUTPUT_FLUSH command %u\n", status);
+        return status;
+    }
+
+    Payload response = {0};
+    uint8_t response_params[3] = {0};
+    uint8_t response_data[1] = {0};
+    response.params = &response_params[0];
+    response.params_size = sizeof(response_params);
+    response.data = &response_data[0];
+    response.data_size = sizeof(response_data);
+    return receive_response(&response);
+}
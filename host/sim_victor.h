@@ -0,0 +1,25 @@
+#ifndef SIM_VICTOR_H
+#define SIM_VICTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "protocols.h"
+#include "dos_device_payloads.h"
+#include "crc8.h"
+#include "v9_communication.h"
+
+// Victor side of the simulator, shaped like deviceInit(), readBlock() and
+// write_block() in victor9k/src so requests cross the link the same way.
+// framed offers single frame requests checked by integrity in the handshake,
+// as the driver does
+ResponseStatus sim_victor_init(InitPayload *init_payload, bool framed, IntegrityKind integrity);
+ResponseStatus sim_victor_read(uint8_t unit, uint16_t start_sector, uint16_t sector_count, uint8_t *buffer);
+ResponseStatus sim_victor_write(uint8_t unit, uint16_t start_sector, uint16_t sector_count, uint8_t *buffer);
+ResponseStatus sim_victor_flush(void);
+// Interrupt mode for reads and writes too, to run the receive ring
+void sim_victor_sector_receive(ReceiveMode mode);
+// Metadata cache of kb, as /C=kb on the driver's CONFIG.SYS line, set before init
+void sim_victor_metadata_cache(uint16_t kb);
+
+#endif
@@ -0,0 +1,419 @@
+// Throughput benchmark for READ_BLOCK / WRITE_NO_VERIFY. Runs a fixed set of
+// workloads either across the simulated link (the default) or straight into
+// execute_sd_block_command (--direct), and reports per request and per phase
+// latency percentiles from the PHASE_* hooks in the Pico code.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "command_dispatch.h"
+#include "sd_block_device.h"
+#include "phase_timing.h"
+#include "payload_pool.h"
+#include "sector_cache.h"
+#include "protocols.h"
+#include "dos_device_payloads.h"
+#include "crc8.h"
+#include "sim_link.h"
+#include "sim_card.h"
+#include "sim_victor.h"
+#include "sim_pico.h"
+#include "v9_communication.h"
+
+#define MAX_BENCH_SECTORS MAX_REQUEST_SECTORS
+
+typedef struct {
+    const char *name;
+    uint8_t read_percent;   // 100 = all reads, 0 = all writes
+    bool sequential;
+    uint16_t min_sectors;
+    uint16_t max_sectors;
+    uint8_t batch;          // extents per request, more than 1 goes as one SD_BLOCK_BATCH
+} Workload;
+
+static const Workload workloads[] = {
+    { "seq-read-1",         100, true,   1,  1, 1 },
+    { "seq-read-4",         100, true,   4,  4, 1 },
+    { "seq-read-8",         100, true,   8,  8, 1 },
+    { "seq-read-16",        100, true,  16, 16, 1 },
+    { "rand-read-1..16",    100, false,  1, 16, 1 },
+    { "seq-read-128",       100, true, 128, 128, 1 },
+    { "seq-write-16",         0, true,  16, 16, 1 },
+    { "seq-write-128",        0, true, 128, 128, 1 },
+    { "rand-write-1..16",     0, false,  1, 16, 1 },
+    { "mixed-70r-1..16",     70, false,  1, 16, 1 },
+    { "rand-read-1..4",     100, false,  1,  4, 1 },
+    { "batch-read-4x1..4",  100, false,  1,  4, 4 },
+    { "batch-70r-4x1..4",    70, false,  1,  4, 4 },
+};
+
+typedef struct {
+    const char *card_image;
+    uint8_t unit;
+    uint32_t requests;
+    bool direct;
+    SimLinkConfig link;
+    uint32_t card_command_us;
+    uint32_t card_sector_us;
+    bool stop_and_wait;
+    IntegrityKind integrity;
+    WritePolicy write_policy;
+    bool no_fill_sectors;
+} BenchOptions;
+
+static SDState *direct_state;
+static uint32_t bench_seed = 1;
+
+static uint32_t bench_random(void) {
+    bench_seed = bench_seed * 1103515245u + 12345u;
+    return (bench_seed >> 16) & 0x7FFF;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t left = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+    return (left > right) - (left < right);
+}
+
+static ResponseStatus direct_init(InitPayload *init_payload) {
+    direct_state = initialize_sd_state("");
+    if (direct_state == NULL) {
+        return GENERAL_ERROR;
+    }
+    uint8_t params[1] = {0};
+    Payload request = { .protocol = SD_BLOCK_DEVICE, .command = DEVICE_INIT, .params_size = 1, .params = params };
+    Payload *response = execute_sd_block_command(direct_state, NULL, &request);
+    if (response == NULL || response->data == NULL) {
+        return GENERAL_ERROR;
+    }
+    memcpy(init_payload, response->data, sizeof(InitPayload));
+    release_payload(response);
+    return STATUS_OK;
+}
+
+// sd_read answers with one response and its 16 bit data_size, where the link
+// streams the sectors, so a direct read of a whole 64 KB goes in two
+#define DIRECT_READ_SECTORS (UINT16_MAX / SECTOR_SIZE)
+
+static ResponseStatus direct_request(uint8_t command, uint8_t unit, uint16_t start_sector, uint16_t sector_count, uint8_t *buffer) {
+    if (command == READ_BLOCK && sector_count > DIRECT_READ_SECTORS) {
+        ResponseStatus status = direct_request(command, unit, start_sector, DIRECT_READ_SECTORS, buffer);
+        if (status != STATUS_OK) {
+            return status;
+        }
+        return direct_request(command, unit, start_sector + DIRECT_READ_SECTORS, sector_count - DIRECT_READ_SECTORS,
+                              buffer + DIRECT_READ_SECTORS * SECTOR_SIZE);
+    }
+    ReadParams params = {0};
+    params.drive_number = unit;
+    params.start_sector = start_sector;
+    params.sector_count = sector_count;
+    Payload request = {0};
+    request.protocol = SD_BLOCK_DEVICE;
+    request.command = command;
+    request.params_size = sizeof(params);
+    request.params = (uint8_t *)&params;
+    if (command != READ_BLOCK) {
+        request.data = buffer;
+        request.data_size = sector_count * SECTOR_SIZE;
+    }
+    Payload *response = execute_sd_block_command(direct_state, NULL, &request);
+    PHASE_COMMIT();
+    ResponseStatus status = (response == NULL) ? GENERAL_ERROR : response->status;
+    release_payload(response);
+    return status;
+}
+
+static ResponseStatus bench_request(const BenchOptions *options, bool read, uint16_t start_sector, uint16_t sector_count, uint8_t *buffer) {
+    if (options->direct) {
+        return direct_request(read ? READ_BLOCK : WRITE_NO_VERIFY, options->unit, start_sector, sector_count, buffer);
+    }
+    if (read) {
+        return sim_victor_read(options->unit, start_sector, sector_count, buffer);
+    }
+    return sim_victor_write(options->unit, start_sector, sector_count, buffer);
+}
+
+static ResponseStatus direct_batch(BatchEntry *entries, uint8_t count, uint8_t *write_data, uint8_t *read_data) {
+    Payload request = {0};
+    request.protocol = SD_BLOCK_BATCH;
+    request.params_size = count * sizeof(BatchEntry);
+    request.params = (uint8_t *)entries;
+    request.data = write_data;
+    for (uint8_t i = 0; i < count; i++) {
+        if (entries[i].command != READ_BLOCK) {
+            request.data_size += entries[i].params.sector_count * SECTOR_SIZE;
+        }
+    }
+    Payload *response = dispatch_command(direct_state, NULL, &request);
+    PHASE_COMMIT();
+    ResponseStatus status = (response == NULL) ? GENERAL_ERROR : response->status;
+    if (response != NULL && response->data_size > 0) {
+        memcpy(read_data, response->data, response->data_size);
+    }
+    release_payload(response);
+    return status;
+}
+
+// The write entries' sectors go at the start of buffer, the reads land after them
+static ResponseStatus bench_batch(const BenchOptions *options, BatchEntry *entries, uint8_t count, uint8_t *buffer) {
+    uint32_t write_bytes = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (entries[i].command != READ_BLOCK) {
+            write_bytes += entries[i].params.sector_count * SECTOR_SIZE;
+        }
+    }
+    if (options->direct) {
+        return direct_batch(entries, count, buffer, buffer + write_bytes);
+    }
+    uint8_t statuses[BATCH_MAX_ENTRIES];
+    return send_block_batch(entries, count, buffer, buffer + write_bytes, statuses);
+}
+
+// Time per KB of each frame check on this CPU, over a buffer the size of the
+// largest request
+static void report_integrity_cost(uint8_t *buffer) {
+    static const char *names[] = { "crc8", "crc16" };
+    const uint32_t size = MAX_BENCH_SECTORS * SECTOR_SIZE;
+    const int passes = 200;
+    for (uint32_t i = 0; i < size; i++) {
+        buffer[i] = (uint8_t)(i * 7);
+    }
+    printf("integrity cost:");
+    for (int kind = INTEGRITY_CRC8; kind <= INTEGRITY_CRC16; kind++) {
+        volatile uint16_t check = 0;
+        uint64_t start = sim_now_ns();
+        for (int pass = 0; pass < passes; pass++) {
+            check ^= integrity_update((IntegrityKind)kind, 0, buffer, size);
+        }
+        double ns_per_kb = (double)(sim_now_ns() - start) / passes / (size / 1024.0);
+        printf(" %s %.2f us/KB", names[kind], ns_per_kb / 1e3);
+    }
+    printf("\n");
+}
+
+static void run_workload(const BenchOptions *options, const Workload *workload, uint16_t total_sectors, uint8_t *buffer, uint64_t *latencies) {
+    uint64_t sectors = 0;
+    uint32_t failures = 0;
+    uint16_t next_sector = 0;
+
+    bench_seed = 1;
+    phase_reset();
+    SimLinkStats wire_start;
+    sim_link_stats(&wire_start);
+    uint64_t run_start = sim_now_ns();
+    for (uint32_t i = 0; i < options->requests; i++) {
+        BatchEntry entries[BATCH_MAX_ENTRIES];
+        for (uint8_t e = 0; e < workload->batch; e++) {
+            uint16_t count = workload->min_sectors;
+            if (workload->max_sectors > workload->min_sectors) {
+                count += bench_random() % (workload->max_sectors - workload->min_sectors + 1);
+            }
+            bool read = (bench_random() % 100) < workload->read_percent;
+            // writes stay in the upper half of the unit so the boot sector and FATs survive
+            uint16_t first_sector = read ? 0 : total_sectors / 2;
+            uint16_t span = total_sectors - first_sector;
+            uint16_t start_sector;
+            if (workload->sequential) {
+                if (next_sector < first_sector || next_sector + count > total_sectors) {
+                    next_sector = first_sector;
+                }
+                start_sector = next_sector;
+                next_sector += count;
+            } else {
+                start_sector = first_sector + (uint16_t)(((uint32_t)bench_random() << 15 | bench_random()) % (span - count + 1));
+            }
+            memset(&entries[e], 0, sizeof(entries[e]));
+            entries[e].command = read ? READ_BLOCK : WRITE_NO_VERIFY;
+            entries[e].params.drive_number = options->unit;
+            entries[e].params.start_sector = start_sector;
+            entries[e].params.sector_count = count;
+            sectors += count;
+        }
+        // a batch's write data fills the start of buffer, see bench_batch
+        memset(buffer, (int)i, MAX_BENCH_SECTORS * SECTOR_SIZE);
+
+        uint64_t request_start = sim_now_ns();
+        ResponseStatus status;
+        if (workload->batch == 1) {
+            status = bench_request(options, entries[0].command == READ_BLOCK, entries[0].params.start_sector,
+                                   entries[0].params.sector_count, buffer);
+        } else {
+            status = bench_batch(options, entries, workload->batch, buffer);
+        }
+        if (status != STATUS_OK) {
+            failures++;
+        }
+        latencies[i] = sim_now_ns() - request_start;
+    }
+    uint64_t run_ns = sim_now_ns() - run_start;
+    if (!options->direct) {
+        sleep_ms(10);   // let the Pico thread commit the timing of its last response
+    }
+
+    // bytes that crossed the cable in either direction for each sector moved
+    SimLinkStats wire_end;
+    sim_link_stats(&wire_end);
+    uint64_t wire_bytes = (wire_end.victor_to_pico - wire_start.victor_to_pico) +
+                          (wire_end.pico_to_victor - wire_start.pico_to_victor);
+
+    qsort(latencies, options->requests, sizeof(uint64_t), compare_u64);
+    uint32_t last = options->requests - 1;
+    double seconds = run_ns / 1e9;
+    printf("%-18s %6u %10.1f %10.1f %9.1f %9.1f %8.1f %5u\n", workload->name, options->requests,
+           sectors / seconds, (sectors * SECTOR_SIZE / 1024.0) / seconds,
+           latencies[last / 2] / 1e3, latencies[(last * 99) / 100] / 1e3,
+           (double)wire_bytes / sectors, failures);
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        PhaseSummary summary;
+        if (phase_summary((TimingPhase)phase, &summary)) {
+            printf("    %-14s %9.1f %9.1f   %5.1f%% of run\n", phase_name((TimingPhase)phase),
+                   summary.p50_ns / 1e3, summary.p99_ns / 1e3, 100.0 * summary.total_ns / run_ns);
+        }
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s --card IMAGE [options]\n"
+        "  --direct            call execute_sd_block_command without the link\n"
+        "  --unit N            drive unit to exercise (0)\n"
+        "  --requests N        requests per workload (200)\n"
+        "  --byte-ns N         wire time per byte on the Victor side (0)\n"
+        "  --poll-ns N         cost of an empty VIA poll (2000)\n"
+        "  --card-cmd-us N     SD card latency per command (0)\n"
+        "  --card-sector-us N  SD card latency per sector (0)\n"
+        "  --stop-and-wait     acked command and data packets instead of single frames\n"
+        "  --integrity K       check on each frame, crc8 or crc16 (crc16)\n"
+        "  --write-policy P    through, back or back-meta (back-meta)\n"
+        "  --no-fill-sectors   send every sector literally, not coded\n"
+        "Write workloads overwrite the upper half of the unit.\n",
+        name);
+}
+
+static bool parse_args(int argc, char **argv, BenchOptions *options) {
+    static const struct option long_options[] = {
+        { "card", required_argument, NULL, 'c' },
+        { "direct", no_argument, NULL, 'd' },
+        { "unit", required_argument, NULL, 'u' },
+        { "requests", required_argument, NULL, 'n' },
+        { "byte-ns", required_argument, NULL, 'b' },
+        { "poll-ns", required_argument, NULL, 'p' },
+        { "card-cmd-us", required_argument, NULL, 'C' },
+        { "card-sector-us", required_argument, NULL, 'S' },
+        { "stop-and-wait", no_argument, NULL, 'L' },
+        { "integrity", required_argument, NULL, 'I' },
+        { "write-policy", required_argument, NULL, 'W' },
+        { "no-fill-sectors", no_argument, NULL, 'F' },
+        { NULL, 0, NULL, 0 },
+    };
+    static const char *policy_names[] = { "through", "back", "back-meta" };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': options->card_image = optarg; break;
+            case 'd': options->direct = true; break;
+            case 'u': options->unit = (uint8_t)atoi(optarg); break;
+            case 'n': options->requests = (uint32_t)atoi(optarg); break;
+            case 'b': options->link.byte_ns = (uint32_t)atoi(optarg); break;
+            case 'p': options->link.poll_ns = (uint32_t)atoi(optarg); break;
+            case 'C': options->card_command_us = (uint32_t)atoi(optarg); break;
+            case 'S': options->card_sector_us = (uint32_t)atoi(optarg); break;
+            case 'L': options->stop_and_wait = true; break;
+            case 'F': options->no_fill_sectors = true; break;
+            case 'I':
+                if (strcmp(optarg, "crc8") == 0) {
+                    options->integrity = INTEGRITY_CRC8;
+                } else if (strcmp(optarg, "crc16") == 0) {
+                    options->integrity = INTEGRITY_CRC16;
+                } else {
+                    return false;
+                }
+                break;
+            case 'W':
+                for (options->write_policy = 0; options->write_policy < 3; options->write_policy++) {
+                    if (strcmp(optarg, policy_names[options->write_policy]) == 0) {
+                        break;
+                    }
+                }
+                if (options->write_policy == 3) {
+                    return false;
+                }
+                break;
+            default: return false;
+        }
+    }
+    return options->card_image != NULL && options->requests > 0;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = {
+        .requests = 200,
+        .link = { .byte_ns = 0, .poll_ns = 2000, .fifo_depth = 8 },
+        .integrity = INTEGRITY_CRC16,
+        .write_policy = WRITE_POLICY_DEFAULT,
+    };
+    if (!parse_args(argc, argv, &options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    sd_set_write_policy(options.write_policy);
+
+    sim_link_init(&options.link);
+    if (!sim_card_open(options.card_image)) {
+        return 1;
+    }
+    sim_card_set_latency(options.card_command_us, options.card_sector_us);
+    generate_crc8_table();
+
+    InitPayload init_payload = {0};
+    ResponseStatus status;
+    if (options.direct) {
+        status = direct_init(&init_payload);
+    } else {
+        sim_pico_start();
+        set_fill_sectors(!options.no_fill_sectors);
+        status = sim_victor_init(&init_payload, !options.stop_and_wait, options.integrity);
+    }
+    if (status != STATUS_OK) {
+        fprintf(stderr, "DEVICE_INIT failed %u\n", status);
+        return 1;
+    }
+    if (options.unit >= init_payload.num_units) {
+        fprintf(stderr, "unit %u not present\n", options.unit);
+        return 1;
+    }
+    uint16_t total_sectors = init_payload.bpb_array[options.unit].total_sectors;
+    if (total_sectors < 2 * MAX_BENCH_SECTORS) {
+        fprintf(stderr, "unit %u has only %u sectors\n", options.unit, total_sectors);
+        return 1;
+    }
+
+    uint8_t *buffer = malloc(MAX_BENCH_SECTORS * SECTOR_SIZE);
+    uint64_t *latencies = malloc(options.requests * sizeof(uint64_t));
+
+    printf("\n%s mode, unit %u, %u sectors\n", options.direct ? "direct" : "link", options.unit, total_sectors);
+    printf("%-18s %6s %10s %10s %9s %9s %8s %5s\n", "workload", "reqs", "sectors/s", "KB/s", "p50 us", "p99 us",
+           "B/sector", "fail");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        run_workload(&options, &workloads[i], total_sectors, buffer, latencies);
+    }
+    printf("payload pool overflows: %u\n", payload_pool_overflows());
+    report_integrity_cost(buffer);
+    SectorCacheStats cache;
+    sector_cache_stats(&cache);
+    printf("sector cache: %u hits (%u metadata), %u misses, %u evictions, %u sectors\n",
+           cache.hits, cache.metadata_hits, cache.misses, cache.evictions, cache.capacity);
+    printf("read-ahead: %u sectors\n", sd_read_ahead_sectors());
+    WriteBackStats write_back;
+    sd_write_back_stats(&write_back);
+    printf("write-back: %u flushes, %u sectors in %u writes, %u still dirty\n",
+           write_back.flushes, write_back.sectors, write_back.writes, cache.dirty);
+
+    free(buffer);
+    free(latencies);
+    return 0;
+}
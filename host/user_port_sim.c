@@ -0,0 +1,273 @@
+// Host simulator for the Victor 9000 user port link. The unmodified Pico
+// firmware runs on one thread and the Victor driver's communication layer on
+// the main thread, joined by the byte FIFOs in sim_link.c, so protocol and
+// storage changes can be timed without hardware.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "protocols.h"
+#include "dos_device_payloads.h"
+#include "crc8.h"
+#include "sim_link.h"
+#include "sim_card.h"
+#include "sim_victor.h"
+#include "sim_pico.h"
+#include "v9_metadata_cache.h"
+
+typedef struct {
+    const char *card_image;
+    uint8_t unit;
+    bool every_unit;
+    uint16_t sectors;
+    uint32_t requests;
+    bool write;
+    SimLinkConfig link;
+    uint32_t card_command_us;
+    uint32_t card_sector_us;
+    bool stop_and_wait;
+    IntegrityKind integrity;
+    bool interrupt_receive;
+    bool single_byte_handshake;
+    uint16_t cache_kb;
+    bool no_fill_sectors;
+} SimOptions;
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s --card IMAGE [options]\n"
+        "  --unit N            drive unit to exercise (0)\n"
+        "  --every-unit        take turns over every unit, a write run then reads\n"
+        "                      all of them back to catch one unit landing on another\n"
+        "  --sectors N         sectors per request, up to 128 (16)\n"
+        "  --requests N        number of requests (256)\n"
+        "  --write             write a pattern, then read it back and compare\n"
+        "  --byte-ns N         wire time per byte on the Victor side (0)\n"
+        "  --poll-ns N         cost of an empty VIA poll (2000)\n"
+        "  --fifo-depth N      PIO FIFO depth (8)\n"
+        "  --card-cmd-us N     SD card latency per command (0)\n"
+        "  --card-sector-us N  SD card latency per sector (0)\n"
+        "  --stop-and-wait     acked command and data packets instead of single frames\n"
+        "  --integrity K       check on each frame, crc8 or crc16 (crc16)\n"
+        "  --interrupt-receive reads and writes wait on the interrupt receive ring\n"
+        "  --single-byte-handshake  skip the capability exchange, as an older Pico would\n"
+        "  --cache KB          driver metadata cache, as /C=KB in CONFIG.SYS (0)\n"
+        "  --no-fill-sectors   send every sector literally, not coded\n",
+        name);
+}
+
+static bool parse_args(int argc, char **argv, SimOptions *options) {
+    static const struct option long_options[] = {
+        { "card", required_argument, NULL, 'c' },
+        { "unit", required_argument, NULL, 'u' },
+        { "every-unit", no_argument, NULL, 'U' },
+        { "sectors", required_argument, NULL, 's' },
+        { "requests", required_argument, NULL, 'n' },
+        { "write", no_argument, NULL, 'w' },
+        { "byte-ns", required_argument, NULL, 'b' },
+        { "poll-ns", required_argument, NULL, 'p' },
+        { "fifo-depth", required_argument, NULL, 'f' },
+        { "card-cmd-us", required_argument, NULL, 'C' },
+        { "card-sector-us", required_argument, NULL, 'S' },
+        { "stop-and-wait", no_argument, NULL, 'L' },
+        { "integrity", required_argument, NULL, 'I' },
+        { "interrupt-receive", no_argument, NULL, 'R' },
+        { "single-byte-handshake", no_argument, NULL, 'H' },
+        { "cache", required_argument, NULL, 'K' },
+        { "no-fill-sectors", no_argument, NULL, 'F' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': options->card_image = optarg; break;
+            case 'u': options->unit = (uint8_t)atoi(optarg); break;
+            case 'U': options->every_unit = true; break;
+            case 's': options->sectors = (uint16_t)atoi(optarg); break;
+            case 'n': options->requests = (uint32_t)atoi(optarg); break;
+            case 'w': options->write = true; break;
+            case 'b': options->link.byte_ns = (uint32_t)atoi(optarg); break;
+            case 'p': options->link.poll_ns = (uint32_t)atoi(optarg); break;
+            case 'f': options->link.fifo_depth = (uint32_t)atoi(optarg); break;
+            case 'C': options->card_command_us = (uint32_t)atoi(optarg); break;
+            case 'S': options->card_sector_us = (uint32_t)atoi(optarg); break;
+            case 'L': options->stop_and_wait = true; break;
+            case 'R': options->interrupt_receive = true; break;
+            case 'H': options->single_byte_handshake = true; break;
+            case 'K': options->cache_kb = (uint16_t)atoi(optarg); break;
+            case 'F': options->no_fill_sectors = true; break;
+            case 'I':
+                if (strcmp(optarg, "crc8") == 0) {
+                    options->integrity = INTEGRITY_CRC8;
+                } else if (strcmp(optarg, "crc16") == 0) {
+                    options->integrity = INTEGRITY_CRC16;
+                } else {
+                    return false;
+                }
+                break;
+            default: return false;
+        }
+    }
+    return options->card_image != NULL && options->sectors > 0 &&
+           options->sectors <= MAX_REQUEST_SECTORS;
+}
+
+// Every fourth sector holds one value, so coded links send both kinds. The
+// unit is mixed in so units sharing an image file hold different data.
+static void fill_pattern(uint8_t *buffer, uint8_t unit, uint16_t start_sector, uint16_t sectors) {
+    for (uint32_t i = 0; i < (uint32_t)sectors * SECTOR_SIZE; i++) {
+        uint16_t sector = start_sector + i / SECTOR_SIZE;
+        buffer[i] = (uint8_t)(((sector % 4 == 0) ? sector : sector * 31 + i) + unit * 101);
+    }
+}
+
+// Unit and first sector of request i. With --every-unit the units take turns
+// and move on to the next sectors together.
+static void request_target(const SimOptions *options, uint8_t num_units, uint16_t total_sectors,
+                           uint32_t i, uint8_t *unit, uint16_t *start_sector) {
+    uint32_t step = i;
+    *unit = options->unit;
+    if (options->every_unit) {
+        *unit = i % num_units;
+        step = i / num_units;
+    }
+    uint32_t per_pass = total_sectors / options->sectors;
+    *start_sector = (uint16_t)((step % per_pass) * options->sectors);
+}
+
+int main(int argc, char **argv) {
+    SimOptions options = {
+        .sectors = 16,
+        .requests = 256,
+        .link = { .byte_ns = 0, .poll_ns = 2000, .fifo_depth = 8 },
+        .integrity = INTEGRITY_CRC16,
+    };
+    if (!parse_args(argc, argv, &options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    sim_link_init(&options.link);
+    if (!sim_card_open(options.card_image)) {
+        return 1;
+    }
+    sim_card_set_latency(options.card_command_us, options.card_sector_us);
+    generate_crc8_table();
+
+    sim_pico_start();
+
+    if (options.interrupt_receive) {
+        sim_victor_sector_receive(RECEIVE_INTERRUPT);
+    }
+    set_capability_exchange(!options.single_byte_handshake);
+    set_fill_sectors(!options.no_fill_sectors);
+    sim_victor_metadata_cache(options.cache_kb);
+    InitPayload init_payload = {0};
+    if (sim_victor_init(&init_payload, !options.stop_and_wait, options.integrity) != STATUS_OK) {
+        fprintf(stderr, "DEVICE_INIT failed\n");
+        return 1;
+    }
+    const LinkCapabilities *caps = link_capabilities();
+    printf("sim: link version %u, features 0x%02x, integrity 0x%02x, %u sectors per request, window %u, "
+           "write policy %u, PIO clock %u MHz\n", caps->version, caps->features, caps->integrity,
+           caps->max_request_sectors, caps->window, caps->write_policy, caps->pio_clock_mhz);
+    printf("sim: %u units\n", init_payload.num_units);
+    if (options.unit >= init_payload.num_units) {
+        fprintf(stderr, "unit %u not present\n", options.unit);
+        return 1;
+    }
+    // every unit's requests stay within the smallest one
+    uint16_t total_sectors = init_payload.bpb_array[options.unit].total_sectors;
+    for (uint8_t unit = 0; options.every_unit && unit < init_payload.num_units; unit++) {
+        if (init_payload.bpb_array[unit].total_sectors < total_sectors) {
+            total_sectors = init_payload.bpb_array[unit].total_sectors;
+        }
+    }
+    if (total_sectors < options.sectors) {
+        fprintf(stderr, "unit %u has only %u sectors\n", options.unit, total_sectors);
+        return 1;
+    }
+
+    uint32_t request_bytes = (uint32_t)options.sectors * SECTOR_SIZE;
+    uint8_t *buffer = malloc(request_bytes);
+    uint8_t *expected = malloc(request_bytes);
+    uint32_t failures = 0;
+    uint64_t slowest_ns = 0;
+    uint8_t unit;
+    uint16_t start_sector;
+
+    uint64_t run_start = sim_now_ns();
+    for (uint32_t i = 0; i < options.requests; i++) {
+        request_target(&options, init_payload.num_units, total_sectors, i, &unit, &start_sector);
+        uint64_t request_start = sim_now_ns();
+        ResponseStatus status;
+        if (options.write) {
+            fill_pattern(expected, unit, start_sector, options.sectors);
+            memcpy(buffer, expected, request_bytes);
+            status = sim_victor_write(unit, start_sector, options.sectors, buffer);
+            if (status == STATUS_OK) {
+                memset(buffer, 0, request_bytes);
+                status = sim_victor_read(unit, start_sector, options.sectors, buffer);
+            }
+            if (status == STATUS_OK && memcmp(buffer, expected, request_bytes) != 0) {
+                printf("sim: readback mismatch on unit %u at sector %u\n", unit, start_sector);
+                failures++;
+            }
+        } else {
+            status = sim_victor_read(unit, start_sector, options.sectors, buffer);
+        }
+        uint64_t elapsed = sim_now_ns() - request_start;
+        if (elapsed > slowest_ns) {
+            slowest_ns = elapsed;
+        }
+        if (status != STATUS_OK) {
+            printf("sim: request %u on unit %u at sector %u failed %u\n", i, unit, start_sector, status);
+            failures++;
+        }
+    }
+    if (options.write && sim_victor_flush() != STATUS_OK) {
+        printf("sim: flush failed\n");
+        failures++;
+    }
+    uint64_t run_ns = sim_now_ns() - run_start;
+
+    // a write that went to the wrong unit passes its own readback but not
+    // this one, once every unit has been written
+    for (uint32_t i = 0; options.write && options.every_unit && i < options.requests; i++) {
+        request_target(&options, init_payload.num_units, total_sectors, i, &unit, &start_sector);
+        fill_pattern(expected, unit, start_sector, options.sectors);
+        if (sim_victor_read(unit, start_sector, options.sectors, buffer) != STATUS_OK ||
+            memcmp(buffer, expected, request_bytes) != 0) {
+            printf("sim: unit %u sector %u changed after its write\n", unit, start_sector);
+            failures++;
+        }
+    }
+
+    SimLinkStats link_stats;
+    SimCardStats card_stats;
+    sim_link_stats(&link_stats);
+    sim_card_stats(&card_stats);
+
+    uint64_t moved = (uint64_t)options.requests * request_bytes * (options.write ? 2 : 1);
+    printf("sim: %u %s requests of %u sectors, %u failures\n", options.requests,
+           options.write ? "write+verify" : "read", options.sectors, failures);
+    printf("sim: %.3f ms total, %.1f us/request avg, %.1f us slowest\n",
+           run_ns / 1e6, run_ns / 1e3 / options.requests, slowest_ns / 1e3);
+    printf("sim: %.1f KB/s payload\n", (moved / 1024.0) / (run_ns / 1e9));
+    printf("sim: link bytes victor->pico %llu pico->victor %llu\n",
+           (unsigned long long)link_stats.victor_to_pico, (unsigned long long)link_stats.pico_to_victor);
+    printf("sim: card reads %llu (%llu sectors) writes %llu (%llu sectors)\n",
+           (unsigned long long)card_stats.reads, (unsigned long long)card_stats.sectors_read,
+           (unsigned long long)card_stats.writes, (unsigned long long)card_stats.sectors_written);
+    if (options.cache_kb > 0) {
+        MetadataCacheStats cache_stats;
+        metadata_cache_stats(&cache_stats);
+        printf("sim: metadata cache hits %u misses %u\n", cache_stats.hits, cache_stats.misses);
+    }
+
+    free(buffer);
+    free(expected);
+    return failures == 0 ? 0 : 1;
+}
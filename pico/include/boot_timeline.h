@@ -0,0 +1,24 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <stdint.h>
+
+// Power-on-to-ready stages, stamped with time since boot as each is reached.
+// Every stage is stamped once and by one core, so the cores never share a slot.
+typedef enum {
+    BOOT_CONSOLE,       // UART up, core 0
+    BOOT_PIO,           // PIO state machines and DMA running, core 0
+    BOOT_CARD_MOUNTED,  // f_mount done, core 1
+    BOOT_IMAGES,        // images opened, mount index or link maps ready, core 1
+    BOOT_STORAGE_READY, // core 1 takes requests, handshakes get accepted
+    BOOT_HANDSHAKE,     // first handshake byte from the Victor, core 0
+    BOOT_LINK_READY,    // handshake accepted, core 0
+    BOOT_STAGE_COUNT
+} BootStage;
+
+void boot_mark(BootStage stage);
+// Prints the stages reached in the order they were, with the time since boot
+// and since the stage before
+void boot_timeline_print(void);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef MOUNT_INDEX_H
+#define MOUNT_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../common/protocols.h"
+#include "../../common/dos_device_payloads.h"
+#include "sd_block_device.h"
+
+// Sidecar file on the card with what DEVICE_INIT works out from the images:
+// the InitPayload, each image's fast-seek map and the unit table with each
+// unit's bounds and Victor extent table. It is keyed by each image's name,
+// size, timestamp and first cluster, so a boot with the same images reads one
+// file instead of parsing every label again, and any other boot parses as
+// before and writes a new one. A copy made with cp -p keeps size and
+// timestamp but not clusters, and the fast-seek map writes to clusters.
+#define MOUNT_INDEX_NAME "mount.idx"
+#define MOUNT_INDEX_MAX_BYTES (64 * 1024)
+
+// Restores every image of sdState and init_payload from the index. Returns
+// false and changes nothing when the index is missing, damaged or describes
+// other images.
+bool mount_index_load(SDState *sdState, InitPayload *init_payload);
+void mount_index_save(SDState *sdState, const InitPayload *init_payload);
+// Drops the index once a write may have changed what it describes
+void mount_index_invalidate(SDState *sdState);
+
+#endif
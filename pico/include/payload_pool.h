@@ -0,0 +1,24 @@
+#ifndef PAYLOAD_POOL_H
+#define PAYLOAD_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../common/protocols.h"
+#include "../../common/dos_device_payloads.h"
+
+// Requests and responses come from fixed pools of slots, each with room for the
+// largest params and data the protocol sends, so steady state I/O never calls
+// malloc. Anything past the caps falls back to the heap and is counted.
+#define PAYLOAD_POOL_SLOTS 2
+#define PAYLOAD_PARAMS_MAX (BATCH_MAX_ENTRIES * sizeof(BatchEntry))
+#define PAYLOAD_DATA_MAX (16 * SECTOR_SIZE)
+
+Payload* acquire_request_payload(void);     // link core
+Payload* acquire_response_payload(void);    // storage core
+uint8_t* payload_params_buffer(Payload *payload, uint16_t params_size);
+uint8_t* payload_data_buffer(Payload *payload, uint32_t data_size);
+void release_payload(Payload *payload);     // link core
+uint32_t payload_pool_overflows(void);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef PHASE_TIMING_H
+#define PHASE_TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per request timing of the hot path, compiled in with -DPHASE_TIMING (the host
+// benchmark does this). Each phase accumulates across one request and
+// PHASE_COMMIT() turns the totals into one sample per phase.
+typedef enum {
+    PHASE_FRAMING,      // receiving command and data packets off the PIO FIFO
+    PHASE_CRC,          // checking and generating CRCs
+    PHASE_SEEK,         // f_lseek into the image file
+    PHASE_FILE_IO,      // f_read / f_write
+    PHASE_TRANSMIT,     // sending the response packets
+    PHASE_COUNT
+} TimingPhase;
+
+typedef struct {
+    uint32_t count;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t total_ns;
+} PhaseSummary;
+
+#ifdef PHASE_TIMING
+uint64_t phase_clock_ns(void);
+void phase_add(TimingPhase phase, uint64_t elapsed_ns);
+void phase_commit(void);
+void phase_reset(void);
+bool phase_summary(TimingPhase phase, PhaseSummary *summary);
+const char *phase_name(TimingPhase phase);
+
+#define PHASE_BEGIN(name) uint64_t name##_phase_ns = phase_clock_ns()
+#define PHASE_END(name, phase) phase_add(phase, phase_clock_ns() - name##_phase_ns)
+#define PHASE_COMMIT() phase_commit()
+#else
+#define PHASE_BEGIN(name)
+#define PHASE_END(name, phase)
+#define PHASE_COMMIT()
+#endif
+
+#endif
@@ -8,6 +8,9 @@ typedef struct {
   PIO pio;
   uint rx_sm;
   uint tx_sm;
+  uint rx_dma_chan;   // DMA channel paced by the RX state machine's DREQ
+  uint tx_dma_chan;   // DMA channel feeding the TX state machine
+  uint tx_ctrl_dma_chan; // reloads tx_dma_chan from a control block chain
 } PIO_state;
 
 
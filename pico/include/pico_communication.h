@@ -15,10 +15,21 @@ uint16_t receive_utf16(PIO_state *pio_state);
 void transmit_utf16(PIO_state *pio_state, uint16_t value);
 void sendResponseStatus(PIO_state *pio_state, ResponseStatus status);
 ResponseStatus receive_command_payload(PIO_state *pio_state, Payload *payload);
+ResponseStatus receive_frame(PIO_state *pio_state, Payload *payload, uint8_t sequence);
+bool is_segmented_write(const Payload *payload);
+Payload* receive_segmented_write(PIO_state *pio_state, Payload *payload);
 ResponseStatus receive_command_packet(PIO_state *pio_state, Payload *payload);
 ResponseStatus receive_data_packet(PIO_state *pio_state, Payload *payload);
 void process_command(PIO_state *pio_state, Payload *payload);
-void process_incoming_commands(SDState *sd_state, PIO_state *pio_state);
+void process_incoming_commands(PIO_state *pio_state);
 ResponseStatus transmit_response(PIO_state *pio_state, Payload *payload);
+ResponseStatus transmit_command_packet(PIO_state *pio_state, Payload *payload);
+void transmit_data_begin(PIO_state *pio_state, uint16_t data_size);
+void transmit_data_chunk(PIO_state *pio_state, const uint8_t *data, uint32_t size);
+ResponseStatus transmit_data_end(PIO_state *pio_state, uint8_t data_crc);
+void transmit_frame_begin(PIO_state *pio_state, Payload *payload);
+void transmit_segment_begin(PIO_state *pio_state);
+ResponseStatus transmit_frame_end(PIO_state *pio_state, uint16_t frame_check);
+ResponseStatus transmit_streamed_read(PIO_state *pio_state, Payload *payload);
 
 #endif
\ No newline at end of file
@@ -6,28 +6,87 @@
 #include "pico_common.h"
 #include "../sdio-fatfs/src/ff15/source/ff.h"
 
+// A run of a Victor virtual volume that sits in one working media region,
+// so its sectors follow each other in the image file
+typedef struct {
+    uint32_t logical_start;     // first sector of the run within the volume
+    uint32_t file_start;        // where that sector is in the image file
+    uint32_t length;
+} VolumeExtent;
+
 typedef struct {
     FIL *img_file;
+    DWORD *link_map;            //FatFs fast-seek table, NULL when the image seeks the slow way
+    LBA_t raw_lba;              //card sector of a contiguous image's first sector
+    uint32_t raw_sectors;       //sectors of the image reachable at raw_lba, 0 goes through FatFs
+    bool raw_written;           //FatFs' view of the file is stale until it is reopened
+    FSIZE_t file_size;          //size and timestamp at mount, the mount index is keyed by them
+    WORD file_date;
+    WORD file_time;
+} DriveImage;
+
+// A drive the Victor sees. A PC image is one unit, a Victor image is one unit
+// for each of its virtual volumes, all of them on the same DriveImage.
+typedef struct {
+    uint8_t image;              //index into images and file_names
     uint32_t start_lba;    //offset within the image file for multi-partition images
     uint32_t end_lba;
-} DriveImage;
+    uint32_t metadata_sectors;  //boot, FAT and root directory sectors at the start of the unit
+    VolumeExtent *extents;      //a Victor volume's runs by logical_start, NULL maps from start_lba
+    uint16_t num_extents;
+} DriveUnit;
 
 typedef struct {
     char file_names[MAX_IMG_FILES][FILENAME_MAX_LENGTH];
     int fileCount;
     FATFS *fs;
     DriveImage *images[MAX_IMG_FILES];
+    DriveUnit units[MAX_IMG_FILES];     //by unit number, as DEVICE_INIT hands them out
+    uint8_t unitCount;
     FIL *debug_log;
+    InitPayload mounted;        //what DEVICE_INIT answers while mounted_valid
+    bool mounted_valid;         //from the mount index, or the last parse of the images
 } SDState;
 
+// How sd_write treats the card. Write-back holds writes in the sector cache
+// until a flush, the metadata variant still sends the boot sector, FATs and
+// directories straight through.
+typedef enum {
+    WRITE_THROUGH,
+    WRITE_BACK,
+    WRITE_BACK_METADATA_THROUGH,
+} WritePolicy;
+
+#ifndef WRITE_POLICY_DEFAULT
+#define WRITE_POLICY_DEFAULT WRITE_BACK_METADATA_THROUGH
+#endif
+
+typedef struct {
+    uint32_t flushes;
+    uint32_t sectors;   // written back
+    uint32_t writes;    // f_write calls they took
+} WriteBackStats;
+
 void print_debug_bpb(VictorBPB *bpb);
+void attach_link_map(DriveImage *image, const char *name, DWORD *table);
+uint32_t bpb_metadata_sectors(const VictorBPB *bpb);
 SDState* initialize_sd_state(const char *directory);
 Payload* init_sd_card(SDState *sdState, PIO_state *pio_state, Payload *payload);
 Payload* media_check(SDState *sdState, PIO_state *pio_state, Payload *payload);
 Payload* build_bpb(SDState *sdState, PIO_state *pio_state, Payload *payload);
 Payload* victor9k_drive_info(SDState *sdState, PIO_state *pio_state, Payload *payload);
 Payload* sd_read(SDState *sdState, PIO_state *pio_state, Payload *payload);
+void sd_read_stream(SDState *sdState, Payload *payload);
+bool sd_read_ahead(SDState *sdState);
+uint32_t sd_read_ahead_sectors(void);
 Payload* sd_write(SDState *sdState, PIO_state *pio_state, Payload *payload);
+Payload* sd_flush(SDState *sdState, PIO_state *pio_state, Payload *payload);
+Payload* sd_batch(SDState *sdState, PIO_state *pio_state, Payload *payload);
+void sd_set_write_policy(WritePolicy policy);
+WritePolicy sd_write_policy(void);
+bool sd_flush_writes(SDState *sdState);
+uint64_t sd_flush_when_idle(SDState *sdState);
+void sd_write_back_stats(WriteBackStats *stats);
 Payload* create_error_response(SDState *sdState, PIO_state *pio_state, Payload *input);
 
 #endif // SD_BLOCK_DEVICE_H
\ No newline at end of file
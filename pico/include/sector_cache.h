@@ -0,0 +1,39 @@
+#ifndef SECTOR_CACHE_H
+#define SECTOR_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../common/protocols.h"
+
+// RAM cache of image sectors keyed by (drive, sector in the image file). It
+// lives on the storage core and is only touched from there.
+typedef enum {
+    SECTOR_DATA,        // file contents, evicted first
+    SECTOR_METADATA,    // boot sector, FATs and root directory
+} SectorClass;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t metadata_hits;
+    uint32_t evictions;
+    uint32_t dirty;     // sectors waiting for a flush
+    uint32_t capacity;  // sectors
+} SectorCacheStats;
+
+bool sector_cache_contains(uint8_t drive, uint32_t lba);
+bool sector_cache_lookup(uint8_t drive, uint32_t lba, uint8_t *buffer);
+void sector_cache_insert(uint8_t drive, uint32_t lba, const uint8_t *data, SectorClass sector_class);
+void sector_cache_update(uint8_t drive, uint32_t lba, const uint8_t *data);
+void sector_cache_write(uint8_t drive, uint32_t lba, const uint8_t *data, SectorClass sector_class);
+bool sector_cache_lowest_dirty(SectorClass sector_class, uint8_t *drive, uint32_t *lba);
+const uint8_t* sector_cache_dirty_data(uint8_t drive, uint32_t lba);
+void sector_cache_mark_clean(uint8_t drive, uint32_t lba);
+uint32_t sector_cache_dirty_count(void);
+uint32_t sector_cache_dirty_room(void);
+void sector_cache_clear(void);
+uint32_t sector_cache_data_room(void);
+void sector_cache_stats(SectorCacheStats *stats);
+
+#endif
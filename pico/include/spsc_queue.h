@@ -0,0 +1,50 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Lock free ring of pointers between exactly one producer and one consumer,
+// which is all the two cores need. Each index is only written by its own side.
+#define SPSC_QUEUE_CAPACITY 8   // power of two
+
+typedef struct {
+    void *slots[SPSC_QUEUE_CAPACITY];
+    atomic_uint head;   // next slot to fill, written by the producer
+    atomic_uint tail;   // next slot to drain, written by the consumer
+} SpscQueue;
+
+static inline void spsc_queue_init(SpscQueue *queue) {
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+static inline bool spsc_queue_push(SpscQueue *queue, void *item) {
+    unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head - tail == SPSC_QUEUE_CAPACITY) {
+        return false;
+    }
+    queue->slots[head & (SPSC_QUEUE_CAPACITY - 1)] = item;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Only meaningful to the consumer, the producer may add to it at any time
+static inline bool spsc_queue_is_empty(SpscQueue *queue) {
+    return atomic_load_explicit(&queue->head, memory_order_acquire) ==
+           atomic_load_explicit(&queue->tail, memory_order_relaxed);
+}
+
+static inline bool spsc_queue_pop(SpscQueue *queue, void **item) {
+    unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *item = queue->slots[tail & (SPSC_QUEUE_CAPACITY - 1)];
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+#endif
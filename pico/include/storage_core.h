@@ -0,0 +1,48 @@
+#ifndef STORAGE_CORE_H
+#define STORAGE_CORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../common/protocols.h"
+#include "pico_common.h"
+#include "sd_block_device.h"
+
+// Core 0 runs the link (PIO framing, CRCs, ack bytes) and core 1 runs storage
+// (dispatch_command, FatFs). They only meet in the queues in storage_core.c.
+#define STORAGE_REQUEST_SLOTS 2
+#define READ_STREAM_BUFFERS 3
+#define READ_STREAM_SECTORS 1
+
+typedef struct {
+    Payload *payload;     // command as received by the link core
+    Payload *response;    // set by the storage core, NULL for streamed reads
+} StorageRequest;
+
+// One piece of a streamed READ_BLOCK on its way from the card to the link
+typedef struct {
+    uint8_t data[READ_STREAM_SECTORS * SECTOR_SIZE];
+    uint32_t size;
+    bool ok;              // false once a seek or read failed, data is zeros
+} StreamChunk;
+
+// Core 1 mounts the card and scans the images from directory, then serves
+// requests. Core 0 brings up PIO meanwhile and answers handshakes busy until
+// storage_core_ready, and hands over its PIO_state before the first submit.
+void storage_core_start(const char *directory);
+bool storage_core_ready(void);
+void storage_core_attach(PIO_state *pio_state);
+bool is_streamed_read(const Payload *payload);
+
+// link core
+StorageRequest* storage_submit(Payload *payload);
+StorageRequest* storage_wait_complete(void);
+void storage_release(StorageRequest *request);
+StreamChunk* storage_stream_next(void);
+void storage_stream_release(StreamChunk *chunk);
+
+// storage core
+StreamChunk* storage_stream_buffer(void);
+void storage_stream_push(StreamChunk *chunk);
+
+#endif
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "pico/stdlib.h"
+#include "boot_timeline.h"
+
+static uint64_t boot_stamps[BOOT_STAGE_COUNT];
+static bool boot_reached[BOOT_STAGE_COUNT];
+
+static const char *const boot_stage_names[BOOT_STAGE_COUNT] = {
+    "console", "pio", "card mounted", "images", "storage ready", "handshake", "link ready"
+};
+
+void boot_mark(BootStage stage) {
+    if (!boot_reached[stage]) {
+        boot_stamps[stage] = time_us_64();
+        boot_reached[stage] = true;
+    }
+}
+
+// The cores reach their stages side by side, so they print in time order
+void boot_timeline_print(void) {
+    bool printed[BOOT_STAGE_COUNT] = {false};
+    uint64_t previous = 0;
+    printf("Boot timeline:\n");
+    while (true) {
+        int next = -1;
+        for (int stage = 0; stage < BOOT_STAGE_COUNT; stage++) {
+            if (boot_reached[stage] && !printed[stage] &&
+                (next < 0 || boot_stamps[stage] < boot_stamps[next])) {
+                next = stage;
+            }
+        }
+        if (next < 0) {
+            return;
+        }
+        printed[next] = true;
+        printf("  %-14s %8llu us  +%llu us\n", boot_stage_names[next],
+               (unsigned long long)boot_stamps[next], (unsigned long long)(boot_stamps[next] - previous));
+        previous = boot_stamps[next];
+    }
+}
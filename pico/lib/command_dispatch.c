@@ -12,6 +12,9 @@ Payload* dispatch_command(SDState *sdState, PIO_state *pio_state, Payload *paylo
         case SD_BLOCK_DEVICE:
             return execute_sd_block_command(sdState, pio_state, payload);
             break;
+        case SD_BLOCK_BATCH:
+            return sd_batch(sdState, pio_state, payload);
+            break;
         case LOG_OUTPUT:
             return log_output(sdState, pio_state, payload);
             break;
@@ -24,8 +27,7 @@ Payload* dispatch_command(SDState *sdState, PIO_state *pio_state, Payload *paylo
 
 // Command Dispatch
 Payload* execute_sd_block_command(SDState *sdState, PIO_state *pio_state, Payload *payload) {
-    Payload* response = (Payload*)malloc(sizeof(Payload));
-    memset (response, 0, sizeof(Payload));
+    Payload* response = NULL;
 
     switch (payload->command) {
         case DEVICE_INIT:
@@ -49,6 +51,9 @@ Payload* execute_sd_block_command(SDState *sdState, PIO_state *pio_state, Payloa
          case WRITE_VERIFY:
             response = sd_write(sdState, pio_state, payload);
             break;
+        case OUTPUT_FLUSH:
+            response = sd_flush(sdState, pio_state, payload);
+            break;
         default:
             payload->status = INVALID_COMMAND;
             response = create_error_response(sdState, pio_state, payload);
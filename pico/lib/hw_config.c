@@ -0,0 +1,63 @@
+#include "pico/stdlib.h"
+#include "../sdio-fatfs/include/FatFsSd_C.h"
+
+// Board wiring for the SD card socket, kept apart from sd_block_device.c so the
+// block device logic builds without the card drivers (see host/ for the simulator)
+
+/* SDIO Interface */
+static sd_sdio_if_t sdio_if = {
+    /*
+    Pins CLK_gpio, D1_gpio, D2_gpio, and D3_gpio are at offsets from pin D0_gpio.
+    The offsets are determined by sd_driver\SDIO\rp2040_sdio.pio.
+        CLK_gpio = (D0_gpio + SDIO_CLK_PIN_D0_OFFSET) % 32;
+        As of this writing, SDIO_CLK_PIN_D0_OFFSET is 30,
+            which is -2 in mod32 arithmetic, so:
+        CLK_gpio = D0_gpio -2.
+        D1_gpio = D0_gpio + 1;
+        D2_gpio = D0_gpio + 2;
+        D3_gpio = D0_gpio + 3;
+    */
+    .CMD_gpio = 1,
+    .D0_gpio = 2,
+    .baud_rate = 15 * 1000 * 1000  // 15 MHz
+};
+
+/* Hardware Configuration of the SD Card socket "object" */
+static sd_card_t sd_card_sdio = {
+    .type = SD_IF_SDIO,
+    .sdio_if_p = &sdio_if
+};
+
+/* SPI Interface */
+ static spi_t spi = {  
+     .hw_inst = spi0,  // RP2040 SPI component
+     .sck_gpio = 2,    // GPIO number (not Pico pin number)
+     .mosi_gpio = 3,
+     .miso_gpio = 4,
+     .baud_rate = 12 * 1000 * 1000    // Actual frequency: 10416666.
+ };
+
+ /* SPI Interface */
+ static sd_spi_if_t spi_if = {
+     .spi = &spi,  // Pointer to the SPI driving this card
+     .ss_gpio = 5       // The SPI slave select GPIO for this SD card
+ };
+
+/* Configuration of the SD Card socket object */
+ static sd_card_t sd_card = {   
+     .type = SD_IF_SPI,
+     .spi_if_p = &spi_if   // Pointer to the SPI interface driving this card
+ };
+
+
+/* Callbacks used by the library: */
+size_t sd_get_num() { 
+    return 1; 
+}
+
+sd_card_t *sd_get_by_num(size_t num) {
+    if (0 == num)
+        return &sd_card;
+    else
+        return NULL;
+}
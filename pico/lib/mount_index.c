@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "../sdio-fatfs/src/include/f_util.h"
+#include "../sdio-fatfs/src/ff15/source/ff.h"
+
+#include "../../common/protocols.h"
+#include "../../common/dos_device_payloads.h"
+#include "../../common/crc8.h"
+#include "sd_block_device.h"
+#include "mount_index.h"
+
+#define MOUNT_INDEX_MAGIC 0x58444E49   // "INDX"
+#define MOUNT_INDEX_VERSION 3
+
+// The file is a header, then for each image in directory order its record
+// and link map entries, then for each unit its record and extents, then the
+// InitPayload, then a CRC-16 over all of it. Everything is in the Pico's byte
+// order, nothing else reads it.
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t num_images;
+    uint8_t num_units;
+} MountIndexHeader;
+
+typedef struct {
+    char name[FILENAME_MAX_LENGTH];
+    uint64_t file_size;
+    uint16_t file_date;
+    uint16_t file_time;
+    uint32_t start_cluster;         // a copy with the same size and timestamp sits elsewhere
+    uint32_t link_map_entries;      // 0 when the image seeks the slow way
+} MountIndexImage;
+
+typedef struct {
+    uint8_t image;
+    uint32_t start_lba;
+    uint32_t end_lba;
+    uint32_t metadata_sectors;
+    uint16_t num_extents;
+} MountIndexUnit;
+
+static uint32_t link_map_entries(const DriveImage *image) {
+    return image->link_map != NULL ? image->link_map[0] : 0;
+}
+
+static uint32_t index_size(const SDState *sdState) {
+    uint32_t size = sizeof(MountIndexHeader);
+    for (int i = 0; i < sdState->fileCount; i++) {
+        size += sizeof(MountIndexImage) + link_map_entries(sdState->images[i]) * sizeof(DWORD);
+    }
+    for (int i = 0; i < sdState->unitCount; i++) {
+        size += sizeof(MountIndexUnit) + sdState->units[i].num_extents * sizeof(VolumeExtent);
+    }
+    return size + sizeof(InitPayload) + sizeof(uint16_t);
+}
+
+// Takes size bytes from the buffer, or NULL past its end
+static const uint8_t* take(const uint8_t **cursor, const uint8_t *end, uint32_t size) {
+    if ((uint32_t)(end - *cursor) < size) {
+        return NULL;
+    }
+    const uint8_t *taken = *cursor;
+    *cursor += size;
+    return taken;
+}
+
+// Checks every record against the images before anything is changed, then
+// hands out copies of the link maps and rebuilds the unit table
+static bool apply_index(SDState *sdState, const uint8_t *buffer, uint32_t size, InitPayload *init_payload) {
+    const uint8_t *cursor = buffer;
+    const uint8_t *end = buffer + size - sizeof(uint16_t);
+    MountIndexHeader header;
+    memcpy(&header, take(&cursor, end, sizeof(header)), sizeof(header));
+    if (header.magic != MOUNT_INDEX_MAGIC || header.version != MOUNT_INDEX_VERSION ||
+        header.num_images != sdState->fileCount || header.num_units > MAX_IMG_FILES) {
+        return false;
+    }
+    const uint8_t *records = cursor;
+    for (int i = 0; i < sdState->fileCount; i++) {
+        const uint8_t *bytes = take(&cursor, end, sizeof(MountIndexImage));
+        if (bytes == NULL) {
+            return false;
+        }
+        MountIndexImage record;
+        memcpy(&record, bytes, sizeof(record));
+        const DriveImage *image = sdState->images[i];
+        if (strncmp(record.name, sdState->file_names[i], FILENAME_MAX_LENGTH) != 0 ||
+            record.file_size != image->file_size || record.file_date != image->file_date ||
+            record.file_time != image->file_time || record.start_cluster != image->img_file->obj.sclust ||
+            take(&cursor, end, record.link_map_entries * sizeof(DWORD)) == NULL) {
+            return false;
+        }
+    }
+    const uint8_t *unit_records = cursor;
+    for (int i = 0; i < header.num_units; i++) {
+        const uint8_t *bytes = take(&cursor, end, sizeof(MountIndexUnit));
+        if (bytes == NULL) {
+            return false;
+        }
+        MountIndexUnit record;
+        memcpy(&record, bytes, sizeof(record));
+        if (record.image >= sdState->fileCount ||
+            take(&cursor, end, record.num_extents * sizeof(VolumeExtent)) == NULL) {
+            return false;
+        }
+    }
+    const uint8_t *payload = take(&cursor, end, sizeof(InitPayload));
+    if (payload == NULL || cursor != end) {
+        return false;
+    }
+    InitPayload saved;
+    memcpy(&saved, payload, sizeof(saved));
+    if (saved.num_units != header.num_units) {
+        return false;
+    }
+
+    cursor = records;
+    for (int i = 0; i < sdState->fileCount; i++) {
+        MountIndexImage record;
+        memcpy(&record, take(&cursor, end, sizeof(record)), sizeof(record));
+        DriveImage *image = sdState->images[i];
+        uint32_t link_map_bytes = record.link_map_entries * sizeof(DWORD);
+        const uint8_t *link_map = take(&cursor, end, link_map_bytes);
+        if (record.link_map_entries > 0 && image->link_map == NULL) {
+            DWORD *table = malloc(link_map_bytes);
+            if (table != NULL) {
+                memcpy(table, link_map, link_map_bytes);
+                attach_link_map(image, sdState->file_names[i], table);
+            }
+        }
+    }
+    for (int i = 0; i < MAX_IMG_FILES; i++) {
+        free(sdState->units[i].extents);
+    }
+    memset(sdState->units, 0, sizeof(sdState->units));
+    cursor = unit_records;
+    for (int i = 0; i < header.num_units; i++) {
+        MountIndexUnit record;
+        memcpy(&record, take(&cursor, end, sizeof(record)), sizeof(record));
+        DriveUnit *unit = &sdState->units[i];
+        unit->image = record.image;
+        unit->start_lba = record.start_lba;
+        unit->end_lba = record.end_lba;
+        unit->metadata_sectors = record.metadata_sectors;
+        uint32_t extent_bytes = record.num_extents * sizeof(VolumeExtent);
+        const uint8_t *extents = take(&cursor, end, extent_bytes);
+        if (record.num_extents > 0 && (unit->extents = malloc(extent_bytes)) != NULL) {
+            memcpy(unit->extents, extents, extent_bytes);
+            unit->num_extents = record.num_extents;
+        }
+    }
+    sdState->unitCount = header.num_units;
+    memcpy(init_payload, &saved, sizeof(InitPayload));
+    return true;
+}
+
+bool mount_index_load(SDState *sdState, InitPayload *init_payload) {
+    uint64_t load_start = time_us_64();
+    FIL file;
+    if (FR_OK != f_open(&file, MOUNT_INDEX_NAME, FA_OPEN_EXISTING | FA_READ)) {
+        return false;
+    }
+    FSIZE_t size = f_size(&file);
+    uint8_t *buffer = NULL;
+    UINT bytes_read = 0;
+    if (size > sizeof(MountIndexHeader) + sizeof(InitPayload) + sizeof(uint16_t) &&
+        size <= MOUNT_INDEX_MAX_BYTES && (buffer = malloc(size)) != NULL) {
+        f_read(&file, buffer, size, &bytes_read);
+    }
+    f_close(&file);
+
+    bool loaded = false;
+    if (buffer != NULL && bytes_read == size) {
+        integrity_tables_ready();
+        uint16_t check;
+        memcpy(&check, buffer + size - sizeof(check), sizeof(check));
+        loaded = check == integrity_update(INTEGRITY_CRC16, 0, buffer, size - sizeof(check)) &&
+                 apply_index(sdState, buffer, size, init_payload);
+    }
+    free(buffer);
+    printf("Mount index %s: %s in %u us\n", MOUNT_INDEX_NAME, loaded ? "used" : "not used",
+           (unsigned)(time_us_64() - load_start));
+    return loaded;
+}
+
+void mount_index_save(SDState *sdState, const InitPayload *init_payload) {
+    uint32_t size = index_size(sdState);
+    if (size > MOUNT_INDEX_MAX_BYTES) {
+        return;
+    }
+    uint8_t *buffer = malloc(size);
+    if (buffer == NULL) {
+        return;
+    }
+    uint8_t *cursor = buffer;
+    MountIndexHeader header = { MOUNT_INDEX_MAGIC, MOUNT_INDEX_VERSION, (uint8_t)sdState->fileCount,
+                                sdState->unitCount };
+    memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    for (int i = 0; i < sdState->fileCount; i++) {
+        const DriveImage *image = sdState->images[i];
+        MountIndexImage record = {0};
+        strncpy(record.name, sdState->file_names[i], FILENAME_MAX_LENGTH - 1);
+        record.file_size = image->file_size;
+        record.file_date = image->file_date;
+        record.file_time = image->file_time;
+        record.start_cluster = image->img_file->obj.sclust;
+        record.link_map_entries = link_map_entries(image);
+        memcpy(cursor, &record, sizeof(record));
+        cursor += sizeof(record);
+        memcpy(cursor, image->link_map, record.link_map_entries * sizeof(DWORD));
+        cursor += record.link_map_entries * sizeof(DWORD);
+    }
+    for (int i = 0; i < sdState->unitCount; i++) {
+        const DriveUnit *unit = &sdState->units[i];
+        MountIndexUnit record = {0};
+        record.image = unit->image;
+        record.start_lba = unit->start_lba;
+        record.end_lba = unit->end_lba;
+        record.metadata_sectors = unit->metadata_sectors;
+        record.num_extents = unit->num_extents;
+        memcpy(cursor, &record, sizeof(record));
+        cursor += sizeof(record);
+        memcpy(cursor, unit->extents, record.num_extents * sizeof(VolumeExtent));
+        cursor += record.num_extents * sizeof(VolumeExtent);
+    }
+    memcpy(cursor, init_payload, sizeof(InitPayload));
+    cursor += sizeof(InitPayload);
+    integrity_tables_ready();
+    uint16_t check = integrity_update(INTEGRITY_CRC16, 0, buffer, cursor - buffer);
+    memcpy(cursor, &check, sizeof(check));
+
+    FIL file;
+    UINT written = 0;
+    FRESULT fr = f_open(&file, MOUNT_INDEX_NAME, FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK == fr) {
+        fr = f_write(&file, buffer, size, &written);
+        f_close(&file);
+    }
+    if (FR_OK != fr || written != size) {
+        printf("Writing %s failed: %s (%d)\n", MOUNT_INDEX_NAME, FRESULT_str(fr), fr);
+        f_unlink(MOUNT_INDEX_NAME);
+    }
+    free(buffer);
+}
+
+void mount_index_invalidate(SDState *sdState) {
+    if (sdState->mounted_valid) {
+        sdState->mounted_valid = false;
+        f_unlink(MOUNT_INDEX_NAME);
+    }
+}
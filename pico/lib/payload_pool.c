@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../../common/protocols.h"
+#include "spsc_queue.h"
+#include "payload_pool.h"
+
+typedef struct {
+    Payload payload;    // first, so a Payload pointer is its slot
+    uint8_t params[PAYLOAD_PARAMS_MAX];
+    uint8_t data[PAYLOAD_DATA_MAX];
+} PayloadSlot;
+
+// The free list is an SPSC queue: the request pool is taken and given back on
+// the link core, the response pool is taken on the storage core and given back
+// on the link core. Each overflow counter only has the acquiring core writing.
+typedef struct {
+    PayloadSlot slots[PAYLOAD_POOL_SLOTS];
+    SpscQueue free;
+    uint32_t overflows;
+} PayloadPool;
+
+#define POOL_FREE_LIST(pool) { \
+    .slots = { &pool.slots[0], &pool.slots[1] }, \
+    .head = PAYLOAD_POOL_SLOTS, \
+    .tail = 0 }
+
+_Static_assert(PAYLOAD_POOL_SLOTS == 2, "POOL_FREE_LIST lists every slot");
+_Static_assert(PAYLOAD_POOL_SLOTS <= SPSC_QUEUE_CAPACITY, "free list holds every slot");
+
+static PayloadPool request_pool = { .free = POOL_FREE_LIST(request_pool) };
+static PayloadPool response_pool = { .free = POOL_FREE_LIST(response_pool) };
+
+static PayloadPool *owning_pool(const Payload *payload) {
+    const PayloadSlot *slot = (const PayloadSlot *)payload;
+    if (slot >= request_pool.slots && slot < request_pool.slots + PAYLOAD_POOL_SLOTS) {
+        return &request_pool;
+    }
+    if (slot >= response_pool.slots && slot < response_pool.slots + PAYLOAD_POOL_SLOTS) {
+        return &response_pool;
+    }
+    return NULL;
+}
+
+static Payload *acquire_payload(PayloadPool *pool) {
+    void *slot;
+    Payload *payload;
+    if (spsc_queue_pop(&pool->free, &slot)) {
+        payload = &((PayloadSlot *)slot)->payload;
+    } else {
+        pool->overflows++;
+        payload = (Payload *)malloc(sizeof(Payload));
+        if (payload == NULL) {
+            printf("Error: Memory allocation failed for payload\n");
+            return NULL;
+        }
+    }
+    memset(payload, 0, sizeof(Payload));
+    return payload;
+}
+
+Payload* acquire_request_payload(void) {
+    return acquire_payload(&request_pool);
+}
+
+Payload* acquire_response_payload(void) {
+    return acquire_payload(&response_pool);
+}
+
+// Slot buffers are used when they fit, otherwise heap memory that
+// release_payload frees again
+uint8_t* payload_params_buffer(Payload *payload, uint16_t params_size) {
+    PayloadPool *pool = owning_pool(payload);
+    if (pool != NULL && params_size <= PAYLOAD_PARAMS_MAX) {
+        payload->params = ((PayloadSlot *)payload)->params;
+        return payload->params;
+    }
+    if (pool != NULL) {
+        pool->overflows++;
+    }
+    payload->params = (uint8_t *)malloc(params_size);
+    return payload->params;
+}
+
+uint8_t* payload_data_buffer(Payload *payload, uint32_t data_size) {
+    PayloadPool *pool = owning_pool(payload);
+    if (pool != NULL && data_size <= PAYLOAD_DATA_MAX) {
+        payload->data = ((PayloadSlot *)payload)->data;
+        return payload->data;
+    }
+    if (pool != NULL) {
+        pool->overflows++;
+    }
+    payload->data = (uint8_t *)malloc(data_size);
+    return payload->data;
+}
+
+void release_payload(Payload *payload) {
+    if (payload == NULL) {
+        return;
+    }
+    PayloadPool *pool = owning_pool(payload);
+    if (pool == NULL) {
+        free(payload->params);
+        free(payload->data);
+        free(payload);
+        return;
+    }
+    PayloadSlot *slot = (PayloadSlot *)payload;
+    if (payload->params != slot->params) {
+        free(payload->params);
+    }
+    if (payload->data != slot->data) {
+        free(payload->data);
+    }
+    spsc_queue_push(&pool->free, slot);
+}
+
+uint32_t payload_pool_overflows(void) {
+    return request_pool.overflows + response_pool.overflows;
+}
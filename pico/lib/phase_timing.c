@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "phase_timing.h"
+
+#ifdef PHASE_TIMING
+
+#if !PICO_ON_DEVICE
+#include <time.h>
+#endif
+
+#define PHASE_SAMPLES 8192  // samples kept per phase, later ones are dropped
+
+static uint32_t phase_samples[PHASE_COUNT][PHASE_SAMPLES];
+static uint32_t phase_sample_count[PHASE_COUNT];
+static uint64_t phase_totals[PHASE_COUNT];
+static uint64_t phase_pending[PHASE_COUNT];
+static bool phase_touched[PHASE_COUNT];
+
+static const char *const phase_names[PHASE_COUNT] = {
+    "framing", "crc", "seek", "file io", "transmit"
+};
+
+uint64_t phase_clock_ns(void) {
+#if PICO_ON_DEVICE
+    return time_us_64() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+void phase_add(TimingPhase phase, uint64_t elapsed_ns) {
+    phase_pending[phase] += elapsed_ns;
+    phase_touched[phase] = true;
+}
+
+void phase_commit(void) {
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (!phase_touched[phase]) {
+            continue;
+        }
+        if (phase_sample_count[phase] < PHASE_SAMPLES) {
+            uint64_t elapsed = phase_pending[phase];
+            phase_samples[phase][phase_sample_count[phase]++] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+        }
+        phase_totals[phase] += phase_pending[phase];
+        phase_pending[phase] = 0;
+        phase_touched[phase] = false;
+    }
+}
+
+void phase_reset(void) {
+    memset(phase_sample_count, 0, sizeof(phase_sample_count));
+    memset(phase_totals, 0, sizeof(phase_totals));
+    memset(phase_pending, 0, sizeof(phase_pending));
+    memset(phase_touched, 0, sizeof(phase_touched));
+}
+
+static int compare_samples(const void *a, const void *b) {
+    uint32_t left = *(const uint32_t *)a;
+    uint32_t right = *(const uint32_t *)b;
+    return (left > right) - (left < right);
+}
+
+bool phase_summary(TimingPhase phase, PhaseSummary *summary) {
+    memset(summary, 0, sizeof(PhaseSummary));
+    uint32_t count = phase_sample_count[phase];
+    if (count == 0) {
+        return false;
+    }
+    qsort(phase_samples[phase], count, sizeof(uint32_t), compare_samples);
+    summary->count = count;
+    summary->p50_ns = phase_samples[phase][(count - 1) / 2];
+    summary->p99_ns = phase_samples[phase][((uint64_t)(count - 1) * 99) / 100];
+    summary->total_ns = phase_totals[phase];
+    return true;
+}
+
+const char *phase_name(TimingPhase phase) {
+    return phase_names[phase];
+}
+
+#endif
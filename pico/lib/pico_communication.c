@@ -6,6 +6,9 @@
 #include "pico/stdlib.h"
 #include "hardware/clocks.h"
 #include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "pico/multicore.h"
 #include "receive_fifo.pio.h"
 #include "transmit_fifo.pio.h"
@@ -15,11 +18,75 @@
 #include "pico_communication.h"
 #include "command_dispatch.h"
 #include "sd_block_device.h"
+#include "storage_core.h"
+#include "payload_pool.h"
+#include "phase_timing.h"
+#include "boot_timeline.h"
 
 #define __no_inline_not_in_flash_func(read_burst_from_pio_fifo) __noinline __not_in_flash_func(read_burst_from_pio_fifo)
 
 static const bool DEBUG_PACKETS = false;
 
+// DMA_IRQ_0 is left to the SDIO driver, the link uses DMA_IRQ_1 as a shared handler
+static uint link_rx_dma_chan;
+static uint link_tx_dma_chan;
+
+// A transmit is a list of control blocks, each one contiguous run of bytes. The
+// control channel writes a block into the TX channel's alias registers, the
+// write to al3_read_addr_trig starts it, and when it finishes it chains back to
+// the control channel for the next block. The {0, NULL} block ends the list
+// with a null trigger, which raises the TX channel's IRQ_QUIET interrupt.
+// transfer_count is pointer sized so the pair matches the register layout.
+typedef struct {
+    uintptr_t transfer_count;
+    const volatile void *read_addr;
+} TxControlBlock;
+
+// The control channel's write address wraps around one block
+#define TX_CONTROL_BLOCK_RING_BITS __builtin_ctz(sizeof(TxControlBlock))
+#define TX_MAX_BLOCKS 4
+
+static TxControlBlock tx_blocks[TX_MAX_BLOCKS];
+static uint tx_block_count;
+static uint8_t tx_header[FRAME_HEADER_SIZE];
+static volatile bool tx_chain_done = true;
+
+// Set by the handshake the Victor opened with. A framed response carries the
+// sequence of the request it answers.
+static bool framed_link = false;
+static bool fill_sectors = false;       // CAP_FILL_SECTORS agreed
+static IntegrityKind link_integrity = INTEGRITY_CRC8;
+static uint8_t frame_seq;
+static bool tx_sniffing;        // the DMA sniffer is checking the frame going out
+
+// A NAKed frame of a streamed read goes out again from here, see
+// transmit_streamed_read. It holds the frame as sent, sector coded or not.
+static uint8_t segment_buffer[CODED_SEGMENT_MAX];
+
+_Static_assert(SEGMENT_SECTORS % READ_STREAM_SECTORS == 0, "stream chunks fill segments exactly");
+_Static_assert(SEGMENT_SIZE <= PAYLOAD_DATA_MAX, "a write segment fits a pool slot");
+
+static uint16_t segment_sectors(uint32_t sectors_left) {
+    return sectors_left > SEGMENT_SECTORS ? SEGMENT_SECTORS : sectors_left;
+}
+
+// PIO sample clock. The Victor can ask for another one within these bounds in
+// the capability exchange, for instance a slower one over a long cable.
+#define PIO_CLOCK_MHZ 30
+#define PIO_CLOCK_MIN_MHZ 4
+#define PIO_CLOCK_MAX_MHZ 62
+static uint8_t pio_clock_mhz = PIO_CLOCK_MHZ;
+
+// The DMA sniffer works out CRC-16/CCITT on the bytes a channel moves, so a
+// frame checked by it costs the core nothing. It has no CRC-8 mode and there
+// is one for all channels with no claim in the SDK, while sd_get_by_num hands
+// the storage core the SPI card whose driver runs its own DMA on core 1. So
+// the link follows the receive DMA with the core by default, build with
+// LINK_DMA_SNIFFER=1 only for an SD driver known never to enable sniffing.
+#ifndef LINK_DMA_SNIFFER
+#define LINK_DMA_SNIFFER 0
+#endif
+
 void debug_print_payload(Payload *payload) {
     if (DEBUG_PACKETS) {
         printf("Protocol: %d\n", payload->protocol);
@@ -32,21 +99,73 @@ void debug_print_payload(Payload *payload) {
     }
 }
 
-PIO_state* init_pio(void) {
-    stdio_init_all();
+// Completion only has to wake the core out of __wfe, the waiter rechecks busy
+static void __isr link_dma_irq_handler(void) {
+    if (dma_channel_get_irq1_status(link_rx_dma_chan)) {
+        dma_channel_acknowledge_irq1(link_rx_dma_chan);
+    }
+    if (dma_channel_get_irq1_status(link_tx_dma_chan)) {
+        dma_channel_acknowledge_irq1(link_tx_dma_chan);
+        tx_chain_done = true;
+    }
+}
+
+// One byte wide transfers from the RX FIFO, the write address and count are
+// filled in per packet by read_burst_from_pio_fifo
+static void init_rx_dma(PIO_state *pio_state) {
+    pio_state->rx_dma_chan = dma_claim_unused_channel(true);
+    link_rx_dma_chan = pio_state->rx_dma_chan;
+
+    dma_channel_config config = dma_channel_get_default_config(pio_state->rx_dma_chan);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_dreq(&config, pio_get_dreq(pio_state->pio, pio_state->rx_sm, false));
+    dma_channel_configure(pio_state->rx_dma_chan, &config, NULL,
+                          &pio_state->pio->rxf[pio_state->rx_sm], 0, false);
+
+    dma_channel_set_irq1_enabled(pio_state->rx_dma_chan, true);
+    irq_add_shared_handler(DMA_IRQ_1, link_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+}
+
+// The TX channel is paced by the TX state machine's DREQ, so the FIFO and the
+// transmit_fifo.pio handshake stay the flow control. Its read address and count
+// come from the control blocks, see start_tx_chain
+static void init_tx_dma(PIO_state *pio_state) {
+    pio_state->tx_dma_chan = dma_claim_unused_channel(true);
+    pio_state->tx_ctrl_dma_chan = dma_claim_unused_channel(true);
+    link_tx_dma_chan = pio_state->tx_dma_chan;
+
+    dma_channel_config config = dma_channel_get_default_config(pio_state->tx_dma_chan);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(pio_state->pio, pio_state->tx_sm, true));
+    channel_config_set_chain_to(&config, pio_state->tx_ctrl_dma_chan);
+    channel_config_set_irq_quiet(&config, true);
+    dma_channel_configure(pio_state->tx_dma_chan, &config,
+                          &pio_state->pio->txf[pio_state->tx_sm], NULL, 0, false);
 
+    dma_channel_config ctrl = dma_channel_get_default_config(pio_state->tx_ctrl_dma_chan);
+    channel_config_set_transfer_data_size(&ctrl, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl, true);
+    channel_config_set_write_increment(&ctrl, true);
+    channel_config_set_ring(&ctrl, true, TX_CONTROL_BLOCK_RING_BITS);
+    dma_channel_configure(pio_state->tx_ctrl_dma_chan, &ctrl,
+                          &dma_hw->ch[pio_state->tx_dma_chan].al3_transfer_count, NULL, 2, false);
+
+    dma_channel_set_irq1_enabled(pio_state->tx_dma_chan, true);
+}
+
+// main has set up stdio already, core 1 may be printing by now
+PIO_state* init_pio(void) {
     printf("pico booting up pack!\n");
     const uint LED_PIN = 25;
     gpio_init(LED_PIN);
     gpio_set_dir(LED_PIN, GPIO_OUT);
 
-    gpio_put(LED_PIN, 1);
-    sleep_ms(250);
-    gpio_put(LED_PIN, 0);
-    sleep_ms(250);
-    gpio_put(LED_PIN, 1);
-    sleep_ms(250);
-    gpio_put(LED_PIN, 1);
+    gpio_put(LED_PIN, 1);   // no blinking, the card mounts on core 1 while this runs
 
     const uint RX_DATA_READY = 27;
     gpio_init(RX_DATA_READY);
@@ -67,12 +186,12 @@ PIO_state* init_pio(void) {
     gpio_init(TX_DATA_TAKEN);
     gpio_set_dir(TX_DATA_TAKEN, GPIO_IN);
 
-    int p;
-    for(p = 0; p < 2; ++p) {
-
-        PIO pio = (p == 0) ? pio0 : pio1;
-        for(int s = 0; s < 2; ++s) {
-            printf("rp2.PIO(%d).state_machine(%d).pio_sm_is_claimed(): %s\n",p, s, pio_sm_is_claimed(pio, s) ? "true" : "false");
+    if (DEBUG_PACKETS) {
+        for (int p = 0; p < 2; ++p) {
+            PIO pio = (p == 0) ? pio0 : pio1;
+            for (int s = 0; s < 2; ++s) {
+                printf("rp2.PIO(%d).state_machine(%d).pio_sm_is_claimed(): %s\n",p, s, pio_sm_is_claimed(pio, s) ? "true" : "false");
+            }
         }
     }
  
@@ -120,7 +239,7 @@ PIO_state* init_pio(void) {
 
     //for 1 MHz signal, sample PIO at 4MHz for clarity of signal
     //float target_freq = 4.0e6;  // 4MHz in Hz
-    float target_freq = 30.0e6; 
+    float target_freq = PIO_CLOCK_MHZ * 1.0e6; 
     //equal to 125MHz system clock / 4MHz sampling rate
     float clkdiv = clock_get_hz(clk_sys) / target_freq; 
 
@@ -129,18 +248,136 @@ PIO_state* init_pio(void) {
     printf("pico initing PIO\n");
     receive_fifo_init(pio_state->pio, pio_state->rx_sm, rx_offset, clkdiv);
     transmit_fifo_init(pio_state->pio, pio_state->tx_sm, tx_offset, clkdiv);
+    init_rx_dma(pio_state);
+    init_tx_dma(pio_state);
+    boot_mark(BOOT_PIO);
     return pio_state;
 }
 
+static void set_pio_clock(PIO_state *pio_state, uint8_t mhz) {
+    float clkdiv = clock_get_hz(clk_sys) / (mhz * 1.0e6);
+    pio_sm_set_clkdiv(pio_state->pio, pio_state->rx_sm, clkdiv);
+    pio_sm_set_clkdiv(pio_state->pio, pio_state->tx_sm, clkdiv);
+    pio_clock_mhz = mhz;
+    printf("PIO clock %d MHz, divider: %2.2f\n", mhz, clkdiv);
+}
+
+// The Pico's half of the capability exchange, see STARTUP_HANDSHAKE_CAPS. Each
+// setting is the best both sides support. A damaged offer is refused with
+// version 0 and leaves the link stop-and-wait until the Victor starts over.
+static void answer_capabilities(PIO_state *pio_state) {
+    uint8_t block[CAPABILITY_BLOCK_MAX + 3];
+    block[0] = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    block[1] = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    uint8_t size = block[1];
+    bool valid = size <= CAPABILITY_BLOCK_MAX;
+    for (uint8_t i = 0; valid && i <= size; i++) {
+        block[2 + i] = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    }
+    valid = valid && block[0] != 0 && crc8(block, 2 + size) == block[2 + size];
+
+    // an offer from an older version leaves out fields, those keep what the
+    // single byte handshakes give
+    LinkCapabilities offer = { 0, 0, 1 << INTEGRITY_CRC8, SEGMENT_SECTORS, 1, CAP_ANY, CAP_ANY };
+    LinkCapabilities agreed = {0};
+    framed_link = false;
+    fill_sectors = false;
+    link_integrity = INTEGRITY_CRC8;
+    if (valid) {
+        memcpy(&offer.features, &block[2], size < sizeof(offer) - 1 ? size : sizeof(offer) - 1);
+        agreed.version = block[0] < CAPABILITY_VERSION ? block[0] : CAPABILITY_VERSION;
+        agreed.features = offer.features & (CAP_FRAMED | CAP_BLOCK_BATCH | CAP_FILL_SECTORS);
+        if ((agreed.features & CAP_FRAMED) == 0) {
+            agreed.features &= ~CAP_FILL_SECTORS;
+        }
+        link_integrity = (offer.integrity & (1 << INTEGRITY_CRC16)) ? INTEGRITY_CRC16 : INTEGRITY_CRC8;
+        agreed.integrity = 1 << link_integrity;
+        agreed.max_request_sectors = offer.max_request_sectors < MAX_REQUEST_SECTORS ?
+                                     offer.max_request_sectors : MAX_REQUEST_SECTORS;
+        agreed.window = 1;
+        if (offer.write_policy <= WRITE_BACK_METADATA_THROUGH) {
+            sd_set_write_policy((WritePolicy)offer.write_policy);
+        }
+        agreed.write_policy = sd_write_policy();
+        agreed.pio_clock_mhz = pio_clock_mhz;
+        if (offer.pio_clock_mhz >= PIO_CLOCK_MIN_MHZ && offer.pio_clock_mhz <= PIO_CLOCK_MAX_MHZ) {
+            agreed.pio_clock_mhz = offer.pio_clock_mhz;
+        }
+        framed_link = (agreed.features & CAP_FRAMED) != 0;
+        fill_sectors = (agreed.features & CAP_FILL_SECTORS) != 0;
+        if (!framed_link && agreed.max_request_sectors > SEGMENT_SECTORS) {
+            agreed.max_request_sectors = SEGMENT_SECTORS;   // segments are frames
+        }
+    }
+    size = sizeof(agreed) - 1;
+    block[0] = agreed.version;
+    block[1] = size;
+    memcpy(&block[2], &agreed.features, size);
+    block[2 + size] = crc8(block, 2 + size);
+    for (uint8_t i = 0; i < 3 + size; i++) {
+        pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, block[i]);
+    }
+    // the link is handshaked byte by byte, so the clock can change under it
+    if (valid && agreed.pio_clock_mhz != pio_clock_mhz) {
+        set_pio_clock(pio_state, agreed.pio_clock_mhz);
+    }
+}
+
+static bool is_handshake_offer(uint8_t handshake) {
+    return handshake == STARTUP_HANDSHAKE || handshake == STARTUP_HANDSHAKE_FRAMED ||
+           handshake == STARTUP_HANDSHAKE_FRAMED_CRC16 || handshake == STARTUP_HANDSHAKE_CAPS;
+}
+
+// Any handshake starts the link over, the framed ones also switch it to
+// single frame requests with the check they name
+static bool answer_handshake(PIO_state *pio_state, uint8_t handshake) {
+    uint8_t answer;
+    switch (handshake) {
+        case STARTUP_HANDSHAKE_CAPS:
+            pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, HANDSHAKE_RESPONSE_CAPS);
+            answer_capabilities(pio_state);
+            return true;
+        case STARTUP_HANDSHAKE:
+            framed_link = false;
+            answer = HANDSHAKE_RESPONSE;
+            break;
+        case STARTUP_HANDSHAKE_FRAMED:
+            framed_link = true;
+            link_integrity = INTEGRITY_CRC8;
+            answer = HANDSHAKE_RESPONSE_FRAMED;
+            break;
+        case STARTUP_HANDSHAKE_FRAMED_CRC16:
+            framed_link = true;
+            link_integrity = INTEGRITY_CRC16;
+            answer = HANDSHAKE_RESPONSE_FRAMED_CRC16;
+            break;
+        default:
+            return false;
+    }
+    fill_sectors = false;   // only the capability exchange turns it on
+    pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, answer);
+    return true;
+}
+
+// Offers that come in while core 1 is still mounting the card get
+// HANDSHAKE_RESPONSE_BUSY at once, the Victor tries the same offer again later
 void wait_for_startup_handshake(PIO_state *pio_state) {
     printf("Waiting for startup handshake\n");
+    uint32_t busy_answers = 0;
     while (true) {
         uint8_t handshake = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+        boot_mark(BOOT_HANDSHAKE);
+        if (is_handshake_offer(handshake) && !storage_core_ready()) {
+            pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, HANDSHAKE_RESPONSE_BUSY);
+            busy_answers++;
+            continue;
+        }
         printf("Received byte %d\n", handshake);
-        if (handshake == STARTUP_HANDSHAKE) {
-            printf("Startup handshake received\n");
-            pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, HANDSHAKE_RESPONSE);
-            printf("Sent handshake response\n");
+        if (answer_handshake(pio_state, handshake)) {
+            boot_mark(BOOT_LINK_READY);
+            printf("Startup handshake received, sent response, framed: %d integrity: %d busy answers: %u\n",
+                   framed_link, link_integrity, (unsigned)busy_answers);
+            boot_timeline_print();
             // Handshake is considered complete
             return;
 
@@ -150,37 +387,79 @@ void wait_for_startup_handshake(PIO_state *pio_state) {
     }
 }
 
-void process_incoming_commands(SDState *sd_state, PIO_state *pio_state) {
+// A handler that could not get a response payload, or a request the link
+// refuses, still owes the Victor an answer. This one has the status as its only param, as a failed write's has,
+// and lives on the stack until it is sent.
+static ResponseStatus transmit_error_response(PIO_state *pio_state, const Payload *request, ResponseStatus status) {
+    uint8_t params[1] = { (uint8_t)status };
+    Payload response = {0};
+    response.protocol = request->protocol;
+    response.command = request->command;
+    response.status = status;
+    response.params_size = sizeof(params);
+    response.params = params;
+    printf("Error: answering protocol %d command %d with %d\n", request->protocol, request->command, status);
+    return transmit_response(pio_state, &response);
+}
+
+void process_incoming_commands(PIO_state *pio_state) {
     printf("Processing incoming commands\n");
+    storage_core_attach(pio_state);
     while (true) {
-        Payload *payload = (Payload*)malloc(sizeof(Payload));
+        Payload *payload = acquire_request_payload();
         if (payload == NULL) {
-            printf("Error: Memory allocation failed for payload\n");
             return;
         }
-        memset(payload, 0, sizeof(Payload));
         ResponseStatus outcome = receive_command_payload(pio_state, payload);
+        if (outcome == LINK_RESTARTED) {
+            release_payload(payload);
+            continue;
+        }
         if (outcome != STATUS_OK) {
             printf("Error: Command payload reception failed %d\n", outcome);
-            free(payload->params);
-            free(payload->data);
-            free(payload);
+            release_payload(payload);
             continue;
         }
         debug_print_payload(payload);
-        Payload *response = dispatch_command(sd_state, pio_state, payload); 
-        ResponseStatus status = transmit_response(pio_state, response);
+        ResponseStatus status;
+        Payload *response = NULL;
+        if (is_segmented_write(payload)) {
+            // it gives the request back itself, segment by segment
+            response = receive_segmented_write(pio_state, payload);
+            payload = NULL;
+            status = response != NULL ? transmit_response(pio_state, response) : INVALID_CRC;
+        } else if (is_streamed_read(payload) && !framed_link &&
+                   ((ReadParams *)payload->params)->sector_count > SEGMENT_SECTORS) {
+            // a stop-and-wait data packet has a 16 bit size, past the sectors
+            // agreed for the link it would wrap
+            status = transmit_error_response(pio_state, payload, INVALID_DATA_SIZE);
+        } else {
+            // Only a streamed read overlaps the cores, its sectors go out as
+            // the storage core reads them. Anything else answers from the
+            // storage core's response, and with window 1 the Victor sends
+            // nothing more until it has that answer, so this core just waits.
+            StorageRequest *request = storage_submit(payload);
+            if (is_streamed_read(payload)) {
+                status = transmit_streamed_read(pio_state, payload);
+                storage_wait_complete();
+            } else {
+                storage_wait_complete();
+                response = request->response;
+                status = response != NULL ? transmit_response(pio_state, response) :
+                                            transmit_error_response(pio_state, payload, MEMORY_ALLOCATION_ERROR);
+            }
+            storage_release(request);
+        }
         if (status != STATUS_OK) {
-            printf("Error: Command dispatch failed\n");
-        }       
+            printf("Error: Command dispatch failed %d\n", status);
+        }
+        PHASE_COMMIT();
         if (DEBUG_PACKETS) { printf("Receive command Payload successfully\n");}
-        debug_print_payload(response);
-        free(payload->params);
-        free(payload->data);
-        free(payload);
-        free(response->params);
-        free(response->data);
-        free(response);
+        release_payload(payload);
+        if (response != NULL) {
+            debug_print_payload(response);
+            release_payload(response);
+        }
     }
 }
 
@@ -190,9 +469,24 @@ uint16_t receive_utf16(PIO_state *pio_state) {
     return (high_byte << 8) | low_byte;
 }
 
+// The first byte tells the three apart: a handshake, the sequence number that
+// opens a frame, or the protocol byte of a stop-and-wait command packet
 ResponseStatus receive_command_payload(PIO_state *pio_state, Payload *payload) {
 
     if (DEBUG_PACKETS) {printf("Waiting for incoming command\n");}
+    uint8_t first = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    if (answer_handshake(pio_state, first)) {
+        printf("Startup handshake received, link restarted, framed: %d integrity: %d\n", framed_link, link_integrity);
+        return LINK_RESTARTED;
+    }
+    if (framed_link) {
+        if ((first & FRAME_SEQUENCE_FLAG) == 0) {
+            printf("Error: byte %d where a frame should start\n", first);
+            return INVALID_PROTOCOL;
+        }
+        return receive_frame(pio_state, payload, first);
+    }
+    payload->protocol = (V9KProtocol) first;
     ResponseStatus outcome = receive_command_packet(pio_state, payload);
     if (outcome != STATUS_OK) {
         printf("Error: Command packet reception failed %d\n", outcome);
@@ -211,29 +505,273 @@ ResponseStatus receive_command_payload(PIO_state *pio_state, Payload *payload) {
     return outcome;
 }
 
-void read_burst_from_pio_fifo(PIO pio, uint sm, uint8_t *receiveData, uint32_t loop_size) {
-    int count = 0;
-    for (int i = 0; i < loop_size; ++i) {
-        receiveData[i]= pio_sm_get_blocking(pio, sm);
+// Lands loop_size bytes from the RX FIFO straight in receiveData by DMA, the
+// core sleeps until the completion interrupt
+void read_burst_from_pio_fifo(PIO_state *pio_state, uint8_t *receiveData, uint32_t loop_size) {
+    if (loop_size == 0) {
+        return;
+    }
+    dma_channel_set_write_addr(pio_state->rx_dma_chan, receiveData, false);
+    dma_channel_set_trans_count(pio_state->rx_dma_chan, loop_size, true);
+    while (dma_channel_is_busy(pio_state->rx_dma_chan)) {
+        __wfe();
     }
 }
 
-ResponseStatus receive_command_packet(PIO_state *pio_state, Payload *payload) {
-    if (DEBUG_PACKETS) { printf("Waiting for command packet\n"); }
+static bool sniffer_covers(IntegrityKind kind) {
+    return LINK_DMA_SNIFFER && kind == INTEGRITY_CRC16;
+}
+
+static void sniff_channel(uint channel, uint16_t seed) {
+    dma_sniffer_enable(channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC16, true);
+    dma_sniffer_set_data_accumulator(seed);
+}
+
+// read_burst_from_pio_fifo that continues check over the bytes as they land.
+// The sniffer does it in the DMA, otherwise the core follows the write pointer
+// instead of sleeping, so either way the check is ready with the last byte.
+static uint16_t read_burst_checked(PIO_state *pio_state, uint8_t *receiveData, uint32_t loop_size,
+                                   IntegrityKind kind, uint16_t check) {
+    if (loop_size == 0) {
+        return check;
+    }
+    bool sniffing = sniffer_covers(kind);
+    if (sniffing) {
+        sniff_channel(pio_state->rx_dma_chan, check);
+    }
+    dma_channel_set_write_addr(pio_state->rx_dma_chan, receiveData, false);
+    dma_channel_set_trans_count(pio_state->rx_dma_chan, loop_size, true);
+    uint32_t checked = 0;
+    while (dma_channel_is_busy(pio_state->rx_dma_chan)) {
+        if (sniffing) {
+            __wfe();
+            continue;
+        }
+        uint32_t landed = loop_size - dma_channel_hw_addr(pio_state->rx_dma_chan)->transfer_count;
+        if (landed == checked) {
+            tight_loop_contents();
+            continue;
+        }
+        check = integrity_update(kind, check, receiveData + checked, landed - checked);
+        checked = landed;
+    }
+    if (sniffing) {
+        return (uint16_t)dma_sniffer_get_data_accumulator();
+    }
+    return integrity_update(kind, check, receiveData + checked, loop_size - checked);
+}
+
+// Bytes the Victor has already committed to sending when there is nowhere to
+// put them
+static void discard_from_pio_fifo(PIO_state *pio_state, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    }
+}
+
+// Whether the data of a frame from the Victor is sector coded, see SECTOR_FILL
+static bool is_coded_write(const Payload *payload) {
+    return fill_sectors && payload->protocol == SD_BLOCK_DEVICE &&
+           (payload->command == WRITE_NO_VERIFY || payload->command == WRITE_VERIFY) &&
+           payload->data_size % SECTOR_SIZE == 0;
+}
+
+// read_burst_checked for sector coded data. A filled sector costs two bytes on
+// the wire and is expanded here.
+static uint16_t read_sectors_checked(PIO_state *pio_state, uint8_t *data, uint32_t size,
+                                     IntegrityKind kind, uint16_t check) {
+    for (uint32_t offset = 0; offset < size; offset += SECTOR_SIZE) {
+        uint8_t coding[2];
+        check = read_burst_checked(pio_state, coding, 1, kind, check);
+        if (coding[0] == SECTOR_FILL) {
+            check = read_burst_checked(pio_state, &coding[1], 1, kind, check);
+            memset(data + offset, coding[1], SECTOR_SIZE);
+        } else {
+            check = read_burst_checked(pio_state, data + offset, SECTOR_SIZE, kind, check);
+        }
+    }
+    return check;
+}
+
+static void discard_coded_sectors(PIO_state *pio_state, uint32_t size) {
+    for (uint32_t offset = 0; offset < size; offset += SECTOR_SIZE) {
+        uint8_t coding = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+        discard_from_pio_fifo(pio_state, coding == SECTOR_FILL ? 1 : SECTOR_SIZE);
+    }
+}
+
+// One frame holds the whole request and gets one ack of status and sequence.
+// A NAKed frame comes again with the same sequence as a new request.
+ResponseStatus receive_frame(PIO_state *pio_state, Payload *payload, uint8_t sequence) {
+    PHASE_BEGIN(command);
     payload->protocol = (V9KProtocol) pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
-    if (payload->protocol == HANDSHAKE) {
-        printf("Handshake protocol received instead of command_packet, retrying\n");
-        for (int i = 0; i < 3; ++i) {
-            payload->protocol = (V9KProtocol) pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
-            if (payload->protocol != HANDSHAKE) {
-                break;
+    payload->command = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    payload->params_size = receive_utf16(pio_state);
+    payload->data_size = receive_utf16(pio_state);
+    ResponseStatus outcome = STATUS_OK;
+    bool coded = is_coded_write(payload);
+    if (payload_params_buffer(payload, payload->params_size) == NULL ||
+        payload_data_buffer(payload, payload->data_size) == NULL) {
+        printf("Error: Memory allocation failed for frame buffers\n");
+        discard_from_pio_fifo(pio_state, payload->params_size);
+        if (coded) {
+            discard_coded_sectors(pio_state, payload->data_size);
+        } else {
+            discard_from_pio_fifo(pio_state, payload->data_size);
+        }
+        discard_from_pio_fifo(pio_state, integrity_size(link_integrity));
+        outcome = MEMORY_ALLOCATION_ERROR;
+    } else {
+        uint16_t expected = frame_header_integrity(link_integrity, sequence, payload);
+        expected = read_burst_checked(pio_state, payload->params, payload->params_size, link_integrity, expected);
+        if (coded) {
+            expected = read_sectors_checked(pio_state, payload->data, payload->data_size, link_integrity, expected);
+        } else {
+            expected = read_burst_checked(pio_state, payload->data, payload->data_size, link_integrity, expected);
+        }
+        uint16_t check = 0;
+        for (uint8_t i = 0; i < integrity_size(link_integrity); i++) {
+            check = (check << 8) | pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+        }
+        PHASE_END(command, PHASE_FRAMING);
+        if (expected != check) {
+            printf("Invalid CRC on frame %d\n", sequence);
+            outcome = INVALID_CRC;
+        }
+    }
+    sendResponseStatus(pio_state, outcome);
+    pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, sequence);
+    frame_seq = sequence;
+    return outcome;
+}
+
+// The sectors of a request past its frame, see SEGMENT_SECTORS. Each segment
+// takes the next sequence, a NAKed one comes again with the same. Segments are
+// coded when their frame was. Without a buffer (data NULL) every attempt is
+// drained and answered MEMORY_ALLOCATION_ERROR, so the Victor gives the write
+// up and can retry it.
+static ResponseStatus receive_segment(PIO_state *pio_state, uint8_t *data, uint16_t size, bool coded) {
+    uint8_t expected = NEXT_FRAME_SEQUENCE(frame_seq);
+    ResponseStatus outcome = INVALID_CRC;
+    for (int attempt = 0; attempt < FRAME_MAX_ATTEMPTS; attempt++) {
+        uint8_t sequence = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+        if (data == NULL) {
+            if (coded) {
+                discard_coded_sectors(pio_state, size);
+            } else {
+                discard_from_pio_fifo(pio_state, size);
             }
+            discard_from_pio_fifo(pio_state, integrity_size(link_integrity));
+            outcome = MEMORY_ALLOCATION_ERROR;
+            sendResponseStatus(pio_state, outcome);
+            pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, sequence);
+            continue;
         }
+        uint16_t computed = segment_header_integrity(link_integrity, sequence);
+        if (coded) {
+            computed = read_sectors_checked(pio_state, data, size, link_integrity, computed);
+        } else {
+            computed = read_burst_checked(pio_state, data, size, link_integrity, computed);
+        }
+        uint16_t check = 0;
+        for (uint8_t i = 0; i < integrity_size(link_integrity); i++) {
+            check = (check << 8) | pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+        }
+        outcome = (sequence == expected && computed == check) ? STATUS_OK : INVALID_CRC;
+        sendResponseStatus(pio_state, outcome);
+        pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, sequence);
+        if (outcome == STATUS_OK) {
+            frame_seq = expected;
+            return STATUS_OK;
+        }
+        printf("Invalid segment %d, expected %d\n", sequence, expected);
     }
+    return outcome;
+}
+
+// A framed WRITE of more sectors than its frame carried, the rest follow it
+// as segment frames
+bool is_segmented_write(const Payload *payload) {
+    if (!framed_link || payload->protocol != SD_BLOCK_DEVICE ||
+        (payload->command != WRITE_NO_VERIFY && payload->command != WRITE_VERIFY) ||
+        payload->params_size < sizeof(WriteParams)) {
+        return false;
+    }
+    const WriteParams *params = (const WriteParams *)payload->params;
+    return (uint32_t)params->sector_count * SECTOR_SIZE > payload->data_size;
+}
+
+// Link core half of a segmented WRITE. Each segment goes to the storage core as
+// a write of its own while the next one comes in, so card and wire time
+// overlap, and only the last one of a WRITE_VERIFY waits for the card. It takes
+// over the request and gives every segment back. Returns the one response for
+// the Victor, the first failed segment's or else the last one's, or NULL when
+// the Victor gave up on a segment and waits for no response.
+Payload* receive_segmented_write(PIO_state *pio_state, Payload *payload) {
+    WriteParams next = *(WriteParams *)payload->params;
+    uint8_t command = payload->command;
+    bool coded = is_coded_write(payload);
+    Payload *segment = payload;
+    Payload *answer = NULL;
+    while (segment != NULL) {
+        WriteParams *params = (WriteParams *)segment->params;
+        *params = next;
+        params->sector_count = segment->data_size / SECTOR_SIZE;
+        next.start_sector += params->sector_count;
+        next.sector_count -= params->sector_count;
+        segment->command = next.sector_count > 0 ? WRITE_NO_VERIFY : command;
+        StorageRequest *request = storage_submit(segment);
+
+        Payload *following = NULL;
+        bool link_ok = true;
+        if (next.sector_count > 0) {
+            uint16_t size = segment_sectors(next.sector_count) * SECTOR_SIZE;
+            following = acquire_request_payload();
+            if (following == NULL || payload_params_buffer(following, sizeof(WriteParams)) == NULL ||
+                payload_data_buffer(following, size) == NULL) {
+                printf("Error: Memory allocation failed for a write segment\n");
+                release_payload(following);
+                following = NULL;
+                receive_segment(pio_state, NULL, size, coded);
+                link_ok = false;
+            } else {
+                following->protocol = segment->protocol;
+                following->params_size = sizeof(WriteParams);
+                following->data_size = size;
+                link_ok = receive_segment(pio_state, following->data, size, coded) == STATUS_OK;
+            }
+        }
+
+        storage_wait_complete();
+        Payload *response = request->response;
+        storage_release(request);
+        release_payload(segment);
+        if (answer != NULL && answer->status == STATUS_OK) {
+            release_payload(answer);
+            answer = NULL;
+        }
+        if (answer == NULL) {
+            answer = response;
+        } else {
+            release_payload(response);
+        }
+        if (!link_ok) {
+            printf("Error: write segment not taken, dropping the write\n");
+            release_payload(following);
+            release_payload(answer);
+            return NULL;
+        }
+        segment = following;
+    }
+    return answer;
+}
+
+ResponseStatus receive_command_packet(PIO_state *pio_state, Payload *payload) {
+    if (DEBUG_PACKETS) { printf("Waiting for command packet\n"); }
+    PHASE_BEGIN(command);
     payload->command = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm); 
     payload->params_size = receive_utf16(pio_state);
-    payload->params = malloc(payload->params_size);
-    if (payload->params == NULL) {
+    if (payload_params_buffer(payload, payload->params_size) == NULL) {
         printf("Error: Memory allocation failed for payload->params buffer\n");
         sendResponseStatus(pio_state, MEMORY_ALLOCATION_ERROR);
         return MEMORY_ALLOCATION_ERROR;
@@ -243,10 +781,14 @@ ResponseStatus receive_command_packet(PIO_state *pio_state, Payload *payload) {
         printf("Protocol: %d, Command: %d\n", payload->protocol, payload->command);
     }
     if (DEBUG_PACKETS) { printf("Recieving command parameters, size: %d\n", payload->params_size); }
-    read_burst_from_pio_fifo(pio_state->pio, pio_state->rx_sm, payload->params, payload->params_size);
+    read_burst_from_pio_fifo(pio_state, payload->params, payload->params_size);
     payload->command_crc = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
     if (DEBUG_PACKETS) { printf("Done getting command packet %d\n", payload->command_crc); }
-    if ( !is_valid_command_crc8(payload) ) {
+    PHASE_END(command, PHASE_FRAMING);
+    PHASE_BEGIN(crc);
+    bool valid_crc = is_valid_command_crc8(payload);
+    PHASE_END(crc, PHASE_CRC);
+    if ( !valid_crc ) {
         sendResponseStatus(pio_state, INVALID_CRC);  //send a CRC failure Response   
         printf("Invalid CRC on command packet\n");
         return INVALID_CRC;
@@ -258,21 +800,25 @@ ResponseStatus receive_command_packet(PIO_state *pio_state, Payload *payload) {
 
 ResponseStatus receive_data_packet(PIO_state *pio_state, Payload *payload) {
     if (DEBUG_PACKETS) { printf("Waiting for data packet\n"); }
+    PHASE_BEGIN(data);
     payload->data_size = receive_utf16(pio_state);
     if (DEBUG_PACKETS) { printf("Data size: %d\n", payload->data_size);}
-    payload->data = malloc(payload->data_size);
-    if (payload->data == NULL) {
+    if (payload_data_buffer(payload, payload->data_size) == NULL) {
         printf("Error: Memory allocation failed for payload->data buffer\n");
         sendResponseStatus(pio_state, MEMORY_ALLOCATION_ERROR);
         return MEMORY_ALLOCATION_ERROR;
     }
     if (DEBUG_PACKETS) { printf("Receiving data buffer\n"); }
-    read_burst_from_pio_fifo(pio_state->pio, pio_state->rx_sm, payload->data, payload->data_size);
+    // the CRC starts with the size, high byte first
+    uint8_t size_bytes[2] = { (payload->data_size >> 8) & 0xFF, payload->data_size & 0xFF };
+    uint16_t crc = integrity_update(INTEGRITY_CRC8, 0, size_bytes, 2);
+    crc = read_burst_checked(pio_state, payload->data, payload->data_size, INTEGRITY_CRC8, crc);
     
     if (DEBUG_PACKETS) { printf("Receiving data buffer completed\n"); }
     payload->data_crc = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
     if (DEBUG_PACKETS) { printf("Received CRC, Done getting data packet\n"); }
-    if ( !is_valid_data_crc8(payload) ) {
+    PHASE_END(data, PHASE_FRAMING);
+    if (payload->data_crc != crc) {
         sendResponseStatus(pio_state, INVALID_CRC);  //send a CRC failure Response
         printf("Invalid CRC on data packet\n");
         return INVALID_CRC;
@@ -289,46 +835,370 @@ void transmit_utf16(PIO_state *pio_state, uint16_t value) {
     pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, low_byte);
 }
 
+// Empty runs are left out, a zero count trigger would not chain on
+static void add_tx_block(const volatile void *read_addr, uint32_t transfer_count) {
+    if (transfer_count == 0) {
+        return;
+    }
+    if (tx_block_count == TX_MAX_BLOCKS - 1) {
+        panic("Too many TX control blocks\n");
+    }
+    tx_blocks[tx_block_count].transfer_count = transfer_count;
+    tx_blocks[tx_block_count].read_addr = read_addr;
+    tx_block_count++;
+}
+
+// Hands the blocks added so far to the TX state machine and returns straight
+// away, the core is free until wait_tx_chain
+static void start_tx_chain(PIO_state *pio_state) {
+    tx_blocks[tx_block_count].transfer_count = 0;
+    tx_blocks[tx_block_count].read_addr = NULL;
+    tx_block_count = 0;
+    tx_chain_done = false;
+    dma_channel_set_read_addr(pio_state->tx_ctrl_dma_chan, tx_blocks, true);
+}
+
+static void wait_tx_chain(void) {
+    while (!tx_chain_done) {
+        __wfe();
+    }
+}
+
 void sendResponseStatus(PIO_state *pio_state, ResponseStatus status) {
     uint8_t status_value = (uint8_t)status;  // Cast enum to uint8_t
     pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, status_value);
 }
 
-ResponseStatus transmit_response(PIO_state *pio_state, Payload *payload) {
-    //printf("Transmitting response packet\n"); 
-    create_command_crc8(payload);
-    create_data_crc8(payload);
+// Command half of a response, returns the Victor's verdict on its CRC
+ResponseStatus transmit_command_packet(PIO_state *pio_state, Payload *payload) {
     if (DEBUG_PACKETS) { printf("Transmitting protocol: %d and command: %d\n", payload->protocol, payload->command); }
-    pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, payload->protocol);
-    pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, payload->command);
-    transmit_utf16(pio_state, payload->params_size);
+    wait_tx_chain();
+    tx_header[0] = payload->protocol;
+    tx_header[1] = payload->command;
+    tx_header[2] = (payload->params_size >> 8) & 0xFF;
+    tx_header[3] = payload->params_size & 0xFF;
+    add_tx_block(tx_header, 4);
     if (DEBUG_PACKETS) { printf("Transmitting command parameters, size: %d\n", payload->params_size); }
-    for(int i = 0; i < payload->params_size; ++i) {
-        pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, payload->params[i]);
-    }
-    if (DEBUG_PACKETS) { printf("Transmitting command CRC\n"); }
-    pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, payload->command_crc);
+    add_tx_block(payload->params, payload->params_size);
+    add_tx_block(&payload->command_crc, 1);
+    start_tx_chain(pio_state);
+    if (DEBUG_PACKETS) { printf("Waiting for CRC value\n"); }
+    // the Victor only answers once it has taken every byte of the chain
+    uint8_t crc_outcome = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    wait_tx_chain();
+    return crc_outcome;
+}
+
+// The data half can go out in pieces: transmit_data_begin, any number of
+// transmit_data_chunk calls, then transmit_data_end. A chunk is handed to DMA
+// and the call returns, its buffer stays in use until the next call
+void transmit_data_begin(PIO_state *pio_state, uint16_t data_size) {
+    if (DEBUG_PACKETS) { printf("Transmitting data packet\n"); }
+    wait_tx_chain();
+    tx_header[0] = (data_size >> 8) & 0xFF;
+    tx_header[1] = data_size & 0xFF;
+    add_tx_block(tx_header, 2);
+}
+
+void transmit_data_chunk(PIO_state *pio_state, const uint8_t *data, uint32_t size) {
+    wait_tx_chain();
+    add_tx_block(data, size);
+    start_tx_chain(pio_state);
+}
+
+ResponseStatus transmit_data_end(PIO_state *pio_state, uint8_t data_crc) {
+    static uint8_t tx_data_crc;
+    wait_tx_chain();
+    tx_data_crc = data_crc;
+    add_tx_block(&tx_data_crc, 1);
+    start_tx_chain(pio_state);
     if (DEBUG_PACKETS) { printf("Waiting for CRC value\n"); }
     uint8_t crc_outcome = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    wait_tx_chain();
+    return crc_outcome;
+}
+
+// A response frame goes out like the data half: transmit_frame_begin, the data
+// in transmit_data_chunk calls, then transmit_frame_end with the frame check.
+// When the sniffer has the link's check it measures the frame on the way out,
+// and the check given to transmit_frame_end is XORed into it, so 0 sends it
+// as measured and 0xFFFF spoils it.
+void transmit_frame_begin(PIO_state *pio_state, Payload *payload) {
+    wait_tx_chain();
+    tx_sniffing = sniffer_covers(link_integrity);
+    if (tx_sniffing) {
+        sniff_channel(pio_state->tx_dma_chan, 0xFFFF);
+    }
+    tx_header[0] = frame_seq;
+    tx_header[1] = payload->protocol;
+    tx_header[2] = payload->command;
+    tx_header[3] = (payload->params_size >> 8) & 0xFF;
+    tx_header[4] = payload->params_size & 0xFF;
+    tx_header[5] = (payload->data_size >> 8) & 0xFF;
+    tx_header[6] = payload->data_size & 0xFF;
+    add_tx_block(tx_header, FRAME_HEADER_SIZE);
+    add_tx_block(payload->params, payload->params_size);
+}
+
+// A segment frame goes out the same way, its header is just the sequence
+void transmit_segment_begin(PIO_state *pio_state) {
+    wait_tx_chain();
+    tx_sniffing = sniffer_covers(link_integrity);
+    if (tx_sniffing) {
+        sniff_channel(pio_state->tx_dma_chan, 0xFFFF);
+    }
+    tx_header[0] = frame_seq;
+    add_tx_block(tx_header, 1);
+}
+
+ResponseStatus transmit_frame_end(PIO_state *pio_state, uint16_t frame_check) {
+    static uint8_t tx_frame_check[2];
+    wait_tx_chain();
+    if (tx_sniffing) {
+        frame_check ^= (uint16_t)dma_sniffer_get_data_accumulator();
+    }
+    tx_frame_check[0] = (frame_check >> 8) & 0xFF;
+    tx_frame_check[1] = frame_check & 0xFF;
+    uint8_t size = integrity_size(link_integrity);
+    add_tx_block(&tx_frame_check[2 - size], size);
+    start_tx_chain(pio_state);
+    uint8_t outcome = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    uint8_t sequence = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    wait_tx_chain();
+    return sequence == frame_seq ? outcome : INVALID_CRC;
+}
+
+static ResponseStatus transmit_response_frame(PIO_state *pio_state, Payload *payload) {
+    uint16_t check = 0;
+    if (!sniffer_covers(link_integrity)) {
+        PHASE_BEGIN(crc);
+        check = frame_integrity(link_integrity, frame_seq, payload);
+        PHASE_END(crc, PHASE_CRC);
+    }
+    ResponseStatus outcome = INVALID_CRC;
+    for (int attempt = 0; attempt < FRAME_MAX_ATTEMPTS && outcome != STATUS_OK; attempt++) {
+        PHASE_BEGIN(transmit);
+        transmit_frame_begin(pio_state, payload);
+        transmit_data_chunk(pio_state, payload->data, payload->data_size);
+        outcome = transmit_frame_end(pio_state, check);
+        PHASE_END(transmit, PHASE_TRANSMIT);
+    }
+    if (outcome != STATUS_OK) {
+        printf("Error: response frame %d not taken %d\n", frame_seq, outcome);
+    }
+    return outcome;
+}
+
+ResponseStatus transmit_response(PIO_state *pio_state, Payload *payload) {
+    if (framed_link) {
+        return transmit_response_frame(pio_state, payload);
+    }
+    //printf("Transmitting response packet\n"); 
+    PHASE_BEGIN(crc);
+    create_command_crc8(payload);
+    create_data_crc8(payload);
+    PHASE_END(crc, PHASE_CRC);
+    PHASE_BEGIN(transmit);
+    uint8_t crc_outcome = transmit_command_packet(pio_state, payload);
     if (crc_outcome != STATUS_OK) {
+        PHASE_END(transmit, PHASE_TRANSMIT);
         printf("Error: CRC or other failure on command portion of payload\n");
         return crc_outcome;
     }
-    if (DEBUG_PACKETS) { printf("Transmitting data packet\n"); }
-    transmit_utf16(pio_state, payload->data_size);
-    if (DEBUG_PACKETS) { printf("Transmitting data buffer\n"); }
-    for(int i = 0; i < payload->data_size; ++i) {
-        pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, payload->data[i]);
-    }
-    if (DEBUG_PACKETS) { printf("transmitting data CRC\n"); }
-    pio_sm_put_blocking(pio_state->pio, pio_state->tx_sm, payload->data_crc);
-
-    if (DEBUG_PACKETS) { printf("Waiting for CRC value\n"); }
-    crc_outcome = pio_sm_get_blocking(pio_state->pio, pio_state->rx_sm);
+    transmit_data_begin(pio_state, payload->data_size);
+    transmit_data_chunk(pio_state, payload->data, payload->data_size);
+    crc_outcome = transmit_data_end(pio_state, payload->data_crc);
+    PHASE_END(transmit, PHASE_TRANSMIT);
     if (crc_outcome != STATUS_OK) {
         printf("Error: CRC or other failure on data portion of payload\n");
         return crc_outcome;
     }
     if (DEBUG_PACKETS) { printf("Response transmitted successfully\n"); }
     return STATUS_OK;
-}
\ No newline at end of file
+}
+
+// Copies sectors into out as they go on the wire, SECTOR_FILL and the value for
+// a sector of one value, otherwise SECTOR_LITERAL and the sector. Returns the
+// bytes written.
+static uint32_t code_sectors(uint8_t *out, const uint8_t *data, uint32_t size) {
+    uint32_t written = 0;
+    for (uint32_t offset = 0; offset < size; offset += SECTOR_SIZE) {
+        const uint8_t *sector = data + offset;
+        // each byte matches the next exactly when the whole sector is one value
+        if (memcmp(sector, sector + 1, SECTOR_SIZE - 1) == 0) {
+            out[written++] = SECTOR_FILL;
+            out[written++] = sector[0];
+        } else {
+            out[written++] = SECTOR_LITERAL;
+            memcpy(out + written, sector, SECTOR_SIZE);
+            written += SECTOR_SIZE;
+        }
+    }
+    return written;
+}
+
+// Framed half of transmit_streamed_read. The sectors go out in the response
+// frame and segment frames of up to SEGMENT_SECTORS. Each chunk is copied into
+// segment_buffer, sector coded when the link agreed to it, and sent from
+// there, which frees it for the storage core straight away and lets a NAKed
+// frame go out again without another read. A failed read spoils the check of
+// every frame from there on, so the Victor gives up on the request.
+static ResponseStatus transmit_streamed_frames(PIO_state *pio_state, Payload *response, uint32_t data_size) {
+    bool sniffed = sniffer_covers(link_integrity);
+    bool read_ok = true;
+    ResponseStatus outcome = STATUS_OK;
+    uint32_t taken = 0;
+    while (taken < data_size && outcome == STATUS_OK) {
+        uint16_t size = segment_sectors((data_size - taken) / SECTOR_SIZE) * SECTOR_SIZE;
+        bool first = (taken == 0);
+        uint16_t check = 0;
+        PHASE_BEGIN(transmit);
+        if (first) {
+            response->data_size = size;
+            transmit_frame_begin(pio_state, response);
+        } else {
+            frame_seq = NEXT_FRAME_SEQUENCE(frame_seq);
+            transmit_segment_begin(pio_state);
+        }
+        PHASE_END(transmit, PHASE_TRANSMIT);
+        if (!sniffed) {
+            // the sniffer measures it on the way out, see transmit_frame_begin
+            PHASE_BEGIN(crc);
+            check = first ? frame_integrity_start(link_integrity, frame_seq, response)
+                          : segment_header_integrity(link_integrity, frame_seq);
+            PHASE_END(crc, PHASE_CRC);
+        }
+        uint32_t sent = 0;    // bytes of segment_buffer handed to the DMA
+        for (uint16_t filled = 0; filled < size; ) {
+            StreamChunk *chunk = storage_stream_next();
+            // a chunk still going out is behind sent, the DMA only reads ahead of it
+            uint8_t *out = segment_buffer + sent;
+            uint32_t out_size = chunk->size;
+            if (fill_sectors) {
+                out_size = code_sectors(out, chunk->data, chunk->size);
+            } else {
+                memcpy(out, chunk->data, chunk->size);
+            }
+            read_ok = read_ok && chunk->ok;
+            filled += chunk->size;
+            storage_stream_release(chunk);
+            if (!sniffed) {
+                PHASE_BEGIN(crc);
+                check = integrity_update(link_integrity, check, out, out_size);
+                PHASE_END(crc, PHASE_CRC);
+            }
+            PHASE_BEGIN(transmit);
+            transmit_data_chunk(pio_state, out, out_size);
+            PHASE_END(transmit, PHASE_TRANSMIT);
+            sent += out_size;
+        }
+        taken += size;
+        if (!read_ok) {
+            check = ~check;
+        }
+        PHASE_BEGIN(data_end);
+        outcome = transmit_frame_end(pio_state, check);
+        for (int attempt = 1; outcome != STATUS_OK && attempt < FRAME_MAX_ATTEMPTS; attempt++) {
+            if (first) {
+                transmit_frame_begin(pio_state, response);
+            } else {
+                transmit_segment_begin(pio_state);
+            }
+            transmit_data_chunk(pio_state, segment_buffer, sent);
+            outcome = transmit_frame_end(pio_state, check);
+        }
+        PHASE_END(data_end, PHASE_TRANSMIT);
+    }
+    // every chunk is taken even when the Victor gave up, so the storage core
+    // always finishes the request
+    for (; taken < data_size; ) {
+        StreamChunk *chunk = storage_stream_next();
+        taken += chunk->size;
+        storage_stream_release(chunk);
+    }
+    if (outcome != STATUS_OK) {
+        printf("Error: response frame %d not taken %d\n", frame_seq, outcome);
+        return outcome;
+    }
+    return read_ok ? STATUS_OK : FILE_SEEK_ERROR;
+}
+
+// Link core half of a streamed READ_BLOCK. The command packet goes out while
+// the storage core is still seeking, then each chunk is handed to the TX DMA as
+// it arrives. Once the command packet is out there is no way to report an
+// error, so a failed read sends zeros with an inverted data CRC and the Victor
+// fails the request. Every chunk is taken even when the Victor gives up, so the
+// storage core always finishes the request. A framed link sends the sectors
+// in frames instead, see transmit_streamed_frames.
+ResponseStatus transmit_streamed_read(PIO_state *pio_state, Payload *payload) {
+    ReadParams *readParams = (ReadParams *)payload->params;
+    uint32_t data_size = (uint32_t)readParams->sector_count * SECTOR_SIZE;
+
+    uint8_t status_param = 0;
+    Payload response = {0};
+    response.protocol = SD_BLOCK_DEVICE;
+    response.command = READ_BLOCK;
+    response.params_size = 1;
+    response.params = &status_param;
+    if (framed_link) {
+        return transmit_streamed_frames(pio_state, &response, data_size);
+    }
+    response.data_size = data_size;
+    ResponseStatus outcome = STATUS_OK;
+    PHASE_BEGIN(crc);
+    create_command_crc8(&response);
+    uint8_t size_bytes[2] = { (response.data_size >> 8) & 0xFF, response.data_size & 0xFF };
+    uint16_t data_crc = integrity_update(INTEGRITY_CRC8, 0, size_bytes, 2);
+    PHASE_END(crc, PHASE_CRC);
+
+    PHASE_BEGIN(command);
+    outcome = transmit_command_packet(pio_state, &response);
+    PHASE_END(command, PHASE_TRANSMIT);
+    bool send_data = (outcome == STATUS_OK);
+    if (!send_data) {
+        printf("Error: CRC or other failure on command portion of payload\n");
+    }
+
+    bool read_ok = true;
+    StreamChunk *sending = NULL;
+    if (send_data) {
+        transmit_data_begin(pio_state, response.data_size);
+    }
+    for (uint32_t remaining = data_size; remaining > 0; ) {
+        StreamChunk *chunk = storage_stream_next();
+        remaining -= chunk->size;
+        read_ok = read_ok && chunk->ok;
+        if (!send_data) {
+            storage_stream_release(chunk);
+            continue;
+        }
+        PHASE_BEGIN(crc);
+        data_crc = integrity_update(INTEGRITY_CRC8, data_crc, chunk->data, chunk->size);
+        PHASE_END(crc, PHASE_CRC);
+        PHASE_BEGIN(transmit);
+        // starting this chunk waits out the previous one, so that buffer is free
+        transmit_data_chunk(pio_state, chunk->data, chunk->size);
+        PHASE_END(transmit, PHASE_TRANSMIT);
+        if (sending != NULL) {
+            storage_stream_release(sending);
+        }
+        sending = chunk;
+    }
+    if (!send_data) {
+        return outcome;
+    }
+    if (!read_ok) {
+        data_crc = ~data_crc;
+    }
+    PHASE_BEGIN(data_end);
+    outcome = transmit_data_end(pio_state, data_crc);
+    PHASE_END(data_end, PHASE_TRANSMIT);
+    if (sending != NULL) {
+        storage_stream_release(sending);
+    }
+    if (outcome != STATUS_OK) {
+        printf("Error: CRC or other failure on data portion of payload\n");
+        return outcome;
+    }
+    return read_ok ? STATUS_OK : FILE_SEEK_ERROR;
+}
@@ -11,9 +11,9 @@
 #include "pico/multicore.h"
 #include "receive_fifo.pio.h"
 #include "transmit_fifo.pio.h"
-#include "../sdio-fatfs/include/FatFsSd_C.h"
 #include "../sdio-fatfs/src/include/f_util.h"
 #include "../sdio-fatfs/src/ff15/source/ff.h"
+#include "../sdio-fatfs/src/ff15/source/diskio.h"
 
 #include "../../common/protocols.h"
 #include "../../common/dos_device_payloads.h"
@@ -21,68 +21,15 @@
 #include "pico_common.h"
 #include "sd_block_device.h"
 #include "v9k_hard_drives.h"
+#include "storage_core.h"
+#include "payload_pool.h"
+#include "sector_cache.h"
+#include "mount_index.h"
+#include "phase_timing.h"
+#include "boot_timeline.h"
 
 static const bool DEBUG_SDIO = false;
 
-/* SDIO Interface */
-static sd_sdio_if_t sdio_if = {
-    /*
-    Pins CLK_gpio, D1_gpio, D2_gpio, and D3_gpio are at offsets from pin D0_gpio.
-    The offsets are determined by sd_driver\SDIO\rp2040_sdio.pio.
-        CLK_gpio = (D0_gpio + SDIO_CLK_PIN_D0_OFFSET) % 32;
-        As of this writing, SDIO_CLK_PIN_D0_OFFSET is 30,
-            which is -2 in mod32 arithmetic, so:
-        CLK_gpio = D0_gpio -2.
-        D1_gpio = D0_gpio + 1;
-        D2_gpio = D0_gpio + 2;
-        D3_gpio = D0_gpio + 3;
-    */
-    .CMD_gpio = 1,
-    .D0_gpio = 2,
-    .baud_rate = 15 * 1000 * 1000  // 15 MHz
-};
-
-/* Hardware Configuration of the SD Card socket "object" */
-static sd_card_t sd_card_sdio = {
-    .type = SD_IF_SDIO,
-    .sdio_if_p = &sdio_if
-};
-
-/* SPI Interface */
- static spi_t spi = {  
-     .hw_inst = spi0,  // RP2040 SPI component
-     .sck_gpio = 2,    // GPIO number (not Pico pin number)
-     .mosi_gpio = 3,
-     .miso_gpio = 4,
-     .baud_rate = 12 * 1000 * 1000    // Actual frequency: 10416666.
- };
-
- /* SPI Interface */
- static sd_spi_if_t spi_if = {
-     .spi = &spi,  // Pointer to the SPI driving this card
-     .ss_gpio = 5       // The SPI slave select GPIO for this SD card
- };
-
-/* Configuration of the SD Card socket object */
- static sd_card_t sd_card = {   
-     .type = SD_IF_SPI,
-     .spi_if_p = &spi_if   // Pointer to the SPI interface driving this card
- };
-
-
-/* Callbacks used by the library: */
-size_t sd_get_num() { 
-    return 1; 
-}
-
-sd_card_t *sd_get_by_num(size_t num) {
-    if (0 == num)
-        return &sd_card;
-    else
-        return NULL;
-}
-
-
 // Function to check if a file matches the given pattern
 int matches_pattern(const char *filename) {
     if (strlen(filename) < 8) return 0; // Minimum length for valid filenames (e.g., 0_pc.img)
@@ -114,7 +61,7 @@ uint64_t calculate_victor_offset(
         // Check if the logical sector falls within this region
         if (logical_sector < region_size) {
             // Logical sector is within this region; calculate physical sector
-            uint32_t physical_sector = region->region_size + logical_sector;
+            uint32_t physical_sector = region->physical_address + logical_sector;
 
             // Calculate byte offset
             offset = (uint64_t)physical_sector * sector_size;
@@ -130,11 +77,41 @@ uint64_t calculate_victor_offset(
     return 0xFFFFFFFFFFFFFFFF; // Return a large invalid offset to indicate failure
 }
 
+// Splits a virtual volume, capacity sectors from logical disk address
+// volume_address, into one extent per working media region it crosses. The
+// regions are walked in order, so the extents come out sorted for
+// unit_file_sector's binary search. Returns the number of extents, 0 when the
+// volume runs past the working media.
+static uint16_t build_volume_extents(const MediaList *working_media_list, uint32_t volume_address,
+                                     uint32_t capacity, VolumeExtent *extents) {
+    uint16_t count = 0;
+    uint32_t region_logical = 0;    // logical disk address of the region's first block
+    uint32_t mapped = 0;            // sectors of the volume placed so far
+    for (uint16_t i = 0; i < working_media_list->num_regions && mapped < capacity; i++) {
+        const Region *region = &working_media_list->regions[i];
+        uint32_t next = volume_address + mapped;
+        if (next < region_logical + region->region_size) {
+            uint32_t into_region = next - region_logical;
+            uint32_t length = region->region_size - into_region;
+            if (length > capacity - mapped) {
+                length = capacity - mapped;
+            }
+            extents[count].logical_start = mapped;
+            extents[count].file_start = region->physical_address + into_region;
+            extents[count].length = length;
+            count++;
+            mapped += length;
+        }
+        region_logical += region->region_size;
+    }
+    return mapped == capacity ? count : 0;
+}
+
 int read_mbr(FIL *disk_image, MBR *mbr) {
     FRESULT res;
 
     // Read the MBR (first 512 bytes)
-    size_t bytes_read;
+    UINT bytes_read;
     res = f_read(disk_image, mbr, sizeof(MBR), &bytes_read);
     if (bytes_read != sizeof(MBR)) {
         perror("Error reading MBR");
@@ -214,7 +191,7 @@ uint32_t get_first_partition_start(uint8_t *mbr_buffer) {
     return start_sector;
 }
 
-int read_fat12_bpb_from_img_file(DriveImage *drive_image, VictorBPB *victor_bpb) {
+int read_fat12_bpb_from_img_file(DriveImage *drive_image, DriveUnit *unit, VictorBPB *victor_bpb) {
     MBR mbr;
     BPB_FAT12 bpb;
     FIL *img_file = drive_image->img_file;
@@ -262,14 +239,23 @@ int read_fat12_bpb_from_img_file(DriveImage *drive_image, VictorBPB *victor_bpb)
     victor_bpb->media_descriptor = bpb.media_type;
     victor_bpb->sectors_per_fat = bpb.fat_size_16;
     
-    drive_image->start_lba = first_partition->start_lba;
-    drive_image->end_lba = first_partition->start_lba + first_partition->size_in_sectors;
+    unit->start_lba = first_partition->start_lba;
+    unit->end_lba = first_partition->start_lba + first_partition->size_in_sectors;
 
     print_debug_bpb(victor_bpb);
 
     return 0;
 }
 
+// Boot sector, FATs and root directory, everything in front of the first cluster
+uint32_t bpb_metadata_sectors(const VictorBPB *bpb) {
+    if (bpb->bytes_per_sector == 0) {
+        return 0;
+    }
+    uint32_t root_dir_sectors = (bpb->root_entry_count * 32 + bpb->bytes_per_sector - 1) / bpb->bytes_per_sector;
+    return bpb->reserved_sectors + (uint32_t)bpb->num_fats * bpb->sectors_per_fat + root_dir_sectors;
+}
+
 void print_debug_bpb(VictorBPB *bpb) {
     printf("BIOS Parameter Block (BPB) Information:\n");
     printf("  Bytes per Sector: %u\n", bpb->bytes_per_sector);
@@ -341,7 +327,7 @@ void print_v9k_disk_label(const V9kDriveLabel *label, const MediaList *available
 
 
 /* Function to parse the BPB from a FAT16 .img file */
-int parse_fat16_bpb(DriveImage *drive_image, VictorBPB *bpb) {
+int parse_fat16_bpb(DriveImage *drive_image, DriveUnit *unit, VictorBPB *bpb) {
 
     FRESULT res;
     uint8_t buffer[SECTOR_SIZE];
@@ -351,7 +337,7 @@ int parse_fat16_bpb(DriveImage *drive_image, VictorBPB *bpb) {
     size_t bytes_read;
 
     // Read MBR from sector 0
-    if (read_sector(img_file, drive_image->start_lba, 0, buffer) != 0) {
+    if (read_sector(img_file, unit->start_lba, 0, buffer) != 0) {
         f_close(img_file);
         return -1;
     }
@@ -361,7 +347,7 @@ int parse_fat16_bpb(DriveImage *drive_image, VictorBPB *bpb) {
     if (DEBUG_SDIO) { printf("First partition starts at sector: %u\n", partition_start); }
 
     // Read the boot sector of the first partition
-    if (read_sector(img_file, drive_image->start_lba, partition_start, boot_sector) != 0) {
+    if (read_sector(img_file, unit->start_lba, partition_start, boot_sector) != 0) {
         f_close(img_file);
         return -1;
     }
@@ -381,17 +367,17 @@ int parse_fat16_bpb(DriveImage *drive_image, VictorBPB *bpb) {
     return 0; /* Success */
 }
 // Function to parse the BPB from a Victor 9000 .img file
-// Returns the number of virtual volumes found
-// img_num is the index of the image file in the array of DriveImage pointers
-// drive_image is an array of DriveImage pointers
-// bpb is an array of VictorBPB structures
+// Returns the number of units filled in, one per virtual volume, -1 on error
+// drive_image is the image file and img_num its index in the DriveImage array
+// units and bpb are the unit table and BPB array from the first free unit on
 // max_units is the maximum number of virtual volumes we support
-int build_bpbs_from_v9k_disk_label(uint8_t img_num, DriveImage *drive_image[], VictorBPB *bpb, uint8_t max_units) {
+int build_bpbs_from_v9k_disk_label(DriveImage *drive_image, uint8_t img_num, DriveUnit *units, VictorBPB *bpb, uint8_t max_units) {
     
     uint8_t result;
     int vol;
+    int found = 0;
     size_t bytes_read;
-    FIL *img_file = drive_image[img_num]->img_file;
+    FIL *img_file = drive_image->img_file;
 
     // Read and parse the drive label
     V9kDriveLabel drive_label = {0};
@@ -426,50 +412,145 @@ int build_bpbs_from_v9k_disk_label(uint8_t img_num, DriveImage *drive_image[], V
     
     // Populate BPBs for each virtual volume
     for (vol = 0; vol < volume_list.num_volumes; vol++) {
-        if (img_num >= max_units) {
+        if (found >= max_units) {
             printf("Reached maximum number of units\n");
-            return vol;
+            return found;
         }
         VirtualVolumeLabel volume_label = {0};
-        result = read_virtual_volume_label(img_file, volume_list.volume_addresses[vol], &volume_label);
+        // volume addresses are logical disk addresses, like the sectors within a volume
+        uint64_t label_offset = calculate_victor_offset(volume_list.volume_addresses[vol], &working_media_list, SECTOR_SIZE);
+        result = -1;
+        if (label_offset != 0xFFFFFFFFFFFFFFFF) {
+            result = read_virtual_volume_label(img_file, (uint32_t)(label_offset / SECTOR_SIZE), &volume_label);
+        }
+        // a label the Victor has written over must not divide by zero below
+        if (result == 0 && (volume_label.allocation_unit == 0 || volume_label.assignment_count > MAX_PARTITIONS)) {
+            result = -1;
+        }
         if (result != 0) {
             printf("Error reading virtual volume label\n");
-            return vol;
+            return found;
         }
         if (volume_label.label_type == 65535) {
             continue; // Skip maintenance volume entries
         }
 
         uint32_t start_lba = volume_list.volume_addresses[vol];
-        drive_image[img_num]->start_lba = start_lba;
-        drive_image[img_num]->end_lba = start_lba + volume_label.volume_capacity - 1;
+        DriveUnit *unit = &units[found];
+        unit->image = img_num;
+        unit->start_lba = start_lba;
+        unit->end_lba = start_lba + volume_label.volume_capacity - 1;
+
+        // the volume's logical sectors can cross working media regions, the
+        // extent table maps them once here rather than on every request
+        free(unit->extents);
+        unit->extents = malloc(working_media_list.num_regions * sizeof(VolumeExtent));
+        unit->num_extents = 0;
+        if (unit->extents != NULL) {
+            unit->num_extents = build_volume_extents(&working_media_list, start_lba,
+                                                     volume_label.volume_capacity, unit->extents);
+        }
+        if (unit->num_extents == 0) {
+            printf("Volume %d does not fit the working media\n", vol);
+        }
 
         /* Populate the BPB structure */
-        bpb[vol].bytes_per_sector = volume_label.host_block_size;
-        bpb[vol].sectors_per_cluster = volume_label.allocation_unit;
-        bpb[vol].reserved_sectors = volume_label.data_start; // First volumes have parition info, others start at 0.
-        bpb[vol].num_fats = 2; // Standard value
-        bpb[vol].root_entry_count = volume_label.directory_entries;
-        bpb[vol].total_sectors = (uint16_t)volume_label.volume_capacity;
-        bpb[vol].media_descriptor = 0xF8; // Standard hard disk media descriptor
+        bpb[found].bytes_per_sector = volume_label.host_block_size;
+        bpb[found].sectors_per_cluster = volume_label.allocation_unit;
+        bpb[found].reserved_sectors = volume_label.data_start; // First volumes have parition info, others start at 0.
+        bpb[found].num_fats = 2; // Standard value
+        bpb[found].root_entry_count = volume_label.directory_entries;
+        bpb[found].total_sectors = (uint16_t)volume_label.volume_capacity;
+        bpb[found].media_descriptor = 0xF8; // Standard hard disk media descriptor
 
         // Calculate sectors per FAT
         uint32_t root_dir_sectors = (volume_label.directory_entries * 32 + drive_label.sector_size - 1) / drive_label.sector_size;
-        uint32_t data_sectors = volume_label.volume_capacity - (bpb[vol].reserved_sectors + root_dir_sectors);
+        uint32_t data_sectors = volume_label.volume_capacity - (bpb[found].reserved_sectors + root_dir_sectors);
         uint32_t total_clusters = data_sectors / volume_label.allocation_unit;
 
         // FAT size depends on total clusters (assume FAT16 for simplicity)
-        //bpb[vol].sectors_per_fat = (total_clusters * 2 + drive_label.sector_size - 1) / drive_label.sector_size;
-        bpb[vol].sectors_per_fat = 11;
+        //bpb[found].sectors_per_fat = (total_clusters * 2 + drive_label.sector_size - 1) / drive_label.sector_size;
+        bpb[found].sectors_per_fat = 11;
 
         print_v9k_disk_label(&drive_label, &available_media_list, &working_media_list, &volume_list, &volume_label);
-        print_debug_bpb(&bpb[vol]);
-        img_num++;
+        print_debug_bpb(&bpb[found]);
+        found++;
+    }
+
+    return found; // count of volumes instantiated
+}
+
+// The fast-seek table takes two entries per fragment of an image file, a
+// contiguous image needs four. Past the cap the image seeks the slow way.
+#define LINK_MAP_INITIAL_ENTRIES 16
+#define LINK_MAP_MAX_ENTRIES 1024
+
+// Builds the FatFs cluster link map table, so f_lseek finds any sector of the
+// image without walking its FAT chain from the start of the file
+static void build_link_map(DriveImage *image, const char *name) {
+#if FF_USE_FASTSEEK
+    uint64_t build_start = time_us_64();
+    DWORD *table = malloc(LINK_MAP_INITIAL_ENTRIES * sizeof(DWORD));
+    if (table == NULL) {
+        return;
+    }
+    table[0] = LINK_MAP_INITIAL_ENTRIES;
+    image->img_file->cltbl = table;
+    FRESULT fr = f_lseek(image->img_file, CREATE_LINKMAP);
+    if (fr == FR_NOT_ENOUGH_CORE && table[0] <= LINK_MAP_MAX_ENTRIES) {
+        // table[0] now holds the size this image needs
+        DWORD entries = table[0];
+        free(table);
+        table = malloc(entries * sizeof(DWORD));
+        if (table != NULL) {
+            table[0] = entries;
+            image->img_file->cltbl = table;
+            fr = f_lseek(image->img_file, CREATE_LINKMAP);
+        }
+    }
+    if (table == NULL || fr != FR_OK) {
+        printf("No fast seek for %s: %s (%d)\n", name, FRESULT_str(fr), fr);
+        free(table);
+        image->img_file->cltbl = NULL;
+        return;
     }
+    printf("Fast seek for %s: %u fragments, %u bytes, built in %u us\n", name,
+           (unsigned)(table[0] - 2) / 2, (unsigned)(table[0] * sizeof(DWORD)),
+           (unsigned)(time_us_64() - build_start));
+    attach_link_map(image, name, table);
+#endif
+}
 
-    uint8_t volumes_found = vol + 1;
+// Hands a built link map to the image, from build_link_map or the mount index
+void attach_link_map(DriveImage *image, const char *name, DWORD *table) {
+#if FF_USE_FASTSEEK
+    image->link_map = table;
+    image->img_file->cltbl = table;
+
+    // one fragment is [size, clusters, first cluster, 0], the whole image sits
+    // in consecutive card sectors and can skip FatFs
+    if (table[0] == 4) {
+        FATFS *fs = image->img_file->obj.fs;
+        image->raw_lba = fs->database + (LBA_t)fs->csize * (table[2] - 2);
+        image->raw_sectors = f_size(image->img_file) / SECTOR_SIZE;
+        printf("Raw sector access for %s at card sector %lu\n", name, (unsigned long)image->raw_lba);
+    }
+#endif
+}
 
-    return volumes_found; // count of volumes instantiated
+// Reopens an image FatFs has not seen the raw writes to, so its sector buffer
+// doesn't hand back old contents
+static void refresh_image(DriveImage *image, const char *name) {
+    f_close(image->img_file);
+    free(image->link_map);
+    image->link_map = NULL;
+    image->raw_sectors = 0;
+    image->raw_written = false;
+    if (FR_OK != f_open(image->img_file, name, FA_OPEN_EXISTING | FA_READ | FA_WRITE)) {
+        printf("error reopening file, %s", name);
+        return;
+    }
+    build_link_map(image, name);
 }
 
 SDState* initialize_sd_state(const char *directory) {
@@ -488,6 +569,7 @@ SDState* initialize_sd_state(const char *directory) {
     }
     FRESULT fr = f_mount(sdState->fs, "", 1);
     if (FR_OK != fr) panic("f_mount error: %s (%d)\n", FRESULT_str(fr), fr);
+    boot_mark(BOOT_CARD_MOUNTED);
 
     const char* const filename = "output.log";
     sdState->debug_log = malloc(sizeof(FIL));
@@ -498,9 +580,6 @@ SDState* initialize_sd_state(const char *directory) {
     fr = f_open(sdState->debug_log, filename, FA_OPEN_APPEND | FA_WRITE);
     if (FR_OK != fr && FR_EXIST != fr)
         panic("f_open(%s) error: %s (%d)\n", filename, FRESULT_str(fr), fr);
-    if (f_printf(sdState->debug_log, "Hello, world!\n") < 0) {
-        printf("fprintf failed\n");
-    }
 
     if (DEBUG_SDIO) { printf("Mounted SD card\n"); }
     DIR dir;
@@ -515,7 +594,12 @@ SDState* initialize_sd_state(const char *directory) {
     }
 
     FILINFO fno;
+    bool opened[MAX_IMG_FILES] = {false};
+    bool all_open = true;
     sdState->fileCount = 0;
+    sdState->unitCount = 0;
+    memset(sdState->units, 0, sizeof(sdState->units));
+    sdState->mounted_valid = false;
     while (FR_OK == f_readdir(&dir, &fno) ) {
        if (DEBUG_SDIO) { printf("directory entry: %s\n", fno.fname); }
         if (fno.fname[0] == 0 || sdState->fileCount >= MAX_IMG_FILES) {
@@ -532,14 +616,32 @@ SDState* initialize_sd_state(const char *directory) {
                 perror("Failed to allocate FIL");
                 // Handle cleanup and error
             }
+            sdState->images[sdState->fileCount]->link_map = NULL;
+            sdState->images[sdState->fileCount]->raw_sectors = 0;
+            sdState->images[sdState->fileCount]->raw_written = false;
+            sdState->images[sdState->fileCount]->file_size = fno.fsize;
+            sdState->images[sdState->fileCount]->file_date = fno.fdate;
+            sdState->images[sdState->fileCount]->file_time = fno.ftime;
             FRESULT fr = f_open(sdState->images[sdState->fileCount]->img_file, fno.fname, FA_OPEN_EXISTING | FA_READ | FA_WRITE);
             if (FR_OK != fr) {
                 printf("error opening file, %s", fno.fname);
+                all_open = false;
             }
+            opened[sdState->fileCount] = FR_OK == fr;
             sdState->fileCount++;
         }
     }
     f_closedir(&dir);
+
+    // the mount index holds the fast-seek maps and DEVICE_INIT's answer for
+    // these exact images, without it every image is worked out from scratch
+    sdState->mounted_valid = all_open && mount_index_load(sdState, &sdState->mounted);
+    for (int i = 0; i < sdState->fileCount; i++) {
+        if (opened[i] && sdState->images[i]->link_map == NULL) {
+            build_link_map(sdState->images[i], sdState->file_names[i]);
+        }
+    }
+    boot_mark(BOOT_IMAGES);
     if (DEBUG_SDIO) { printf("file list length: %d\n", sdState->fileCount); }
 
     // Loop through and print each string
@@ -549,10 +651,21 @@ SDState* initialize_sd_state(const char *directory) {
     return sdState;
 }
 
+// Drops the unit table ahead of working it out again
+static void clear_units(SDState *sdState) {
+    for (int i = 0; i < MAX_IMG_FILES; i++) {
+        free(sdState->units[i].extents);
+    }
+    memset(sdState->units, 0, sizeof(sdState->units));
+    sdState->unitCount = 0;
+}
+
 void freeSDState(SDState *sdState) {
     for (int i = 0; i < sdState->fileCount; i++) {
         f_close(sdState->images[i]->img_file);
+        free(sdState->images[i]->link_map);
     }
+    clear_units(sdState);
     f_close(sdState->debug_log);
     f_unmount("");
     free(sdState->fs);
@@ -568,21 +681,15 @@ Payload* init_sd_card(SDState *sdState, PIO_state *pio_state, Payload *payload)
        if (DEBUG_SDIO) { printf("%s\n", sdState->file_names[i]); }
     }
        
-    //determine the number of drives I'm instantiating, based on images from SD card
-    uint8_t num_drives = sdState->fileCount;
-
     //initialize the response payload
-    Payload *response = (Payload*)malloc(sizeof(Payload));
+    Payload *response = acquire_response_payload();
     if (response == NULL) {
-        printf("Error: Memory allocation failed for payload\n");
         return response;
     }
-    memset(response, 0, sizeof(Payload));
     response->protocol = SD_BLOCK_DEVICE;
     response->command = DEVICE_INIT;
     response->params_size = 1;
-    response->params = (uint8_t *)malloc(1);
-    if (response->params == NULL) {
+    if (payload_params_buffer(response, 1) == NULL) {
         printf("Error: Memory allocation failed for response->params\n");
         return response;
     }
@@ -590,7 +697,7 @@ Payload* init_sd_card(SDState *sdState, PIO_state *pio_state, Payload *payload)
 
     //InitPayload is a struct that contains the number of drives and an array of BPBs
     //for DOS INIT call. Don't confuse with the protocol Payload which is the wire format
-    InitPayload *initPayload = (InitPayload *)malloc(sizeof(InitPayload));
+    InitPayload *initPayload = (InitPayload *)payload_data_buffer(response, sizeof(InitPayload));
     if (initPayload == NULL) {
         printf("Error: Memory allocation failed for initPayload\n");
         response->status = MEMORY_ALLOCATION_ERROR;
@@ -598,36 +705,75 @@ Payload* init_sd_card(SDState *sdState, PIO_state *pio_state, Payload *payload)
     }
     memset(initPayload, 0, sizeof(InitPayload));
 
-    initPayload->num_units = num_drives;
-    
-    //parse the BPB for each image file
-    uint8_t i=0;
-    while (i < num_drives) {
-        printf("Parsing BPB for %s\n", sdState->file_names[i]);
-        if (strcasestr(sdState->file_names[i], "_v9k") != 0) {
-            //each V9k disk image has multiple volumes, so we need to build BPBs for each volume
-            uint8_t volumes = build_bpbs_from_v9k_disk_label(i, sdState->images, initPayload->bpb_array, (MAX_IMG_FILES - i));
-            if (volumes == 0) {
-                printf("Error parsing BPB for %s\n", sdState->file_names[i]);
+    // the BPBs below are read through FatFs
+    for (int i = 0; i < sdState->fileCount; i++) {
+        if (sdState->images[i] != NULL && sdState->images[i]->raw_written) {
+            sd_flush_writes(sdState);
+            refresh_image(sdState->images[i], sdState->file_names[i]);
+        }
+    }
+
+    if (sdState->mounted_valid) {
+        // from the mount index, or a parse nothing has been written over since
+        memcpy(initPayload, &sdState->mounted, sizeof(InitPayload));
+    } else {
+        //parse the BPB for each image file, units are handed out in image order
+        bool parsed = true;
+        // dirty sectors are cached under the old unit numbers and go out
+        // through the old table, and the labels parsed below must see them
+        sd_flush_writes(sdState);
+        clear_units(sdState);
+        for (uint8_t i = 0; i < sdState->fileCount; i++) {
+            uint8_t unit = sdState->unitCount;
+            if (unit >= MAX_IMG_FILES) {
+                printf("No unit left for %s\n", sdState->file_names[i]);
+                parsed = false;
+                break;
             }
-            i += volumes;
-        } else {
-            if (read_fat12_bpb_from_img_file(sdState->images[i], &initPayload->bpb_array[i]) != 0) {
-                printf("Error parsing BPB for %s\n", sdState->file_names[i]);
+            printf("Parsing BPB for %s\n", sdState->file_names[i]);
+            if (strcasestr(sdState->file_names[i], "_v9k") != 0) {
+                //each V9k disk image has multiple volumes, so we need to build BPBs for each volume
+                int volumes = build_bpbs_from_v9k_disk_label(sdState->images[i], i, &sdState->units[unit],
+                                                             &initPayload->bpb_array[unit], MAX_IMG_FILES - unit);
+                if (volumes <= 0) {
+                    printf("Error parsing BPB for %s\n", sdState->file_names[i]);
+                    parsed = false;
+                    continue;
+                }
+                sdState->unitCount += volumes;
+            } else {
+                // a PC image keeps its unit even when its BPB does not parse
+                sdState->units[unit].image = i;
+                if (read_fat12_bpb_from_img_file(sdState->images[i], &sdState->units[unit],
+                                                 &initPayload->bpb_array[unit]) != 0) {
+                    printf("Error parsing BPB for %s\n", sdState->file_names[i]);
+                    parsed = false;
+                }
+                sdState->unitCount++;
             }
-            i++;
+        }
+        initPayload->num_units = sdState->unitCount;
+
+        for (int i = 0; i < sdState->unitCount; i++) {
+            sdState->units[i].metadata_sectors = bpb_metadata_sectors(&initPayload->bpb_array[i]);
+        }
+        // an image that did not parse is worked out again next time
+        if (parsed) {
+            memcpy(&sdState->mounted, initPayload, sizeof(InitPayload));
+            sdState->mounted_valid = true;
+            mount_index_save(sdState, initPayload);
         }
     }
 
-    for (int i = 0; i < num_drives; i++) {
-       if (DEBUG_SDIO) { printf("BPB for drive %d %c %s\n", i, (i + 'C'), sdState->file_names[i]); }
+    for (int i = 0; i < initPayload->num_units; i++) {
+       if (DEBUG_SDIO) { printf("BPB for drive %d %c %s\n", i, (i + 'C'), sdState->file_names[sdState->units[i].image]); }
         print_debug_bpb(&initPayload->bpb_array[i]);
     }
+    // the units may have changed, so nothing cached can stay
+    sd_flush_writes(sdState);
+    sector_cache_clear();
     //return the drive information to the Victor 9000
-    response->data = (uint8_t *)initPayload;
     response->data_size = (sizeof(InitPayload));
-    create_command_crc8(response);
-    create_data_crc8(response);
    
     return response;
 
@@ -645,66 +791,302 @@ Payload* victor9k_drive_info(SDState *sdState, PIO_state *pio_state, Payload *pa
     //fully in RAM on Victor 9000, not needed here
 }
 
+// The unit number comes straight off the wire, so it is checked before it
+// indexes anything
+static bool valid_unit(const SDState *sdState, uint8_t drive) {
+    return drive < sdState->unitCount;
+}
+
+// Read-ahead follows one sequential stream per drive. Each read that starts
+// where the previous one ended doubles the window, anything else turns it off.
+#define READ_AHEAD_MIN 4
+#define READ_AHEAD_MAX 32
+
+// Read-ahead and write-back move at most this many sectors per f_read or
+// f_write, so a new command waits at most one run
+#define CARD_RUN_SECTORS 8
+
+static uint8_t card_run_buffer[CARD_RUN_SECTORS * SECTOR_SIZE];
+
+typedef struct {
+    uint32_t next_sector;   // where a sequential read would start
+    uint32_t fetched_to;    // read-ahead has cached up to here
+    uint16_t window;        // sectors past next_sector to keep cached, 0 is off
+} ReadAhead;
+
+static ReadAhead read_ahead[MAX_IMG_FILES];
+static uint32_t read_ahead_sectors;
+
+static void note_read(uint8_t drive, uint32_t sector, uint32_t count) {
+    ReadAhead *stream = &read_ahead[drive];
+    if (sector == stream->next_sector && count > 0) {
+        // the read and its read-ahead have to fit in the cache side by side
+        uint32_t limit = sector_cache_data_room() / 2;
+        if (limit > READ_AHEAD_MAX) {
+            limit = READ_AHEAD_MAX;
+        }
+        stream->window = stream->window == 0 ? READ_AHEAD_MIN : stream->window * 2;
+        if (stream->window > limit) {
+            stream->window = limit;
+        }
+    } else {
+        stream->window = 0;
+    }
+    stream->next_sector = sector + count;
+    if (stream->fetched_to < stream->next_sector) {
+        stream->fetched_to = stream->next_sector;
+    }
+}
+
+uint32_t sd_read_ahead_sectors(void) {
+    return read_ahead_sectors;
+}
+
+static SectorClass sector_class_of(const DriveUnit *unit, uint32_t sector) {
+    return sector < unit->metadata_sectors ? SECTOR_METADATA : SECTOR_DATA;
+}
+
+// Where a sector of a unit sits in its image file, and how many sectors from
+// there on follow it in the file. A Victor volume binary searches its extent
+// table, anything else sits at start_lba. 0 contiguous means past the volume.
+static uint32_t unit_file_sector(const DriveUnit *unit, uint32_t sector, uint32_t *contiguous) {
+    if (unit->extents == NULL) {
+        *contiguous = UINT32_MAX;
+        return unit->start_lba + sector;
+    }
+    *contiguous = 0;
+    if (unit->num_extents == 0) {
+        return 0;
+    }
+    uint16_t low = 0;
+    uint16_t high = unit->num_extents;
+    while (high - low > 1) {
+        uint16_t middle = (low + high) / 2;
+        if (unit->extents[middle].logical_start <= sector) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    const VolumeExtent *extent = &unit->extents[low];
+    uint32_t into_extent = sector - extent->logical_start;
+    if (into_extent >= extent->length) {
+        return 0;
+    }
+    *contiguous = extent->length - into_extent;
+    return extent->file_start + into_extent;
+}
+
+// Sector I/O on an image by sector within the image file. A contiguous image
+// goes straight to the card as one multi-block disk_read or disk_write, any
+// other through FatFs.
+static bool image_read(DriveImage *image, uint32_t file_sector, uint32_t count, uint8_t *buffer) {
+    if (image->raw_sectors != 0) {
+        if (file_sector + count > image->raw_sectors) {
+            return false;
+        }
+        PHASE_BEGIN(raw);
+        DRESULT result = disk_read(image->img_file->obj.fs->pdrv, buffer, image->raw_lba + file_sector, count);
+        PHASE_END(raw, PHASE_FILE_IO);
+        return result == RES_OK;
+    }
+    PHASE_BEGIN(seek);
+    FRESULT seek_result = f_lseek(image->img_file, (FSIZE_t)file_sector * SECTOR_SIZE);
+    PHASE_END(seek, PHASE_SEEK);
+    if (FR_OK != seek_result) {
+        printf("Failed to seek to offset");
+        return false;
+    }
+    UINT bytesRead;
+    PHASE_BEGIN(read);
+    FRESULT result = f_read(image->img_file, buffer, count * SECTOR_SIZE, &bytesRead);
+    PHASE_END(read, PHASE_FILE_IO);
+    if (FR_OK != result || bytesRead != count * SECTOR_SIZE) {
+        if (DEBUG_SDIO) { printf("Failed to read the expected number of bytes\n"); }
+        return false;
+    }
+    return true;
+}
+
+static bool image_write(DriveImage *image, uint32_t file_sector, uint32_t count, const uint8_t *buffer) {
+    if (image->raw_sectors != 0) {
+        if (file_sector + count > image->raw_sectors) {
+            return false;
+        }
+        PHASE_BEGIN(raw);
+        DRESULT result = disk_write(image->img_file->obj.fs->pdrv, buffer, image->raw_lba + file_sector, count);
+        PHASE_END(raw, PHASE_FILE_IO);
+        image->raw_written = true;
+        return result == RES_OK;
+    }
+    PHASE_BEGIN(seek);
+    FRESULT seek_result = f_lseek(image->img_file, (FSIZE_t)file_sector * SECTOR_SIZE);
+    PHASE_END(seek, PHASE_SEEK);
+    if (FR_OK != seek_result) {
+        printf("Failed to seek to offset");
+        return false;
+    }
+    UINT bytesWriten;
+    PHASE_BEGIN(write);
+    FRESULT result = f_write(image->img_file, buffer, count * SECTOR_SIZE, &bytesWriten);
+    PHASE_END(write, PHASE_FILE_IO);
+    if (FR_OK != result || bytesWriten != count * SECTOR_SIZE) {
+        if (DEBUG_SDIO) { printf("Failed to write the expected number of bytes\n"); }
+        return false;
+    }
+    return true;
+}
+
+static bool image_sync(DriveImage *image) {
+    if (image->raw_sectors != 0) {
+        return RES_OK == disk_ioctl(image->img_file->obj.fs->pdrv, CTRL_SYNC, NULL);
+    }
+    return FR_OK == f_sync(image->img_file);
+}
+
+// Reads sectors of a drive through the sector cache. Each run of misses is one
+// image_read, and what comes back from the card is cached.
+static bool read_drive_sectors(SDState *sdState, uint8_t drive, uint32_t sector, uint32_t count, uint8_t *buffer) {
+    const DriveUnit *unit = &sdState->units[drive];
+    DriveImage *image = sdState->images[unit->image];
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t contiguous;
+        uint32_t file_sector = unit_file_sector(unit, sector + i, &contiguous);
+        if (contiguous == 0) {
+            return false;
+        }
+        if (sector_cache_lookup(drive, file_sector, buffer + i * SECTOR_SIZE)) {
+            i++;
+            continue;
+        }
+        // extend the run up to the next sector the cache already holds, or
+        // the end of the stretch that is contiguous in the file
+        uint32_t run = 1;
+        bool next_cached = false;
+        while (i + run < count && run < contiguous) {
+            if (sector_cache_lookup(drive, file_sector + run, buffer + (i + run) * SECTOR_SIZE)) {
+                next_cached = true;
+                break;
+            }
+            run++;
+        }
+
+        if (!image_read(image, file_sector, run, buffer + i * SECTOR_SIZE)) {
+            return false;
+        }
+        for (uint32_t j = 0; j < run; j++) {
+            sector_cache_insert(drive, file_sector + j, buffer + (i + j) * SECTOR_SIZE,
+                                sector_class_of(unit, sector + i + j));
+        }
+        i += run + (next_cached ? 1 : 0);
+    }
+    return true;
+}
+
+// Fetches one step of read-ahead into the sector cache, returns false once no
+// drive has anything left to fetch
+bool sd_read_ahead(SDState *sdState) {
+    for (uint8_t drive = 0; drive < sdState->unitCount; drive++) {
+        ReadAhead *stream = &read_ahead[drive];
+        const DriveUnit *unit = &sdState->units[drive];
+        DriveImage *image = sdState->images[unit->image];
+        uint32_t target = stream->next_sector + stream->window;
+        uint32_t contiguous = 0;
+        uint32_t first = 0;
+        // skip what the cache already has
+        while (stream->fetched_to < target) {
+            first = unit_file_sector(unit, stream->fetched_to, &contiguous);
+            if (contiguous == 0 || !sector_cache_contains(drive, first)) {
+                break;
+            }
+            stream->fetched_to++;
+        }
+        if (stream->window == 0 || stream->fetched_to >= target) {
+            continue;
+        }
+        uint32_t count = target - stream->fetched_to;
+        if (count > CARD_RUN_SECTORS) {
+            count = CARD_RUN_SECTORS;
+        }
+        if (count > contiguous) {
+            count = contiguous;
+        }
+        uint32_t file_sectors = f_size(image->img_file) / SECTOR_SIZE;
+        if (first + count > file_sectors) {
+            count = first < file_sectors ? file_sectors - first : 0;
+        }
+        if (count == 0 || !image_read(image, first, count, card_run_buffer)) {
+            // end of the image or a card error, the next real read will report it
+            stream->window = 0;
+            continue;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            sector_cache_insert(drive, first + i, card_run_buffer + i * SECTOR_SIZE,
+                                sector_class_of(unit, stream->fetched_to + i));
+        }
+        read_ahead_sectors += count;
+        stream->fetched_to += count;
+        return true;
+    }
+    return false;
+}
+
 Payload* sd_read(SDState *sdState, PIO_state *pio_state, Payload *payload) {
     ReadParams *readParams = (ReadParams *)payload->params;
 
-    Payload *response = (Payload*)malloc(sizeof(Payload));
+    Payload *response = acquire_response_payload();
     if (response == NULL) {
-        printf("Error: Memory allocation failed for payload\n");
         return NULL;
     }
-    memset(response, 0, sizeof(Payload));
     response->protocol = SD_BLOCK_DEVICE;
     response->command = READ_BLOCK;
-    response->params = (uint8_t *)malloc(1);
-    if (response->params == NULL) {
+    if (payload_params_buffer(response, 1) == NULL) {
         printf("Error: Memory allocation failed for response->params\n");
-        free(response);
+        release_payload(response);
         return NULL;
     }
     response->params[0] = 0;
 
     int driveNumber = readParams->drive_number;
-
-    // Calculate the offset in the .img file
     int startSector = readParams->start_sector;
-    long offset = calculate_mbr_offset(sdState->images[driveNumber]->start_lba, startSector, SECTOR_SIZE);
-    if (DEBUG_SDIO) { printf("sd_read startSector: %u, Offset: %ld\n", startSector, offset); }
-
-    // Move to the calculated offset
-    if (FR_OK != f_lseek(sdState->images[driveNumber]->img_file, offset)) {
-        printf("Failed to seek to offset");
-        response->status = FILE_SEEK_ERROR;
-        free(response->params);
-        free(response);
-        return NULL;
+    if (DEBUG_SDIO) { printf("sd_read startSector: %u\n", startSector); }
+    if (!valid_unit(sdState, driveNumber)) {
+        printf("sd_read: no unit %d\n", driveNumber);
+        response->status = INVALID_PARAMS;
+        response->params[0] = INVALID_PARAMS;
+        response->data_size = 0;
+        return response;
     }
 
     // Calculate the number of bytes to read
     int sectorCount = readParams->sector_count;
     size_t bytesToRead = sectorCount * SECTOR_SIZE;
+    // a whole response has a 16 bit data_size, only a streamed read goes past it
+    if (bytesToRead > UINT16_MAX) {
+        printf("sd_read: %d sectors do not fit one response\n", sectorCount);
+        response->status = INVALID_DATA_SIZE;
+        response->params[0] = INVALID_DATA_SIZE;
+        response->data_size = 0;
+        return response;
+    }
 
     // Read the data into the buffer
-    char *buffer = (char *)malloc(bytesToRead);
+    uint8_t *buffer = payload_data_buffer(response, bytesToRead);
     if (buffer == NULL) {
         printf("Failed to allocate buffer");
         response->status = MEMORY_ALLOCATION_ERROR;
-        free(response->params);
-        free(response);
+        release_payload(response);
         return NULL;
     }
-    UINT bytesRead;
-    FRESULT result = f_read(sdState->images[driveNumber]->img_file, buffer, bytesToRead, &bytesRead);
-    if (FR_OK != result) {
-        DBG_PRINTF("Failed to read the expected number of bytes");
+    note_read(driveNumber, startSector, sectorCount);
+    if (!read_drive_sectors(sdState, driveNumber, startSector, sectorCount, buffer)) {
         response->status = FILE_SEEK_ERROR;
-        free(buffer);
-        free(response->params);
-        free(response);
+        release_payload(response);
         return NULL;
     }
+    UINT bytesRead = bytesToRead;
     response->data_size = (uint16_t) bytesRead;
-    response->data = buffer;
     response->status = STATUS_OK;
     
     if (DEBUG_SDIO) {
@@ -718,67 +1100,225 @@ Payload* sd_read(SDState *sdState, PIO_state *pio_state, Payload *payload) {
         printf("\n");
     }
 
-    create_command_crc8(response);
-    create_data_crc8(response);
-    
     return response;
 }
 
+// Fills one stream chunk, a failed read zero fills it and clears read_ok
+static void read_stream_chunk(SDState *sdState, uint8_t drive, uint32_t sector, StreamChunk *chunk,
+                              uint32_t remaining, bool *read_ok) {
+    chunk->size = remaining < sizeof(chunk->data) ? remaining : sizeof(chunk->data);
+    if (*read_ok) {
+        *read_ok = read_drive_sectors(sdState, drive, sector, chunk->size / SECTOR_SIZE, chunk->data);
+    }
+    if (!*read_ok) {
+        memset(chunk->data, 0, chunk->size);
+    }
+    chunk->ok = *read_ok;
+}
+
+// Storage core half of a streamed READ_BLOCK, the link core sends the chunks
+// with transmit_streamed_read as they arrive. Reading only stalls when every
+// stream buffer is still waiting to go out, so card and wire time overlap.
+void sd_read_stream(SDState *sdState, Payload *payload) {
+    ReadParams *readParams = (ReadParams *)payload->params;
+
+    int driveNumber = readParams->drive_number;
+    uint32_t sector = readParams->start_sector;
+    if (DEBUG_SDIO) { printf("sd_read_stream startSector: %u\n", sector); }
+
+    // a unit that does not exist streams zeros marked as failed
+    bool read_ok = valid_unit(sdState, driveNumber);
+    if (read_ok) {
+        note_read(driveNumber, sector, readParams->sector_count);
+    } else {
+        printf("sd_read_stream: no unit %d\n", driveNumber);
+    }
+    uint32_t remaining = readParams->sector_count * SECTOR_SIZE;
+    while (remaining > 0) {
+        StreamChunk *chunk = storage_stream_buffer();
+        read_stream_chunk(sdState, driveNumber, sector, chunk, remaining, &read_ok);
+        remaining -= chunk->size;
+        sector += chunk->size / SECTOR_SIZE;
+        storage_stream_push(chunk);
+    }
+}
+
+// Write-back state. Dirty sectors live in the sector cache until a flush
+// writes them to the image files, which happens once writes have been idle for
+// WRITE_BACK_IDLE_US, on OUTPUT_FLUSH, before WRITE_VERIFY answers, and when
+// the dirty sectors reach the cache's bound.
+#define WRITE_BACK_IDLE_US 250000
+
+static WritePolicy write_policy = WRITE_POLICY_DEFAULT;
+static uint64_t last_write_us;
+static WriteBackStats write_back_stats;
+
+void sd_set_write_policy(WritePolicy policy) {
+    write_policy = policy;
+}
+
+WritePolicy sd_write_policy(void) {
+    return write_policy;
+}
+
+void sd_write_back_stats(WriteBackStats *stats) {
+    *stats = write_back_stats;
+}
+
+// Writes every dirty sector of one class back to its image file and syncs the
+// files that changed. Adjacent sectors go out as one f_write of up to
+// CARD_RUN_SECTORS, split on CARD_RUN_SECTORS boundaries of the image file.
+static bool flush_class(SDState *sdState, SectorClass sector_class) {
+    bool touched[MAX_IMG_FILES] = {false};
+    uint8_t drive;
+    uint32_t lba;
+    while (sector_cache_lowest_dirty(sector_class, &drive, &lba)) {
+        uint32_t run = 0;
+        const uint8_t *data;
+        do {
+            data = sector_cache_dirty_data(drive, lba + run);
+            if (data != NULL) {
+                memcpy(card_run_buffer + run * SECTOR_SIZE, data, SECTOR_SIZE);
+                run++;
+            }
+        } while (data != NULL && run < CARD_RUN_SECTORS && (lba + run) % CARD_RUN_SECTORS != 0);
+
+        uint8_t img_num = sdState->units[drive].image;
+        if (!image_write(sdState->images[img_num], lba, run, card_run_buffer)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < run; i++) {
+            sector_cache_mark_clean(drive, lba + i);
+        }
+        touched[img_num] = true;
+        write_back_stats.sectors += run;
+        write_back_stats.writes++;
+    }
+    for (int i = 0; i < sdState->fileCount; i++) {
+        if (touched[i] && !image_sync(sdState->images[i])) {
+            printf("f_sync failed for %s\n", sdState->file_names[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// File data is synced before the boot sector, FATs and directories, so the
+// card never holds a FAT pointing at clusters that were not written yet
+bool sd_flush_writes(SDState *sdState) {
+    if (sector_cache_dirty_count() == 0) {
+        return true;
+    }
+    write_back_stats.flushes++;
+    return flush_class(sdState, SECTOR_DATA) && flush_class(sdState, SECTOR_METADATA);
+}
+
+// Storage core idle hook. Flushes once writes have stopped for a while and
+// returns when to call again, 0 when nothing is waiting to be written.
+uint64_t sd_flush_when_idle(SDState *sdState) {
+    if (sector_cache_dirty_count() == 0) {
+        return 0;
+    }
+    uint64_t due = last_write_us + WRITE_BACK_IDLE_US;
+    if (time_us_64() < due) {
+        return due;
+    }
+    if (sd_flush_writes(sdState)) {
+        return 0;
+    }
+    // card error, the sectors stay dirty and get another try later
+    last_write_us = time_us_64();
+    return last_write_us + WRITE_BACK_IDLE_US;
+}
+
+// Writes a request straight to the image file or absorbs it into the cache,
+// depending on the write policy
+static bool store_write(SDState *sdState, uint8_t drive, uint32_t sector, uint32_t count, const uint8_t *data) {
+    const DriveUnit *unit = &sdState->units[drive];
+    DriveImage *image = sdState->images[unit->image];
+    uint32_t contiguous = 1;
+    if (count > 0) {
+        unit_file_sector(unit, sector + count - 1, &contiguous);
+    }
+    if (contiguous == 0) {
+        return false;   // runs past the end of a Victor volume
+    }
+    // a unit's boot sector or Victor volume label is what DEVICE_INIT parses
+    if (sector == 0 && count > 0) {
+        mount_index_invalidate(sdState);
+    }
+    bool through = write_policy == WRITE_THROUGH ||
+                   (write_policy == WRITE_BACK_METADATA_THROUGH && sector < unit->metadata_sectors);
+    if (!through && sector_cache_dirty_room() < count && !sd_flush_writes(sdState)) {
+        return false;
+    }
+    if (through || sector_cache_dirty_room() < count) {
+        // metadata forced through must not land ahead of the file data it
+        // points at, so what is dirty goes first
+        if (write_policy != WRITE_THROUGH && !sd_flush_writes(sdState)) {
+            return false;
+        }
+        for (uint32_t done = 0; done < count; ) {
+            uint32_t file_sector = unit_file_sector(unit, sector + done, &contiguous);
+            uint32_t run = count - done < contiguous ? count - done : contiguous;
+            if (!image_write(image, file_sector, run, data + done * SECTOR_SIZE)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < run; i++) {
+                sector_cache_update(drive, file_sector + i, data + (done + i) * SECTOR_SIZE);
+            }
+            done += run;
+        }
+        return write_policy == WRITE_THROUGH || image_sync(image);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        sector_cache_write(drive, unit_file_sector(unit, sector + i, &contiguous), data + i * SECTOR_SIZE,
+                           sector_class_of(unit, sector + i));
+    }
+    last_write_us = time_us_64();
+    return true;
+}
+
 Payload* sd_write(SDState *sdState, PIO_state *pio_state, Payload *payload) {
     ReadParams *writeParams = (ReadParams *)payload->params;
 
-    Payload *response = (Payload*)malloc(sizeof(Payload));
+    Payload *response = acquire_response_payload();
     if (response == NULL) {
-        printf("Error: Memory allocation failed for payload\n");
         return NULL;
     }
-    memset(response, 0, sizeof(Payload));
     response->protocol = SD_BLOCK_DEVICE;
     response->command = WRITE_NO_VERIFY;
-    response->params = (uint8_t *)malloc(1);
-    if (response->params == NULL) {
+    response->params_size = 1;
+    if (payload_params_buffer(response, 1) == NULL) {
         printf("Error: Memory allocation failed for response->params\n");
-        free(response);
+        release_payload(response);
         return NULL;
     }
     response->params[0] = 0;
 
     int driveNumber = writeParams->drive_number;
-
-    // Calculate the offset in the .img file
     int startSector = writeParams->start_sector;
-    FSIZE_t offset = (FSIZE_t) calculate_mbr_offset(sdState->images[driveNumber]->start_lba, startSector, SECTOR_SIZE);
-    if (DEBUG_SDIO) { printf("sd_write startSector: %u, Offset: %ld\n", startSector, offset); }
-
-    // Move to the calculated offset
-    if (FR_OK != f_lseek(sdState->images[driveNumber]->img_file, offset)) {
-        printf("Failed to seek to offset");
-        response->status = FILE_SEEK_ERROR;
-        free(response->params);
-        free(response);
-        return NULL;
-    }
-
-    // Calculate the number of bytes to write
     int sectorCount = writeParams->sector_count;
-    size_t bytesToWrite = sectorCount * SECTOR_SIZE;
+    if (DEBUG_SDIO) { printf("sd_write startSector: %u, sectorCount: %u\n", startSector, sectorCount); }
 
-    UINT bytesWriten;
-    FRESULT result = f_write(sdState->images[driveNumber]->img_file, payload->data, bytesToWrite, &bytesWriten);
-    if (FR_OK != result) {
-        DBG_PRINTF("Failed to read the expected number of bytes");
+    // WRITE_VERIFY only answers once the sectors are on the card. A failure is
+    // answered too, with the status in params, as the Victor is waiting.
+    response->status = STATUS_OK;
+    if (!valid_unit(sdState, driveNumber)) {
+        printf("sd_write: no unit %d\n", driveNumber);
+        response->status = INVALID_PARAMS;
+        response->params[0] = INVALID_PARAMS;
+    } else if (!store_write(sdState, driveNumber, startSector, sectorCount, payload->data) ||
+        (payload->command == WRITE_VERIFY && !sd_flush_writes(sdState))) {
         response->status = FILE_SEEK_ERROR;
-        free(response->params);
-        free(response);
-        return NULL;
+        response->params[0] = FILE_SEEK_ERROR;
     }
     response->data_size = 1;
-    response->data = (uint8_t *)malloc(1);
+    payload_data_buffer(response, 1);
     response->data[0] = 0;
-    response->status = STATUS_OK;
 
     if (DEBUG_SDIO) {
-        printf("sd_write Wrote %u bytes\n", bytesWriten);
+        printf("sd_write Wrote %u bytes\n", sectorCount * SECTOR_SIZE);
         printf("sd_write Wrote %.40s\n", payload->data);
         printf("sd_write Wrote: ");
         for (int i = 0; i < 40; i++) {
@@ -787,27 +1327,155 @@ Payload* sd_write(SDState *sdState, PIO_state *pio_state, Payload *payload) {
         printf("\n");
     }
 
-    create_command_crc8(response);
-    create_data_crc8(response);
-    
     return response;
 
 }
 
+// OUTPUT_FLUSH, writes every dirty sector to the card before answering
+Payload* sd_flush(SDState *sdState, PIO_state *pio_state, Payload *payload) {
+    Payload *response = acquire_response_payload();
+    if (response == NULL) {
+        return NULL;
+    }
+    response->protocol = SD_BLOCK_DEVICE;
+    response->command = OUTPUT_FLUSH;
+    if (payload_params_buffer(response, 1) == NULL) {
+        printf("Error: Memory allocation failed for response->params\n");
+        release_payload(response);
+        return NULL;
+    }
+    response->params[0] = 0;
+    response->data_size = 1;
+    payload_data_buffer(response, 1);
+    response->data[0] = 0;
+    response->status = sd_flush_writes(sdState) ? STATUS_OK : FILE_SEEK_ERROR;
+    return response;
+}
+
+static bool batch_entries_overlap(const BatchEntry *a, const BatchEntry *b) {
+    return a->params.drive_number == b->params.drive_number &&
+           a->params.start_sector < b->params.start_sector + b->params.sector_count &&
+           b->params.start_sector < a->params.start_sector + a->params.sector_count;
+}
+
+// Order to run a batch in: by drive and sector, so the card sees one pass over
+// each image. A write overlapping another entry would change what that entry
+// reads or leaves behind, so such a batch keeps its own order.
+static void batch_order(const BatchEntry *entries, uint8_t count, uint8_t *order) {
+    bool keep_order = false;
+    for (uint8_t i = 0; i < count; i++) {
+        order[i] = i;
+        for (uint8_t j = i + 1; j < count; j++) {
+            if ((entries[i].command != READ_BLOCK || entries[j].command != READ_BLOCK) &&
+                batch_entries_overlap(&entries[i], &entries[j])) {
+                keep_order = true;
+            }
+        }
+    }
+    if (keep_order) {
+        return;
+    }
+    for (uint8_t i = 1; i < count; i++) {
+        uint8_t entry = order[i];
+        const ReadParams *key = &entries[entry].params;
+        uint8_t j = i;
+        while (j > 0 && (entries[order[j - 1]].params.drive_number > key->drive_number ||
+                         (entries[order[j - 1]].params.drive_number == key->drive_number &&
+                          entries[order[j - 1]].params.start_sector > key->start_sector))) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = entry;
+    }
+}
+
+// SD_BLOCK_BATCH, several READ_BLOCK and WRITE sub-commands in one request.
+// Each entry gets its own status, a failed entry does not stop the others.
+Payload* sd_batch(SDState *sdState, PIO_state *pio_state, Payload *payload) {
+    const BatchEntry *entries = (const BatchEntry *)payload->params;
+    uint8_t count = payload->params_size / sizeof(BatchEntry);
+    if (count == 0 || count > BATCH_MAX_ENTRIES || payload->params_size % sizeof(BatchEntry) != 0) {
+        payload->status = INVALID_COMMAND;
+        return create_error_response(sdState, pio_state, payload);
+    }
+
+    // where each entry's sectors sit in the request or the response data
+    uint32_t offsets[BATCH_MAX_ENTRIES];
+    uint32_t read_bytes = 0;
+    uint32_t write_bytes = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t bytes = entries[i].params.sector_count * SECTOR_SIZE;
+        uint32_t *total = entries[i].command == READ_BLOCK ? &read_bytes : &write_bytes;
+        offsets[i] = *total;
+        *total += bytes;
+    }
+    if (write_bytes != payload->data_size || read_bytes > UINT16_MAX) {
+        payload->status = INVALID_COMMAND;
+        return create_error_response(sdState, pio_state, payload);
+    }
+
+    Payload *response = acquire_response_payload();
+    if (response == NULL) {
+        return NULL;
+    }
+    response->protocol = SD_BLOCK_BATCH;
+    response->command = payload->command;
+    if (payload_params_buffer(response, count) == NULL ||
+        payload_data_buffer(response, read_bytes) == NULL) {
+        printf("Error: Memory allocation failed for the batch response\n");
+        release_payload(response);
+        return NULL;
+    }
+    response->params_size = count;
+    response->data_size = read_bytes;
+
+    uint8_t order[BATCH_MAX_ENTRIES];
+    batch_order(entries, count, order);
+    bool verify = false;
+    response->status = STATUS_OK;
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t entry = order[i];
+        const ReadParams *params = &entries[entry].params;
+        bool ok;
+        if (!valid_unit(sdState, params->drive_number)) {
+            ok = false;
+        } else if (entries[entry].command == READ_BLOCK) {
+            note_read(params->drive_number, params->start_sector, params->sector_count);
+            ok = read_drive_sectors(sdState, params->drive_number, params->start_sector,
+                                    params->sector_count, response->data + offsets[entry]);
+        } else {
+            verify = verify || entries[entry].command == WRITE_VERIFY;
+            ok = store_write(sdState, params->drive_number, params->start_sector,
+                             params->sector_count, payload->data + offsets[entry]);
+        }
+        response->params[entry] = ok ? STATUS_OK : FILE_SEEK_ERROR;
+        if (!ok) {
+            response->status = FILE_SEEK_ERROR;
+        }
+    }
+    // WRITE_VERIFY entries only answer once the sectors are on the card
+    if (verify && !sd_flush_writes(sdState)) {
+        for (uint8_t i = 0; i < count; i++) {
+            if (entries[i].command != READ_BLOCK) {
+                response->params[i] = FILE_SEEK_ERROR;
+            }
+        }
+        response->status = FILE_SEEK_ERROR;
+    }
+
+    return response;
+}
+
 Payload* create_error_response(SDState *sdState, PIO_state *pio_state, Payload *input) {
-    Payload *response = (Payload*)malloc(sizeof(Payload));
+    Payload *response = acquire_response_payload();
     if (response == NULL) {
-        printf("Error: Memory allocation failed for payload\n");
         return response;
     }
-    memset(response, 0, sizeof(Payload));
     response->protocol = input->protocol;
     response->params_size = 0;
     response->command = input->command;
     response->status = input->status;
     response->params = NULL;
     response->data = NULL;
-    create_command_crc8(response);
-    create_data_crc8(response);
     return response;
 }
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "../../common/protocols.h"
+#include "sector_cache.h"
+
+// Sized to leave most of SRAM to the stack, payload pool and FatFs
+#ifndef SECTOR_CACHE_SECTORS
+#if PICO_RP2350
+#define SECTOR_CACHE_SECTORS 256    // 128 KB of 520 KB
+#else
+#define SECTOR_CACHE_SECTORS 64     // 32 KB of 264 KB
+#endif
+#endif
+
+// Metadata can fill at most this share of the cache, so a DIR of a big
+// directory cannot push every data sector out
+#define METADATA_MAX_SECTORS (SECTOR_CACHE_SECTORS * 3 / 4)
+// Dirty sectors can't be evicted, so half the cache always stays clean
+#define DIRTY_MAX_SECTORS (SECTOR_CACHE_SECTORS / 2)
+#define CACHE_BUCKETS SECTOR_CACHE_SECTORS
+#define NO_ENTRY -1
+
+typedef struct {
+    uint32_t lba;
+    uint8_t drive;
+    SectorClass sector_class;
+    bool dirty;             // newer than the image file, written back by a flush
+    int16_t bucket_next;    // next entry in the same hash bucket
+    int16_t newer;          // LRU list of the entry's class
+    int16_t older;
+} CacheEntry;
+
+typedef struct {
+    int16_t newest;
+    int16_t oldest;
+    uint16_t count;
+} LruList;
+
+static CacheEntry entries[SECTOR_CACHE_SECTORS];
+static uint8_t sectors[SECTOR_CACHE_SECTORS][SECTOR_SIZE];
+static int16_t buckets[CACHE_BUCKETS];
+static LruList lru[2];
+static int16_t free_entries;    // chained through bucket_next
+static bool initialized = false;
+static uint32_t dirty_count;
+static SectorCacheStats stats;
+
+static uint32_t bucket_of(uint8_t drive, uint32_t lba) {
+    return (lba * 2654435761u + drive) % CACHE_BUCKETS;
+}
+
+static void lru_unlink(CacheEntry *entry) {
+    LruList *list = &lru[entry->sector_class];
+    if (entry->newer != NO_ENTRY) {
+        entries[entry->newer].older = entry->older;
+    } else {
+        list->newest = entry->older;
+    }
+    if (entry->older != NO_ENTRY) {
+        entries[entry->older].newer = entry->newer;
+    } else {
+        list->oldest = entry->newer;
+    }
+    list->count--;
+}
+
+static void lru_push_newest(CacheEntry *entry, int16_t index) {
+    LruList *list = &lru[entry->sector_class];
+    entry->newer = NO_ENTRY;
+    entry->older = list->newest;
+    if (list->newest != NO_ENTRY) {
+        entries[list->newest].newer = index;
+    } else {
+        list->oldest = index;
+    }
+    list->newest = index;
+    list->count++;
+}
+
+static void bucket_remove(int16_t index) {
+    CacheEntry *entry = &entries[index];
+    int16_t *link = &buckets[bucket_of(entry->drive, entry->lba)];
+    while (*link != index) {
+        link = &entries[*link].bucket_next;
+    }
+    *link = entry->bucket_next;
+}
+
+void sector_cache_clear(void) {
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        buckets[i] = NO_ENTRY;
+    }
+    for (int i = 0; i < SECTOR_CACHE_SECTORS; i++) {
+        entries[i].bucket_next = (i + 1 < SECTOR_CACHE_SECTORS) ? i + 1 : NO_ENTRY;
+    }
+    free_entries = 0;
+    dirty_count = 0;
+    for (int c = 0; c < 2; c++) {
+        lru[c].newest = NO_ENTRY;
+        lru[c].oldest = NO_ENTRY;
+        lru[c].count = 0;
+    }
+    initialized = true;
+}
+
+static int16_t find_entry(uint8_t drive, uint32_t lba) {
+    if (!initialized) {
+        sector_cache_clear();
+    }
+    int16_t index = buckets[bucket_of(drive, lba)];
+    while (index != NO_ENTRY) {
+        if (entries[index].lba == lba && entries[index].drive == drive) {
+            return index;
+        }
+        index = entries[index].bucket_next;
+    }
+    return NO_ENTRY;
+}
+
+static int16_t oldest_clean(SectorClass sector_class) {
+    int16_t index = lru[sector_class].oldest;
+    while (index != NO_ENTRY && entries[index].dirty) {
+        index = entries[index].newer;
+    }
+    return index;
+}
+
+// A free entry if there is one, otherwise the oldest clean data sector. Metadata
+// is only given up when there is no data left or it is over its share.
+static int16_t take_entry(SectorClass sector_class) {
+    if (free_entries != NO_ENTRY) {
+        int16_t index = free_entries;
+        free_entries = entries[index].bucket_next;
+        return index;
+    }
+    SectorClass victim_class = SECTOR_DATA;
+    if (lru[SECTOR_DATA].count == 0 ||
+        (sector_class == SECTOR_METADATA && lru[SECTOR_METADATA].count >= METADATA_MAX_SECTORS)) {
+        victim_class = SECTOR_METADATA;
+    }
+    int16_t index = oldest_clean(victim_class);
+    if (index == NO_ENTRY) {
+        index = oldest_clean(victim_class == SECTOR_DATA ? SECTOR_METADATA : SECTOR_DATA);
+    }
+    lru_unlink(&entries[index]);
+    bucket_remove(index);
+    stats.evictions++;
+    return index;
+}
+
+// Presence check that leaves the counters and LRU order alone
+bool sector_cache_contains(uint8_t drive, uint32_t lba) {
+    return find_entry(drive, lba) != NO_ENTRY;
+}
+
+bool sector_cache_lookup(uint8_t drive, uint32_t lba, uint8_t *buffer) {
+    int16_t index = find_entry(drive, lba);
+    if (index == NO_ENTRY) {
+        stats.misses++;
+        return false;
+    }
+    CacheEntry *entry = &entries[index];
+    stats.hits++;
+    if (entry->sector_class == SECTOR_METADATA) {
+        stats.metadata_hits++;
+    }
+    lru_unlink(entry);
+    lru_push_newest(entry, index);
+    memcpy(buffer, sectors[index], SECTOR_SIZE);
+    return true;
+}
+
+void sector_cache_insert(uint8_t drive, uint32_t lba, const uint8_t *data, SectorClass sector_class) {
+    int16_t index = find_entry(drive, lba);
+    if (index != NO_ENTRY) {
+        lru_unlink(&entries[index]);
+    } else {
+        index = take_entry(sector_class);
+        CacheEntry *entry = &entries[index];
+        entry->dirty = false;
+        entry->drive = drive;
+        entry->lba = lba;
+        uint32_t bucket = bucket_of(drive, lba);
+        entry->bucket_next = buckets[bucket];
+        buckets[bucket] = index;
+    }
+    entries[index].sector_class = sector_class;
+    lru_push_newest(&entries[index], index);
+    memcpy(sectors[index], data, SECTOR_SIZE);
+}
+
+// Write through: a cached copy is refreshed, nothing new is brought in. The
+// image file now matches, so a dirty copy becomes clean.
+void sector_cache_update(uint8_t drive, uint32_t lba, const uint8_t *data) {
+    int16_t index = find_entry(drive, lba);
+    if (index != NO_ENTRY) {
+        memcpy(sectors[index], data, SECTOR_SIZE);
+        sector_cache_mark_clean(drive, lba);
+    }
+}
+
+// Write back: the sector is cached as dirty and only reaches the image file on
+// a flush. The caller keeps within sector_cache_dirty_room().
+void sector_cache_write(uint8_t drive, uint32_t lba, const uint8_t *data, SectorClass sector_class) {
+    sector_cache_insert(drive, lba, data, sector_class);
+    CacheEntry *entry = &entries[find_entry(drive, lba)];
+    if (!entry->dirty) {
+        entry->dirty = true;
+        dirty_count++;
+    }
+}
+
+// The dirty sector of a class with the lowest (drive, lba), so a flush goes
+// through each image file in order and adjacent sectors line up into runs
+bool sector_cache_lowest_dirty(SectorClass sector_class, uint8_t *drive, uint32_t *lba) {
+    bool found = false;
+    if (dirty_count == 0) {
+        return false;
+    }
+    for (int16_t index = lru[sector_class].newest; index != NO_ENTRY; index = entries[index].older) {
+        CacheEntry *entry = &entries[index];
+        if (entry->dirty && (!found || entry->drive < *drive || (entry->drive == *drive && entry->lba < *lba))) {
+            *drive = entry->drive;
+            *lba = entry->lba;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Contents of a dirty sector, NULL when the sector is clean or not cached
+const uint8_t* sector_cache_dirty_data(uint8_t drive, uint32_t lba) {
+    int16_t index = find_entry(drive, lba);
+    if (index == NO_ENTRY || !entries[index].dirty) {
+        return NULL;
+    }
+    return sectors[index];
+}
+
+void sector_cache_mark_clean(uint8_t drive, uint32_t lba) {
+    int16_t index = find_entry(drive, lba);
+    if (index != NO_ENTRY && entries[index].dirty) {
+        entries[index].dirty = false;
+        dirty_count--;
+    }
+}
+
+uint32_t sector_cache_dirty_count(void) {
+    return dirty_count;
+}
+
+uint32_t sector_cache_dirty_room(void) {
+    return DIRTY_MAX_SECTORS - dirty_count;
+}
+
+// Sectors data can have without pushing out metadata
+uint32_t sector_cache_data_room(void) {
+    return SECTOR_CACHE_SECTORS - lru[SECTOR_METADATA].count;
+}
+
+void sector_cache_stats(SectorCacheStats *out) {
+    *out = stats;
+    out->dirty = dirty_count;
+    out->capacity = SECTOR_CACHE_SECTORS;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+
+#include "../../common/protocols.h"
+#include "../../common/dos_device_payloads.h"
+#include "pico_common.h"
+#include "command_dispatch.h"
+#include "sd_block_device.h"
+#include "spsc_queue.h"
+#include "storage_core.h"
+#include "boot_timeline.h"
+
+static const char *storage_directory;
+static SDState *storage_sd_state;
+static PIO_state *storage_pio_state;
+static atomic_bool storage_mounted;     // set by the storage core once storage_sd_state is in place
+
+static StorageRequest request_slots[STORAGE_REQUEST_SLOTS];
+static StreamChunk stream_chunks[READ_STREAM_BUFFERS];
+
+// Every queue has one producer and one consumer. The free lists are filled and
+// drained by the same core, the others cross from one core to the other.
+static SpscQueue free_requests;     // link -> link
+static SpscQueue submitted;         // link -> storage
+static SpscQueue completed;         // storage -> link
+static SpscQueue free_chunks;       // link -> storage
+static SpscQueue filled_chunks;     // storage -> link
+
+// Both cores sleep in __wfe while a queue is empty, a push wakes the other side
+static void *queue_pop_blocking(SpscQueue *queue) {
+    void *item;
+    while (!spsc_queue_pop(queue, &item)) {
+        __wfe();
+    }
+    return item;
+}
+
+static void queue_push_signal(SpscQueue *queue, void *item) {
+    while (!spsc_queue_push(queue, item)) {
+        __wfe();
+    }
+    __sev();
+}
+
+bool is_streamed_read(const Payload *payload) {
+    return payload->protocol == SD_BLOCK_DEVICE && payload->command == READ_BLOCK;
+}
+
+// Sleeps until the link core submits, waking up in time to flush writes once
+// they have been idle long enough
+static StorageRequest* wait_for_request(void) {
+    void *item;
+    while (!spsc_queue_pop(&submitted, &item)) {
+        uint64_t flush_due = sd_flush_when_idle(storage_sd_state);
+        if (flush_due == 0) {
+            __wfe();
+        } else {
+            best_effort_wfe_or_timeout(from_us_since_boot(flush_due));
+        }
+    }
+    return (StorageRequest *)item;
+}
+
+static void storage_core_main(void) {
+    storage_sd_state = initialize_sd_state(storage_directory);
+    if (storage_sd_state == NULL) {
+        panic("Failed to initialize SD state\n");
+    }
+    boot_mark(BOOT_STORAGE_READY);
+    atomic_store_explicit(&storage_mounted, true, memory_order_release);
+    __sev();
+    while (true) {
+        StorageRequest *request = wait_for_request();
+        if (is_streamed_read(request->payload)) {
+            sd_read_stream(storage_sd_state, request->payload);
+            request->response = NULL;
+        } else {
+            request->response = dispatch_command(storage_sd_state, storage_pio_state, request->payload);
+        }
+        queue_push_signal(&completed, request);
+        // idle until the next command, a good time to fetch what is likely next
+        while (spsc_queue_is_empty(&submitted) && sd_read_ahead(storage_sd_state)) {
+        }
+    }
+}
+
+void storage_core_start(const char *directory) {
+    storage_directory = directory;
+    atomic_init(&storage_mounted, false);
+    spsc_queue_init(&free_requests);
+    spsc_queue_init(&submitted);
+    spsc_queue_init(&completed);
+    spsc_queue_init(&free_chunks);
+    spsc_queue_init(&filled_chunks);
+    for (int i = 0; i < STORAGE_REQUEST_SLOTS; i++) {
+        spsc_queue_push(&free_requests, &request_slots[i]);
+    }
+    for (int i = 0; i < READ_STREAM_BUFFERS; i++) {
+        spsc_queue_push(&free_chunks, &stream_chunks[i]);
+    }
+    multicore_launch_core1(storage_core_main);
+}
+
+bool storage_core_ready(void) {
+    return atomic_load_explicit(&storage_mounted, memory_order_acquire);
+}
+
+// Only read by dispatch_command, so it has to be in place before the first
+// storage_submit, whose queue push publishes it to the storage core
+void storage_core_attach(PIO_state *pio_state) {
+    storage_pio_state = pio_state;
+}
+
+StorageRequest* storage_submit(Payload *payload) {
+    void *slot;
+    if (!spsc_queue_pop(&free_requests, &slot)) {
+        panic("No free storage request slots\n");
+    }
+    StorageRequest *request = (StorageRequest *)slot;
+    request->payload = payload;
+    request->response = NULL;
+    queue_push_signal(&submitted, request);
+    return request;
+}
+
+StorageRequest* storage_wait_complete(void) {
+    return (StorageRequest *)queue_pop_blocking(&completed);
+}
+
+void storage_release(StorageRequest *request) {
+    spsc_queue_push(&free_requests, request);
+}
+
+StreamChunk* storage_stream_next(void) {
+    return (StreamChunk *)queue_pop_blocking(&filled_chunks);
+}
+
+void storage_stream_release(StreamChunk *chunk) {
+    queue_push_signal(&free_chunks, chunk);
+}
+
+StreamChunk* storage_stream_buffer(void) {
+    return (StreamChunk *)queue_pop_blocking(&free_chunks);
+}
+
+void storage_stream_push(StreamChunk *chunk) {
+    queue_push_signal(&filled_chunks, chunk);
+}
@@ -11,6 +11,8 @@
 #include "transmit_fifo.pio.h"
 #include "pico_communication.h"
 #include "sd_block_device.h"
+#include "storage_core.h"
+#include "boot_timeline.h"
 
 // Assume pio0 is the PIO instance and sm is the state machine number
 // This could be part of your main function or a dedicated function for handling PIO data
@@ -61,15 +63,18 @@ int main(void) {
     uart_set_format(UART_ID, 8, 1, UART_PARITY_NONE);
 
     puts("User Port Pico Initializing...");
-    // Initialize PIO
-    PIO_state *pio_state = init_pio();
+    boot_mark(BOOT_CONSOLE);
 
-    //Initialize the SD Card
+    // The SD card mounts on core 1 while this core brings up PIO, handshakes
+    // that arrive before it is done are answered busy
     const char *directory = "";
-    SDState *sd_state = initialize_sd_state(directory);
+    storage_core_start(directory);
+
+    // Initialize PIO
+    PIO_state *pio_state = init_pio();
 
     wait_for_startup_handshake(pio_state);
-    process_incoming_commands(sd_state, pio_state);
+    process_incoming_commands(pio_state);
 
     return 0;
 
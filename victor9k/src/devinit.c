@@ -56,11 +56,13 @@
 #include "cprint.h"     /* Console printing direct to hardware */
 #include "diskio.h"     /* SD card library header */
 #include "v9_communication.h"  /* Victor 9000 communication protocol */
+#include "v9_metadata_cache.h" /* FAT and root directory sectors kept in the driver */
 #include "../../common/protocols.h"
 #include "../../common/dos_device_payloads.h"
 #include "../../common/crc8.h"
 
 static bool validate_far_ptr(void far *ptr, size_t size); // Function to validate a far pointer
+static void reserve_metadata_cache(uint16_t cs);  // Keeps the init code's memory for the cache
 
 #pragma data_seg("_CODE")
 //((7*16 + 3*8 + 1*32) * 9 + 1)  (size of VictorBPB) * MAX_DRIVES + 1 for num_units
@@ -71,6 +73,7 @@ static bool validate_far_ptr(void far *ptr, size_t size); // Function to validat
 bool debug = false;
 static uint8_t portbase;
 static uint8_t partition_number = 0;
+static uint16_t cache_kb = 0;     // /C=nn metadata cache size, off unless asked for
 //
 // Place here any variables or constants that should go away after initialization
 //
@@ -207,8 +210,9 @@ uint16_t deviceInit( void ) {
     initPayload.data = data_ptr;
     initPayload.data_size = sizeof(data);
     if (debug) writeToDriveLog("sending data_size: %d\n", initPayload.data_size);
-    create_payload_crc8(&initPayload);
 
+    // the Pico mounts the card before it answers, halt rather than spin
+    set_receive_mode(RECEIVE_INTERRUPT);
     ResponseStatus outcome = send_command_payload(&initPayload);
     if (outcome != STATUS_OK) {
         cdprintf("Error: Failed to send DEVICE_INIT command to SD Block Device %u\n", (uint16_t) outcome);
@@ -231,6 +235,8 @@ uint16_t deviceInit( void ) {
     uint8_t response_data[MAX_INIT_PAYLOAD_SIZE] = {0};
     uint8_t far *response_data_ptr = &response_data[0];
     responsePayload.data = response_data_ptr;
+    responsePayload.params_size = sizeof(response_params);
+    responsePayload.data_size = sizeof(response_data);
     
     outcome = receive_response(&responsePayload);
     if (outcome != STATUS_OK) {
@@ -320,6 +326,7 @@ uint16_t deviceInit( void ) {
         my_bpbs[i].bpb_mdesc = drive->media_descriptor;
         my_bpbs[i].bpb_nfsect = drive->sectors_per_fat;
     }
+    reserve_metadata_cache(registers.cs);
     
     if (debug) {
         if (debug) writeToDriveLog("SD: done parsing &my_bpbs[0]: = %4x:%4x\n", FP_SEG(&my_bpbs[0]), FP_OFF(&my_bpbs[0]));
@@ -445,6 +452,14 @@ bool parse_options (char far *p) {
                 if (debug) cdprintf("SD: using serial port %x\n",portbase);
             }
         break; 
+    case 'c':
+    case 'C':
+        if ((p=option_value(p,&temp)) == FALSE)  return FALSE;
+        if (temp > METADATA_CACHE_MAX_KB)
+            temp = METADATA_CACHE_MAX_KB;
+        cache_kb = temp;
+        if (debug) cdprintf("SD: metadata cache %u KB\n", cache_kb);
+        break;
     default:
         return FALSE;
     }
@@ -453,6 +468,27 @@ bool parse_options (char far *p) {
 return TRUE;
 }
 
+/* reserve_metadata_cache */
+/*   The cache buffer takes the place of this init code, which DOS would */
+/* otherwise free once we return, so the end address we hand back just  */
+/* moves past it.  Nothing is written there until the first read after  */
+/* init.  The buffer has to stay inside our one segment.                 */
+static void reserve_metadata_cache(uint16_t cs) {
+    uint16_t start = FP_OFF(&transient_data);
+    uint16_t room = (0xFFFF - start) / SECTOR_SIZE;
+    uint16_t sectors = cache_kb * (1024 / SECTOR_SIZE);
+    if (sectors > room) sectors = room;
+    sectors = metadata_cache_init(MK_FP(cs, start), sectors);
+    if (sectors == 0) return;
+
+    fpRequest->r_endaddr = MK_FP(cs, start + sectors * SECTOR_SIZE);
+    for (int i = 0; i < num_drives; i++) {
+        metadata_cache_add_unit(i, metadata_sectors(my_bpbs[i].bpb_nbyte, my_bpbs[i].bpb_nreserved,
+            my_bpbs[i].bpb_nfat, my_bpbs[i].bpb_nfsect, my_bpbs[i].bpb_ndirent));
+    }
+    if (debug) cdprintf("SD: metadata cache of %u sectors\n", sectors);
+}
+
 static bool validate_far_ptr(void far *ptr, size_t size) {
     uint32_t linear_addr = (FP_SEG(ptr) << 4) + FP_OFF(ptr);
     return linear_addr + size <= 0x100000;  // Below 1MB
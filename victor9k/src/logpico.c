@@ -23,8 +23,8 @@ uint16_t log_message (char *message, uint16_t message_size) {
     logPayload.data = message;
     
     //cdprintf("logging data_size: %u\n", (uint16_t) logPayload.data_size);
-    create_payload_crc8(&logPayload);
 
+    set_receive_mode(RECEIVE_INTERRUPT);
     ResponseStatus outcome = send_command_payload(&logPayload);
     if (outcome != STATUS_OK) {
         cdprintf("Error: Failed to send LOG_OUTPUT command to pico. Outcome: %u\n", (uint16_t) outcome);
@@ -38,6 +38,7 @@ uint16_t log_message (char *message, uint16_t message_size) {
     uint8_t response_params[1] = {0};
     responsePayload.params = &response_params[0];
     responsePayload.data = &response_params[0];
+    responsePayload.params_size = sizeof(response_params);
     responsePayload.data_size = 1;
     outcome = receive_response(&responsePayload);
     if (outcome != STATUS_OK) {
@@ -31,6 +31,7 @@
 #include "template.h"
 #include "cprint.h"     /* Console printing direct to hardware */
 #include "v9_communication.h"  /* Victor 9000 user port to raspberry pico communication protocol */
+#include "v9_metadata_cache.h" /* FAT and root directory sectors kept in the driver */
 #include "../../common/protocols.h"
 #include "../../common/dos_device_payloads.h"
 #include "../../common/crc8.h"
@@ -43,7 +44,7 @@ uint32_t dos_stack;
 
 #endif // USE_INTERNAL_STACK
 
-static bool validate_far_ptr(void far *ptr, size_t size);
+static bool validate_far_ptr(void far *ptr, uint32_t size);
 
 bool initNeeded = TRUE;
 int8_t num_drives = -1;
@@ -224,7 +225,7 @@ static uint16_t readBlock (void)
     uint8_t far *transfer_area = (uint8_t far *)fpRequest->r_trans;
 
     // Validate the transfer buffer
-    if (!validate_far_ptr(transfer_area, sector_count * SECTOR_SIZE)) {
+    if (!validate_far_ptr(transfer_area, (uint32_t)sector_count * SECTOR_SIZE)) {
         if (debug) cdprintf("SD: Invalid transfer buffer address\n");
         return (S_DONE | S_ERROR | E_GENERAL_FAILURE);
     }
@@ -250,11 +251,20 @@ static uint16_t readBlock (void)
     readPayload.data_size = sizeof(data);
     //if (debug) cdprintf("sending data_size: %u\n", readPayload.data_size);
 
-      // Prepare dynamic read parameters
-      readParams.sector_count = sector_count;
-      readParams.start_sector = start_sector;
-      create_payload_crc8(&readPayload);
+    // Whole DOS transfers go as one request on a framed link, a stop-and-wait
+    // link takes them max_request_sectors() at a time. Cached metadata sectors
+    // are copied in place and only the runs between them cross the link.
+    uint16_t per_request = max_request_sectors();
+    for (uint16_t done = 0; done < sector_count; ) {
+      done += metadata_cache_read(readParams.drive_number, start_sector + done,
+          sector_count - done, transfer_area + done * SECTOR_SIZE);
+      if (done == sector_count) break;
+      uint16_t sectors = (sector_count - done > per_request) ? per_request : sector_count - done;
+      sectors = metadata_cache_misses(readParams.drive_number, start_sector + done, sectors);
+      readParams.sector_count = sectors;
+      readParams.start_sector = start_sector + done;
       
+      set_receive_mode(RECEIVE_POLLED);   // sector data, the fast path
       ResponseStatus outcome = send_command_payload(&readPayload);
       if (outcome != STATUS_OK) {
           cdprintf("Error: Failed to send READ_BLOCK command to SD Block Device. Outcome: %d\n",(uint16_t) outcome);
@@ -267,13 +277,16 @@ static uint16_t readBlock (void)
       Payload responsePayload = {0};
       uint8_t response_params[3] = {0};
       responsePayload.params = &response_params[0];
-      responsePayload.data = transfer_area;
-      responsePayload.data_size = sector_count * SECTOR_SIZE;
-      outcome = receive_response(&responsePayload);
+      responsePayload.params_size = sizeof(response_params);
+      responsePayload.data = transfer_area + done * SECTOR_SIZE;
+      outcome = receive_sectors_response(&responsePayload, sectors);
       if (outcome != STATUS_OK) {
           cdprintf("SD Error: Failed to receive response from SD Block Device %d\n", (uint16_t) outcome);
           return (S_DONE | S_ERROR | E_UNKNOWN_MEDIA );
       }
+      metadata_cache_fill(readParams.drive_number, start_sector + done, sectors, transfer_area + done * SECTOR_SIZE);
+      done += sectors;
+    }
 
     #ifdef RAMDRIVE
     //return data from RAM drive
@@ -321,36 +334,48 @@ static uint16_t write_block (bool verify)
     WriteParams writeParams = {0};
     writeParams.drive_number = fpRequest->r_unit;
     writeParams.media_descriptor = media_descriptor;
-    writeParams.sector_count = sector_count;
-    writeParams.start_sector = start_sector;
 
     writePayload.params_size = sizeof(writeParams);
     writePayload.params = (uint8_t *)(&writeParams);
-    writePayload.data_size = sector_count * SECTOR_SIZE;
-    writePayload.data = transfer_area;
     
-    //if (debug) cdprintf("sending data_size: %u\n", (uint16_t) writePayload.data_size);
-    create_payload_crc8(&writePayload);
-
-    ResponseStatus outcome = send_command_payload(&writePayload);
-    if (outcome != STATUS_OK) {
-        cdprintf("Error: Failed to send READ_BLOCK command to SD Block Device. Outcome: %u\n", (uint16_t) outcome);
-        return (S_DONE | S_ERROR | E_UNKNOWN_MEDIA );
-    } 
+    // Split as readBlock does on a stop-and-wait link
+    uint16_t per_request = max_request_sectors();
+    for (uint16_t done = 0; done < sector_count; ) {
+      uint16_t sectors = (sector_count - done > per_request) ? per_request : sector_count - done;
+      writeParams.sector_count = sectors;
+      writeParams.start_sector = start_sector + done;
+      writePayload.data = transfer_area + done * SECTOR_SIZE;
+
+      set_receive_mode(RECEIVE_POLLED);
+      ResponseStatus outcome = send_sectors_payload(&writePayload, sectors);
+      if (outcome != STATUS_OK) {
+          cdprintf("Error: Failed to send READ_BLOCK command to SD Block Device. Outcome: %u\n", (uint16_t) outcome);
+          metadata_cache_drop(writeParams.drive_number, start_sector + done, sectors);
+          return (S_DONE | S_ERROR | E_UNKNOWN_MEDIA );
+      } 
   
-    //getting the response from the pico
-    //cdprintf("command sent success, starting receive response\n");
-
-    Payload responsePayload = {0};
-    uint8_t reponse_data = 0;
-    uint8_t response_params[3] = {0};
-    responsePayload.params = &response_params[0];
-    responsePayload.data = reponse_data;
-    responsePayload.data_size = sector_count * SECTOR_SIZE;
-    outcome = receive_response(&responsePayload);
-    if (outcome != STATUS_OK) {
-        cdprintf("SD Error: Failed to receive response from SD Block Device %u\n", (uint16_t) outcome);
-        return (S_DONE | S_ERROR | E_UNKNOWN_MEDIA );
+      //getting the response from the pico
+      //cdprintf("command sent success, starting receive response\n");
+
+      Payload responsePayload = {0};
+      uint8_t reponse_data = 0;
+      uint8_t response_params[3] = {0};
+      responsePayload.params = &response_params[0];
+      responsePayload.params_size = sizeof(response_params);
+      responsePayload.data = &reponse_data;
+      responsePayload.data_size = sizeof(reponse_data);
+      outcome = receive_response(&responsePayload);
+      if (outcome != STATUS_OK) {
+          cdprintf("SD Error: Failed to receive response from SD Block Device %u\n", (uint16_t) outcome);
+          metadata_cache_drop(writeParams.drive_number, start_sector + done, sectors);
+          return (S_DONE | S_ERROR | E_UNKNOWN_MEDIA );
+      }
+      if (responsePayload.params_size > 0 && response_params[0] != STATUS_OK) {
+          metadata_cache_drop(writeParams.drive_number, start_sector + done, sectors);
+          return (S_DONE | S_ERROR | E_WRITE_FAULT );
+      }
+      metadata_cache_fill(writeParams.drive_number, start_sector + done, sectors, writePayload.data);
+      done += sectors;
     }
 
     #ifdef RAMDRIVE
@@ -462,7 +487,7 @@ void __far DeviceStrategy( request __far *req )
 
 }
 
-static bool validate_far_ptr(void far *ptr, size_t size) {
-    uint32_t linear_addr = (FP_SEG(ptr) << 4) + FP_OFF(ptr);
+static bool validate_far_ptr(void far *ptr, uint32_t size) {
+    uint32_t linear_addr = ((uint32_t)FP_SEG(ptr) << 4) + FP_OFF(ptr);
     return linear_addr + size <= 0x100000;  // Below 1MB
 }
@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <conio.h>
 #include <time.h>
+#include <string.h>
 
 #include "../common/protocols.h"
 #include "../common/dos_device_payloads.h"
@@ -27,30 +28,115 @@ static volatile V9kParallelPort far *via3 = MK_FP(PHASE2_DEVICE_SEGMENT,
       VIA3_REG_OFFSET);
 static volatile uint8_t far *pic = MK_FP(INTEL_DEV_SEGMENT, PIC_8259_OFFSET);
 
-static uint8_t buffer;
-static bool bufferFull = false;
 static bool payloadDebug = false;
 
+// Interrupt mode receive: userPortISR moves each byte from port A into the
+// ring as CA1 signals it, receives take them from there. Only the ISR moves
+// rxHead and only the reader rxTail.
+static ReceiveMode receiveMode = RECEIVE_POLLED;
+static bool isrInstalled = false;
+static volatile uint8_t rxRing[RX_RING_SIZE];
+static volatile uint8_t rxHead = 0;
+static volatile uint8_t rxTail = 0;
+static volatile bool rxStalled = false;    // ring was full, CA1 masked until there is room
+
+// Single frame requests and the check on them, agreed in send_startup_handshake
+static bool framingWanted = true;
+static IntegrityKind integrityWanted = INTEGRITY_CRC16;
+static bool framedLink = false;
+static IntegrityKind linkIntegrity = INTEGRITY_CRC8;
+static uint8_t frameSequence = FRAME_SEQUENCE_FLAG;   // of the last request sent
+
+// What the Pico agreed to in the capability exchange, or what an older
+// handshake implies
+static bool capabilitiesWanted = true;
+static bool fillWanted = true;
+static LinkCapabilities linkCaps = { 0, 0, 1 << INTEGRITY_CRC8, SEGMENT_SECTORS, 1, CAP_ANY, CAP_ANY };
+
+// Takes the byte waiting in port A into the ring. Reading port A is what
+// tells the Pico to send the next one, so with the ring full the byte is left
+// in the port and CA1 masked, and the Pico waits until ring_take makes room.
+static void receive_port_byte(void) {
+    if ((uint8_t)(rxHead + 1) == rxTail) {
+        via3->int_enable_reg = CA1_INTERRUPT_MASK;      // bit 7 clear disables
+        rxStalled = true;
+        return;
+    }
+    rxRing[rxHead] = VIA_READ_DATA();
+    rxHead++;
+}
+
+// INTERRUPT_NUM is shared by the VIAs. A byte for us goes into the ring, then
+// the interrupt always goes on to the original handler: it services the other
+// VIAs and sends the one EOI for the line, so the PIC never gets two.
 void interrupt far userPortISR(void) {
-   // Check if the interrupt is for your device and handle it
-   if (via3->int_flag_reg > 0) {
-      // Check if the interrupt is for the user port
-      if (via3->int_flag_reg & CB2_INTERRUPT_MASK) {
-         // Clear CB2 interrupt flag, outbound port data taken
-         via3->int_flag_reg = CB2_INTERRUPT_MASK;
-      } else if (via3->int_flag_reg & CA1_INTERRUPT_MASK) {
-         // Inbound port Data Ready signal detected
-         buffer = via3->out_in_reg_a; // Get data byte
-         bufferFull = true;
-         // Clear CA1 interrupt flag
-         via3->int_flag_reg = CA1_INTERRUPT_MASK;
-      }
-      *pic = PIC_VIA_SPECIFIC_EOI; // Send End of Interrupt command to the PIC command register
-      _chain_intr(originalISR);         //send the interrupt up the chain for other 6522's
-   } else {
-      // Call the original ISR
-      _chain_intr(originalISR);
-   }
+    if (receiveMode == RECEIVE_INTERRUPT && (via3->int_flag_reg & via3->int_enable_reg & CA1_INTERRUPT_MASK)) {
+        receive_port_byte();
+    }
+    _chain_intr(originalISR);
+}
+
+#ifdef __WATCOMC__
+// sti only takes effect after the next instruction, so an interrupt that
+// comes after the ring was found empty still ends the hlt
+extern void halt_until_interrupt(void);
+#pragma aux halt_until_interrupt = \
+    "sti" \
+    "hlt" \
+    parm [] \
+    modify [];
+#endif
+
+// Called with interrupts off and the ring empty, returns with them on. The
+// check after waking is all the host has, it has no interrupts, and on the
+// Victor it picks up a byte whose interrupt did not come through.
+static void wait_for_port_byte(void) {
+#ifdef __WATCOMC__
+    halt_until_interrupt();
+    Disable();
+#endif
+    if (rxHead == rxTail && VIA_DATA_READY()) {
+        receive_port_byte();
+    }
+    Enable();
+}
+
+static uint8_t ring_take(void) {
+    Disable();
+    while (rxHead == rxTail) {
+        wait_for_port_byte();
+        Disable();
+    }
+    uint8_t value = rxRing[rxTail];
+    rxTail++;
+    if (rxStalled) {
+        rxStalled = false;
+        via3->int_enable_reg = INTERRUPT_ENABLE | CA1_INTERRUPT_MASK;   // a byte still waiting fires at once
+    }
+    Enable();
+    return value;
+}
+
+// Picks how receives wait for the Pico, for the requests that follow. Polled
+// is the fast path for sector data. In interrupt mode the CPU halts between
+// bytes instead of spinning, which suits replies that take a while to start.
+// Only switch between requests, while no byte is on its way.
+void set_receive_mode(ReceiveMode mode) {
+    if (mode == receiveMode) {
+        return;
+    }
+    if (mode == RECEIVE_INTERRUPT && !isrInstalled) {
+        originalISR = _dos_getvect(INTERRUPT_NUM);
+        _dos_setvect(INTERRUPT_NUM, userPortISR);
+        isrInstalled = true;
+    }
+    Disable();
+    if (rxHead != rxTail && debug) cdprintf("Dropping %d received bytes\n", (uint8_t)(rxHead - rxTail));
+    rxHead = rxTail = 0;
+    rxStalled = false;
+    receiveMode = mode;
+    via3->int_enable_reg = (mode == RECEIVE_INTERRUPT) ? (INTERRUPT_ENABLE | CA1_INTERRUPT_MASK) : CA1_INTERRUPT_MASK;
+    Enable();
 }
 
 ResponseStatus initialize_user_port(void) {
@@ -60,11 +146,8 @@ ResponseStatus initialize_user_port(void) {
     if (debug) cdprintf("Address of via3: %x\n", (void*)via3);
     if (debug) cdprintf("via3->out_in_reg_a: %x\n", (void*)via3);
 
-    // Save the original 6522 Interrupt Service Routine [ISR] address
-    // originalISR = _dos_getvect(INTERRUPT_NUM);
-
-    // Set my ISR
-    //_dos_setvect( INTERRUPT_NUM, userPortISR );
+    // userPortISR is installed by set_receive_mode the first time interrupt
+    // mode is asked for, polled receives never need it
 
     via3->out_in_reg_a = 0;               // out_in_reg_a is dataport, init with 0's =input bits
     if (debug) cdprintf("setting data_dir_reg_a\n");
@@ -76,6 +159,7 @@ ResponseStatus initialize_user_port(void) {
 
     via3->int_enable_reg = VIA_CLEAR_INTERRUPTS;   //turn off all interrupts as base starting point
     via3->int_flag_reg = VIA_CLEAR_INTERRUPTS;    //clear all interrupt flags
+    receiveMode = RECEIVE_POLLED;
 
     if (debug) cdprintf("periph_ctrl_reg\n");
     via3->periph_ctrl_reg = VIA_PULSE_MODE;  // setting usage of CA/CB lines
@@ -98,9 +182,13 @@ ResponseStatus burstBytes(uint8_t far *data, size_t length) {
     }
     if (payloadDebug) cdprintf("burstBytes start\n");
     if (payloadDebug) cdprintf("burstBytes &data: %4x:%4x\n", FP_SEG(data), FP_OFF(data));
+#ifdef __WATCOMC__
+    via_burst(data, length);
+#else
     for (size_t i = 0; i < length; ++i) {
-        via3->out_in_reg_b = data[i]; // Send data byte
+        VIA_WRITE_DATA(data[i]); // Send data byte
     }
+#endif
     if (payloadDebug) cdprintf("burstBytes end\n");
     return STATUS_OK;
 }
@@ -114,14 +202,20 @@ ResponseStatus sendBytes(uint8_t far *data, size_t length) {
     }
     if (payloadDebug) cdprintf("sendBytesPB start\n");
     if (payloadDebug) cdprintf("sendBytesPB &data: %4x:%4x\n", FP_SEG(data), FP_OFF(data));
+#ifdef __WATCOMC__
+    if (via_send(data, length) != 0) {
+        if (debug) cdprintf("Timeout waiting for CB1 interrupt\n");
+        return TIMEOUT;
+    }
+#else
     int iteration = 0;
     for (size_t i = 0; i < length; ++i) {
         //if (debug) cdprintf("i: %d: value: %d\n", i, data[i]);
         
-        via3->out_in_reg_b = data[i]; // Send data byte
+        VIA_WRITE_DATA(data[i]); // Send data byte
         //Wait for ACK on CB2periph_ctrl_reg
         for (iteration = 0; iteration < MAX_POLLING_ITERATIONS; iteration++) {
-            if (via3->int_flag_reg & CB1_INTERRUPT_MASK) {
+            if (VIA_DATA_TAKEN()) {
                 // Data Taken signal detected
                 break;
             }
@@ -131,6 +225,7 @@ ResponseStatus sendBytes(uint8_t far *data, size_t length) {
             return TIMEOUT;
         }
     }
+#endif
     //if (debug) cdprintf("sendBytesPB end\n");
     return STATUS_OK;
 }
@@ -144,18 +239,243 @@ ResponseStatus receiveBytes(uint8_t far *data, size_t length) {
    if (payloadDebug) cdprintf("receiveBytesPA start size: %d\n", length);
    if (payloadDebug) cdprintf("receiveBytesPA &data: %4x:%4x\n", FP_SEG(data), FP_OFF(data));
  
+   if (receiveMode == RECEIVE_INTERRUPT) {
+      for (size_t i = 0; i < length; ++i) {
+         data[i] = ring_take();
+      }
+      return STATUS_OK;
+   }
+#ifdef __WATCOMC__
+   via_receive(data, length);
+#else
    for (size_t i = 0; i < length; ++i) {
       //if (debug) cdprintf("waiting for data i: %d int_flag_reg: %x\n", i, via3->int_flag_reg);
-      while ((via3->int_flag_reg & CA1_INTERRUPT_MASK) == 0) {}; // Poll CA1 for Data Ready signal
-      data[i] = via3->out_in_reg_a; // get data byte
+      while (!VIA_DATA_READY()) {}; // Poll CA1 for Data Ready signal
+      data[i] = VIA_READ_DATA(); // get data byte
       //if (debug) cdprintf("received: %d %d\n", i, data[i]);
    }
+#endif
    if (payloadDebug) cdprintf("receiveBytesPA end\n");
    return STATUS_OK;
 }
 
+// burstBytes and receiveBytes that also continue a check over the bytes, so
+// each byte is read once to go out or stored once coming in, and the check
+// needs no second pass over the data
+static uint16_t burstBytesChecked(uint8_t far *data, size_t length, IntegrityKind kind, uint16_t check) {
+    integrity_tables_ready();
+#ifdef __WATCOMC__
+    if (kind == INTEGRITY_CRC16) {
+        return via_burst_crc16(data, length, crc16_table[0], check);
+    }
+    return via_burst_crc8(data, length, crc8_table, check);
+#else
+    if (kind == INTEGRITY_CRC16) {
+        for (size_t i = 0; i < length; ++i) {
+            uint8_t byte = data[i];
+            VIA_WRITE_DATA(byte);
+            check = CRC16_STEP(check, byte);
+        }
+    } else {
+        for (size_t i = 0; i < length; ++i) {
+            uint8_t byte = data[i];
+            VIA_WRITE_DATA(byte);
+            check = CRC8_STEP(check, byte);
+        }
+    }
+    return check;
+#endif
+}
+
+static uint16_t receiveBytesChecked(uint8_t far *data, size_t length, IntegrityKind kind, uint16_t check) {
+    integrity_tables_ready();
+    if (receiveMode == RECEIVE_INTERRUPT) {
+        for (size_t i = 0; i < length; ++i) {
+            uint8_t byte = ring_take();
+            data[i] = byte;
+            check = (kind == INTEGRITY_CRC16) ? CRC16_STEP(check, byte) : CRC8_STEP(check, byte);
+        }
+        return check;
+    }
+#ifdef __WATCOMC__
+    if (kind == INTEGRITY_CRC16) {
+        return via_receive_crc16(data, length, crc16_table[0], check);
+    }
+    return via_receive_crc8(data, length, crc8_table, check);
+#else
+    if (kind == INTEGRITY_CRC16) {
+        for (size_t i = 0; i < length; ++i) {
+            while (!VIA_DATA_READY()) {};
+            uint8_t byte = VIA_READ_DATA();
+            data[i] = byte;
+            check = CRC16_STEP(check, byte);
+        }
+    } else {
+        for (size_t i = 0; i < length; ++i) {
+            while (!VIA_DATA_READY()) {};
+            uint8_t byte = VIA_READ_DATA();
+            data[i] = byte;
+            check = CRC8_STEP(check, byte);
+        }
+    }
+    return check;
+#endif
+}
+
+// Sector coding, see SECTOR_FILL. Only the sector data of reads and writes is
+// coded, and only once the capability exchange agreed to it.
+static bool is_coded_write(const Payload *request) {
+    return (linkCaps.features & CAP_FILL_SECTORS) && request->protocol == SD_BLOCK_DEVICE &&
+           (request->command == WRITE_NO_VERIFY || request->command == WRITE_VERIFY) &&
+           request->data_size % SECTOR_SIZE == 0;
+}
+
+static bool is_coded_read(const Payload *response) {
+    return (linkCaps.features & CAP_FILL_SECTORS) && response->protocol == SD_BLOCK_DEVICE &&
+           response->command == READ_BLOCK && response->data_size % SECTOR_SIZE == 0;
+}
+
+static bool is_uniform_sector(uint8_t far *sector) {
+#ifdef __WATCOMC__
+    return uniform_sector(sector) != 0;
+#else
+    return memcmp(sector, sector + 1, SECTOR_SIZE - 1) == 0;
+#endif
+}
+
+static void expand_sector(uint8_t far *sector, uint8_t value) {
+#ifdef __WATCOMC__
+    fill_sector(sector, value);
+#else
+    memset(sector, value, SECTOR_SIZE);
+#endif
+}
+
+// burstBytesChecked and receiveBytesChecked for sector coded data. A sector of
+// one value crosses as two bytes instead of 513.
+static uint16_t burstSectorsChecked(uint8_t far *data, uint16_t size, IntegrityKind kind, uint16_t check) {
+    for (uint16_t offset = 0; offset < size; offset += SECTOR_SIZE) {
+        uint8_t far *sector = data + offset;
+        uint8_t coding[2] = { SECTOR_LITERAL, 0 };
+        if (is_uniform_sector(sector)) {
+            coding[0] = SECTOR_FILL;
+            coding[1] = sector[0];
+            check = burstBytesChecked( (uint8_t far *) coding, 2, kind, check);
+        } else {
+            check = burstBytesChecked( (uint8_t far *) coding, 1, kind, check);
+            check = burstBytesChecked( sector, SECTOR_SIZE, kind, check);
+        }
+    }
+    return check;
+}
+
+static uint16_t receiveSectorsChecked(uint8_t far *data, uint16_t size, IntegrityKind kind, uint16_t check) {
+    for (uint16_t offset = 0; offset < size; offset += SECTOR_SIZE) {
+        uint8_t coding[2];
+        check = receiveBytesChecked( (uint8_t far *) coding, 1, kind, check);
+        if (coding[0] == SECTOR_FILL) {
+            check = receiveBytesChecked( (uint8_t far *) &coding[1], 1, kind, check);
+            expand_sector(data + offset, coding[1]);
+        } else {
+            check = receiveBytesChecked( data + offset, SECTOR_SIZE, kind, check);
+        }
+    }
+    return check;
+}
+
+// The legacy data CRC starts with the size, high byte first
+static uint8_t data_size_crc8(uint16_t data_size) {
+    integrity_tables_ready();
+    uint8_t crc = CRC8_STEP(0, (data_size >> 8) & 0xFF);
+    return CRC8_STEP(crc, data_size & 0xFF);
+}
+
+// Best offer first: the capability exchange, frames checked by CRC-16, frames
+// checked by CRC-8, then the plain handshake. A Pico ignores an offer it does
+// not know, so each one gets FRAMED_HANDSHAKE_ATTEMPTS silent tries before the
+// next one goes out.
+static uint8_t handshake_offer(uint8_t attempt) {
+    uint8_t round = (attempt - 1) / FRAMED_HANDSHAKE_ATTEMPTS;
+    bool crc16 = integrityWanted == INTEGRITY_CRC16;
+    if (capabilitiesWanted) {
+        if (round == 0) {
+            return STARTUP_HANDSHAKE_CAPS;
+        }
+        round--;
+    }
+    if (framingWanted && crc16 && round == 0) {
+        return STARTUP_HANDSHAKE_FRAMED_CRC16;
+    }
+    if (framingWanted && round <= (crc16 ? 1 : 0)) {
+        return STARTUP_HANDSHAKE_FRAMED;
+    }
+    return STARTUP_HANDSHAKE;
+}
+
+// An answer to one of the single byte handshakes. Those Picos may predate
+// segments and batches, so neither is used.
+static void settle_handshake(uint8_t response) {
+    framedLink = (response != HANDSHAKE_RESPONSE);
+    linkIntegrity = (response == HANDSHAKE_RESPONSE_FRAMED_CRC16) ? INTEGRITY_CRC16 : INTEGRITY_CRC8;
+    linkCaps.version = 0;
+    linkCaps.features = framedLink ? CAP_FRAMED : 0;
+    linkCaps.integrity = 1 << linkIntegrity;
+    linkCaps.max_request_sectors = SEGMENT_SECTORS;
+    linkCaps.window = 1;
+    linkCaps.write_policy = CAP_ANY;
+    linkCaps.pio_clock_mhz = CAP_ANY;
+}
+
+// After HANDSHAKE_RESPONSE_CAPS: the offer goes out as a block and the Pico's
+// answer is what the link runs with
+static ResponseStatus exchange_capabilities(void) {
+    LinkCapabilities offer;
+    offer.version = CAPABILITY_VERSION;
+    offer.features = CAP_BLOCK_BATCH | (framingWanted ? CAP_FRAMED : 0) |
+                     (framingWanted && fillWanted ? CAP_FILL_SECTORS : 0);
+    offer.integrity = (1 << INTEGRITY_CRC8) | (integrityWanted == INTEGRITY_CRC16 ? 1 << INTEGRITY_CRC16 : 0);
+    offer.max_request_sectors = MAX_REQUEST_SECTORS;
+    offer.window = 1;
+    offer.write_policy = CAP_ANY;
+    offer.pio_clock_mhz = CAP_ANY;
+
+    uint8_t block[CAPABILITY_BLOCK_MAX + 3];
+    uint8_t size = sizeof(offer) - 1;
+    block[0] = offer.version;
+    block[1] = size;
+    memcpy(&block[2], &offer.features, size);
+    block[2 + size] = crc8(block, 2 + size);
+    sendBytes( (uint8_t far *) block, 3 + size);
+
+    receiveBytes( (uint8_t far *) block, 2);
+    size = block[1];
+    if (size > CAPABILITY_BLOCK_MAX) {
+        return INVALID_DATA_SIZE;   // no way to stay in step with the Pico, the handshake starts over
+    }
+    receiveBytes( (uint8_t far *) &block[2], size + 1);
+    if (block[0] == 0 || crc8(block, 2 + size) != block[2 + size]) {
+        if (debug) cdprintf("Capability answer refused or damaged\n");
+        return INVALID_CRC;
+    }
+    // fields a version 1 Pico does not send keep what the older handshakes imply
+    settle_handshake(HANDSHAKE_RESPONSE);
+    linkCaps.version = block[0];
+    memcpy(&linkCaps.features, &block[2], size < sizeof(linkCaps) - 1 ? size : sizeof(linkCaps) - 1);
+    framedLink = (linkCaps.features & CAP_FRAMED) != 0;
+    linkIntegrity = (linkCaps.integrity & (1 << INTEGRITY_CRC16)) ? INTEGRITY_CRC16 : INTEGRITY_CRC8;
+    if (!framedLink) {
+        linkCaps.features &= ~CAP_FILL_SECTORS;             // so is the sector coding
+        if (linkCaps.max_request_sectors > SEGMENT_SECTORS) {
+            linkCaps.max_request_sectors = SEGMENT_SECTORS; // segments are frames
+        }
+    }
+    return STATUS_OK;
+}
+
 ResponseStatus send_startup_handshake(void) {
+    set_receive_mode(RECEIVE_POLLED);   // the answer is polled for with a timeout
     uint8_t handshake_count = 0;
+    uint16_t busy_count = 0;
     while (handshake_count < MAX_HANDSHAKE_ATTEMPTS) {
         handshake_count++;
         if (debug) cdprintf("Handshake attempt: %d\n", handshake_count);
@@ -169,7 +489,7 @@ ResponseStatus send_startup_handshake(void) {
             }
         }
 
-        via3->out_in_reg_b = STARTUP_HANDSHAKE; // Send startup handshake
+        VIA_WRITE_DATA(handshake_offer(handshake_count)); // Send startup handshake
 
         // Wait for response within timeout
         uint8_t response = 0;
@@ -178,8 +498,8 @@ ResponseStatus send_startup_handshake(void) {
         // Wait for ACK on CB2
         int iteration;
         for (iteration = 0; iteration < MAX_POLLING_ITERATIONS; iteration++) {
-            if (via3->int_flag_reg & CA1_INTERRUPT_MASK) {
-                response = via3->out_in_reg_a;
+            if (VIA_DATA_READY()) {
+                response = VIA_READ_DATA();
                     response_received = true;
                     break;
             }
@@ -191,18 +511,60 @@ ResponseStatus send_startup_handshake(void) {
             continue; // Retry handshake
         }
 
-        if (response == HANDSHAKE_RESPONSE) {
-            if (payloadDebug) cdprintf("Handshake successful\n");
+        // the Pico is up but still mounting its card: the offer was understood,
+        // so it goes out again unchanged and is not counted as an attempt
+        if (response == HANDSHAKE_RESPONSE_BUSY) {
+            if (++busy_count > MAX_BUSY_ANSWERS) {
+                break;
+            }
+            handshake_count--;
+            for (iteration = 0; iteration < BUSY_RETRY_POLLS; iteration++) {
+                delay_us(20);
+            }
+            continue;
+        }
+
+        if (response == HANDSHAKE_RESPONSE_CAPS) {
+            if (exchange_capabilities() != STATUS_OK) {
+                continue;
+            }
+            if (payloadDebug) cdprintf("Capabilities agreed, version: %d framed: %d integrity: %d busy: %u\n",
+                                       linkCaps.version, framedLink, linkIntegrity, busy_count);
+            return STATUS_OK;
+        } else if (response == HANDSHAKE_RESPONSE || response == HANDSHAKE_RESPONSE_FRAMED ||
+            response == HANDSHAKE_RESPONSE_FRAMED_CRC16) {
+            settle_handshake(response);
+            if (payloadDebug) cdprintf("Handshake successful, framed: %d integrity: %d\n", framedLink, linkIntegrity);
             return STATUS_OK;
         } else {
             if (debug) cdprintf("Unexpected response %d, retrying\n", response);
             continue;
         }
     }
-    if (debug) cdprintf("Handshake failed after %d attempts\n", handshake_count);
+    if (debug) cdprintf("Handshake failed after %d attempts, %u busy answers\n", handshake_count, busy_count);
     return TIMEOUT;
 }
 
+void set_link_framing(bool enabled) {
+    framingWanted = enabled;
+}
+
+void set_capability_exchange(bool enabled) {
+    capabilitiesWanted = enabled;
+}
+
+void set_fill_sectors(bool enabled) {
+    fillWanted = enabled;
+}
+
+const LinkCapabilities* link_capabilities(void) {
+    return &linkCaps;
+}
+
+void set_link_integrity(IntegrityKind kind) {
+    integrityWanted = kind;
+}
+
 ResponseStatus send_uint16_t(uint16_t data) {
     if (payloadDebug) cdprintf("send_uint16_t: %d\n", data);
     uint8_t data_array[2];
@@ -212,7 +574,7 @@ ResponseStatus send_uint16_t(uint16_t data) {
     return STATUS_OK;
 }
 
-void sendResponseStatus(ResponseStatus status) {
+static void sendResponseStatus(ResponseStatus status) {
     uint8_t status_value = (uint8_t)status;  // Cast enum to uint8_t
     sendBytes(&status_value, 1);               // Pass address of uint8_t
 }
@@ -223,7 +585,79 @@ ResponseStatus receive_response_status() {
     return (ResponseStatus)status_value;
 }
 
+static void fill_frame_header(uint8_t *header, uint8_t sequence, Payload *payload) {
+    header[0] = sequence;
+    header[1] = (uint8_t)payload->protocol;
+    header[2] = payload->command;
+    header[3] = (payload->params_size >> 8) & 0xFF;
+    header[4] = payload->params_size & 0xFF;
+    header[5] = (payload->data_size >> 8) & 0xFF;
+    header[6] = payload->data_size & 0xFF;
+}
+
+// Ends a frame with its check and waits for the ack, which has to carry the
+// frame's sequence to count
+static ResponseStatus finish_frame(uint8_t sequence, uint16_t check) {
+    uint8_t trailer_size = integrity_size(linkIntegrity);
+    uint8_t trailer[2] = { (check >> 8) & 0xFF, check & 0xFF };
+    sendBytes( (uint8_t far *) &trailer[2 - trailer_size], trailer_size);
+    uint8_t ack[2];
+    receiveBytes( (uint8_t far *) ack, 2);
+    return (ack[1] == sequence) ? (ResponseStatus)ack[0] : INVALID_CRC;
+}
+
+// The whole request goes out as one frame with one ack to wait for. A NAK
+// sends the same frame again. The check is worked out as the bytes go.
+static ResponseStatus send_command_frame(Payload *payload) {
+    frameSequence = NEXT_FRAME_SEQUENCE(frameSequence);
+    uint8_t header[FRAME_HEADER_SIZE];
+    fill_frame_header(header, frameSequence, payload);
+    ResponseStatus outcome = INVALID_CRC;
+    for (int attempt = 0; attempt < FRAME_MAX_ATTEMPTS; attempt++) {
+        if (payloadDebug) cdprintf("sending frame %d attempt %d\n", frameSequence, attempt);
+        sendBytes( (uint8_t far *) header, FRAME_HEADER_SIZE);
+        uint16_t check = frame_header_integrity(linkIntegrity, frameSequence, payload);
+        check = burstBytesChecked( payload->params, payload->params_size, linkIntegrity, check);
+        if (is_coded_write(payload)) {
+            check = burstSectorsChecked( payload->data, payload->data_size, linkIntegrity, check);
+        } else {
+            check = burstBytesChecked( payload->data, payload->data_size, linkIntegrity, check);
+        }
+        outcome = finish_frame(frameSequence, check);
+        if (outcome == STATUS_OK) {
+            break;
+        }
+    }
+    return outcome;
+}
+
+// The sectors of a transfer past its first frame, see SEGMENT_SECTORS. They
+// are coded when the first frame was.
+static ResponseStatus send_segment_frame(uint8_t far *data, uint16_t size, bool coded) {
+    frameSequence = NEXT_FRAME_SEQUENCE(frameSequence);
+    ResponseStatus outcome = INVALID_CRC;
+    for (int attempt = 0; attempt < FRAME_MAX_ATTEMPTS; attempt++) {
+        if (payloadDebug) cdprintf("sending segment %d attempt %d\n", frameSequence, attempt);
+        sendBytes( (uint8_t far *) &frameSequence, 1);
+        uint16_t check = segment_header_integrity(linkIntegrity, frameSequence);
+        if (coded) {
+            check = burstSectorsChecked( data, size, linkIntegrity, check);
+        } else {
+            check = burstBytesChecked( data, size, linkIntegrity, check);
+        }
+        outcome = finish_frame(frameSequence, check);
+        if (outcome == STATUS_OK) {
+            break;
+        }
+    }
+    return outcome;
+}
+
 ResponseStatus send_command_payload(Payload *payload) {
+    if (framedLink) {
+        return send_command_frame(payload);
+    }
+    create_command_crc8(payload);
     ResponseStatus crc_outcome;
     for (int i = 0; i < 9; i++) {
         if (payloadDebug) cdprintf("sending command packet %d\n", i);
@@ -261,7 +695,8 @@ ResponseStatus send_data_packet(Payload *payload) {
     if (payloadDebug) cdprintf("data_size: %d\n", payload->data_size);
     send_uint16_t(payload->data_size);  //send the size of the data
     if (payloadDebug) cdprintf("sending data\n");
-    burstBytes( payload->data, payload->data_size);  //send the actual data
+    uint16_t crc = data_size_crc8(payload->data_size);
+    payload->data_crc = (uint8_t)burstBytesChecked( payload->data, payload->data_size, INTEGRITY_CRC8, crc);
     if (payloadDebug) cdprintf("sending data_crc\n");
     sendBytes( (uint8_t far *) &payload->data_crc, 1);
     ResponseStatus crc_success = receive_response_status();
@@ -277,13 +712,117 @@ uint16_t receive_uint16_t() {
     return (high_byte << 8) | low_byte;
 }
 
+// Reads a frame's check and acks it. The frame counts when it carries the
+// sequence expected and its check matches the one worked out on the way in.
+static bool accept_frame(uint8_t sequence, uint8_t expected, uint16_t check) {
+    uint8_t trailer[2] = {0};
+    uint8_t trailer_size = integrity_size(linkIntegrity);
+    receiveBytes( (uint8_t far *) &trailer[2 - trailer_size], trailer_size);
+    bool valid = sequence == expected && ((trailer[0] << 8) | trailer[1]) == check;
+    uint8_t ack[2] = { valid ? STATUS_OK : INVALID_CRC, sequence };
+    sendBytes( (uint8_t far *) ack, 2);
+    return valid;
+}
+
+// Throws away what the Pico sends until the port has been quiet for
+// MAX_POLLING_ITERATIONS polls, which it is once the Pico has sent all of a
+// frame or packet and waits for its ack. Used when a size in a header cannot
+// be trusted, so the bytes left to come are not known.
+static void drain_until_quiet(void) {
+    int iteration = 0;
+    while (iteration < MAX_POLLING_ITERATIONS) {
+        if (receiveMode == RECEIVE_INTERRUPT && (rxHead != rxTail || VIA_DATA_READY())) {
+            ring_take();
+            iteration = 0;
+        } else if (receiveMode != RECEIVE_INTERRUPT && VIA_DATA_READY()) {
+            VIA_READ_DATA();
+            iteration = 0;
+        } else {
+            delay_us(20);
+            iteration++;
+        }
+    }
+}
+
+// A response frame answers the last request, so it carries its sequence.
+// Anything else is NAKed and the Pico sends the frame again. So is a header
+// whose sizes are more than the caller has room for, it was damaged on the
+// way and nothing past it is stored.
+static ResponseStatus receive_response_frame(Payload *response) {
+    uint16_t params_room = response->params_size;
+    uint16_t data_room = response->data_size;
+    for (int attempt = 0; attempt < FRAME_MAX_ATTEMPTS; attempt++) {
+        uint8_t header[FRAME_HEADER_SIZE];
+        receiveBytes( (uint8_t far *) header, FRAME_HEADER_SIZE);
+        response->protocol = (V9KProtocol)header[1];
+        response->command = header[2];
+        response->params_size = (header[3] << 8) | header[4];
+        response->data_size = (header[5] << 8) | header[6];
+        if (response->params_size > params_room || response->data_size > data_room) {
+            if (debug) cdprintf("frame %d sizes %u %u past room %u %u\n", header[0],
+                                response->params_size, response->data_size, params_room, data_room);
+            drain_until_quiet();
+            uint8_t nak[2] = { INVALID_CRC, header[0] };
+            sendBytes( (uint8_t far *) nak, 2);
+            continue;
+        }
+        uint16_t check = frame_header_integrity(linkIntegrity, header[0], response);
+        check = receiveBytesChecked( response->params, response->params_size, linkIntegrity, check);
+        if (is_coded_read(response)) {
+            check = receiveSectorsChecked( response->data, response->data_size, linkIntegrity, check);
+        } else {
+            check = receiveBytesChecked( response->data, response->data_size, linkIntegrity, check);
+        }
+        if (accept_frame(header[0], frameSequence, check)) {
+            return STATUS_OK;
+        }
+        if (debug) cdprintf("frame %d invalid, attempt %d\n", header[0], attempt);
+    }
+    return INVALID_CRC;
+}
+
+// The segments of a response follow its frame with the next sequences, coded
+// when the frame was
+static ResponseStatus receive_segment_frame(uint8_t far *data, uint16_t size, bool coded) {
+    uint8_t expected = NEXT_FRAME_SEQUENCE(frameSequence);
+    for (int attempt = 0; attempt < FRAME_MAX_ATTEMPTS; attempt++) {
+        uint8_t sequence;
+        receiveBytes( (uint8_t far *) &sequence, 1);
+        uint16_t check = segment_header_integrity(linkIntegrity, sequence);
+        if (coded) {
+            check = receiveSectorsChecked( data, size, linkIntegrity, check);
+        } else {
+            check = receiveBytesChecked( data, size, linkIntegrity, check);
+        }
+        if (accept_frame(sequence, expected, check)) {
+            frameSequence = expected;
+            return STATUS_OK;
+        }
+        if (debug) cdprintf("segment %d invalid, attempt %d\n", sequence, attempt);
+    }
+    return INVALID_CRC;
+}
+
+// params_size and data_size give the room at params and data on the way in
+// and what arrived on the way out. A response with more is refused.
 ResponseStatus receive_response(Payload *response) {
+    if (framedLink) {
+        return receive_response_frame(response);
+    }
+    uint16_t params_room = response->params_size;
+    uint16_t data_room = response->data_size;
     if (payloadDebug) cdprintf("Receiving response\n");
     receiveBytes( (uint8_t *) &response->protocol, 1);
     receiveBytes( (uint8_t *) &response->command, 1);
     if (payloadDebug) cdprintf("protocol: %d\n", response->protocol);
     response->params_size = receive_uint16_t();
     if (payloadDebug) cdprintf("params_size: %d\n", response->params_size);
+    if (response->params_size > params_room) {
+        if (debug) cdprintf("params_size %u past room %u\n", response->params_size, params_room);
+        drain_until_quiet();
+        sendResponseStatus(INVALID_CRC);
+        return INVALID_DATA_SIZE;
+    }
     receiveBytes( response->params, response->params_size);
     if (payloadDebug) cdprintf("Receiving command_crc\n");
     receiveBytes( (uint8_t *) &response->command_crc, 1);
@@ -299,11 +838,18 @@ ResponseStatus receive_response(Payload *response) {
     if (payloadDebug) cdprintf("Receiving data size: %d\n", response->data_size);
     response->data_size = receive_uint16_t();    
     if (payloadDebug) cdprintf("data_size: %d\n", response->data_size);
+    if (response->data_size > data_room) {
+        if (debug) cdprintf("data_size %u past room %u\n", response->data_size, data_room);
+        drain_until_quiet();
+        sendResponseStatus(INVALID_CRC);
+        return INVALID_DATA_SIZE;
+    }
     if (payloadDebug) cdprintf("Receiving data\n");
-    receiveBytes( response->data, response->data_size);
+    uint8_t crc = (uint8_t)receiveBytesChecked( response->data, response->data_size, INTEGRITY_CRC8,
+                                                data_size_crc8(response->data_size));
     if (payloadDebug) cdprintf("Receiving data_crc\n");
     receiveBytes( (uint8_t far *) &response->data_crc, 1);
-    if (is_valid_data_crc8(response) ) {
+    if (response->data_crc == crc) {
         sendResponseStatus(STATUS_OK);
         if (payloadDebug) cdprintf("data_crc valid\n");
     } else {
@@ -313,3 +859,108 @@ ResponseStatus receive_response(Payload *response) {
     }
     return STATUS_OK;
 }
+
+// Sectors one READ_BLOCK or WRITE request can move, as agreed in the
+// handshake. A Pico with segments takes a whole DOS transfer on a framed
+// link, otherwise the driver splits bigger transfers.
+uint16_t max_request_sectors(void) {
+    return linkCaps.max_request_sectors;
+}
+
+static uint16_t segment_sectors(uint16_t sectors_left) {
+    return sectors_left > SEGMENT_SECTORS ? SEGMENT_SECTORS : sectors_left;
+}
+
+// send_command_payload for a request whose data is sector_count sectors, at
+// most max_request_sectors(). The request frame takes the first segment and
+// the rest follow it as segment frames.
+ResponseStatus send_sectors_payload(Payload *request, uint16_t sector_count) {
+    uint16_t sent = segment_sectors(sector_count);
+    request->data_size = sent * SECTOR_SIZE;
+    bool coded = framedLink && is_coded_write(request);
+    ResponseStatus outcome = send_command_payload(request);
+    while (outcome == STATUS_OK && sent < sector_count) {
+        uint16_t sectors = segment_sectors(sector_count - sent);
+        outcome = send_segment_frame(request->data + sent * SECTOR_SIZE, sectors * SECTOR_SIZE, coded);
+        sent += sectors;
+    }
+    return outcome;
+}
+
+// receive_response for the answer to a READ_BLOCK of sector_count sectors,
+// landing them at response->data. Only params_size is the caller's to set.
+ResponseStatus receive_sectors_response(Payload *response, uint16_t sector_count) {
+    uint8_t far *data = response->data;
+    response->data_size = segment_sectors(sector_count) * SECTOR_SIZE;
+    ResponseStatus outcome = receive_response(response);
+    // an error answer is the whole response, no segments follow it
+    if (outcome == STATUS_OK && response->params_size > 0 && response->params[0] != STATUS_OK) {
+        return (ResponseStatus)response->params[0];
+    }
+    bool coded = framedLink && is_coded_read(response);
+    uint16_t received = segment_sectors(sector_count);
+    while (outcome == STATUS_OK && received < sector_count) {
+        uint16_t sectors = segment_sectors(sector_count - received);
+        outcome = receive_segment_frame(data + received * SECTOR_SIZE, sectors * SECTOR_SIZE, coded);
+        received += sectors;
+    }
+    return outcome;
+}
+
+// Runs up to BATCH_MAX_ENTRIES block reads and writes as one request and one
+// response. write_data holds the sectors of the write entries back to back,
+// read_data receives those of the read entries the same way, and statuses
+// gets one byte per entry. The Pico may run the entries in any order that
+// gives the same result.
+ResponseStatus send_block_batch(BatchEntry *entries, uint8_t count, uint8_t far *write_data,
+                                uint8_t far *read_data, uint8_t *statuses) {
+    uint32_t write_sectors = 0;
+    uint32_t read_sectors = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (entries[i].command == READ_BLOCK) {
+            read_sectors += entries[i].params.sector_count;
+        } else {
+            write_sectors += entries[i].params.sector_count;
+        }
+        statuses[i] = GENERAL_ERROR;    // stays if the Pico rejects the batch
+    }
+    if ((linkCaps.features & CAP_BLOCK_BATCH) == 0) {
+        return INVALID_PROTOCOL;    // the Pico did not say it takes batches
+    }
+    // each direction travels with a 16 bit size, which the whole batch has to fit
+    if (read_sectors > MAX_REQUEST_SECTORS || write_sectors > MAX_REQUEST_SECTORS ||
+        read_sectors * SECTOR_SIZE > UINT16_MAX || write_sectors * SECTOR_SIZE > UINT16_MAX) {
+        if (debug) cdprintf("Batch of %d entries moves too many sectors\n", count);
+        return INVALID_DATA_SIZE;
+    }
+    uint16_t read_size = (uint16_t)(read_sectors * SECTOR_SIZE);
+    uint16_t write_size = (uint16_t)(write_sectors * SECTOR_SIZE);
+
+    Payload request = {0};
+    request.protocol = SD_BLOCK_BATCH;
+    request.params_size = count * sizeof(BatchEntry);
+    request.params = (uint8_t *)entries;
+    request.data = write_data;
+    request.data_size = write_size;
+    ResponseStatus outcome = send_command_payload(&request);
+    if (outcome != STATUS_OK) {
+        if (debug) cdprintf("Error: Failed to send batch of %d %d\n", count, outcome);
+        return outcome;
+    }
+
+    Payload response = {0};
+    response.params = statuses;
+    response.params_size = count;
+    response.data = read_data;
+    response.data_size = read_size;
+    outcome = receive_response(&response);
+    if (outcome != STATUS_OK) {
+        return outcome;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (statuses[i] != STATUS_OK) {
+            return (ResponseStatus)statuses[i];
+        }
+    }
+    return STATUS_OK;
+}
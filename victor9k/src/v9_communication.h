@@ -1,4 +1,6 @@
 #include "../../common/protocols.h"
+#include "../../common/dos_device_payloads.h"
+#include "../../common/crc8.h"
 
 #ifndef _USER_PORT_H
 #define _USER_PORT_H
@@ -63,9 +65,19 @@
 #define VIA_RESET_AUX_CTL      0x03  // Resets T1/T2/SR disabled, PA/PB latching enabled
 #define MAX_POLLING_ITERATIONS 5000  // Maximum number of iterations to poll for interrupt
 #define MAX_HANDSHAKE_ATTEMPTS 100   // Maximum number of handshake attempts before timeout
+#define FRAMED_HANDSHAKE_ATTEMPTS 3  // Attempts offering framing before falling back to stop-and-wait
+#define BUSY_RETRY_POLLS 500         // 20 us polls waited after a busy answer, about 10 ms
+#define MAX_BUSY_ANSWERS 1000        // Busy answers taken while the Pico mounts its card, about 10 s
+
+#define RX_RING_SIZE 256          // interrupt mode receive ring, indexed by uint8_t
 
 enum ports {PARALLEL, SERIAL_A, SERIAL_B, USER_PORT};
 
+typedef enum {
+    RECEIVE_POLLED,     // spin on CA1, fastest for sector data
+    RECEIVE_INTERRUPT,  // CA1 interrupts fill a ring, the CPU halts while it is empty
+} ReceiveMode;
+
 
 typedef struct {
     uint8_t out_in_reg_b;
@@ -86,6 +98,7 @@ typedef struct {
     uint8_t out_in_reg_a_no_hs;     // out-in reg 'a' NO HANDSHAKE
 } V9kParallelPort;
 
+#ifdef __WATCOMC__
 /* something about our makefile isn't letting these be linked, defining here */
 extern void Enable( void );
 #pragma aux Enable = \
@@ -106,18 +119,252 @@ static void delay_us(unsigned int n);
     parm [ax] \
     modify [cx];
 
+// Transfer kernels for the data path. The VIA sits at E800:0080, so with a
+// segment register on E800 port B is [0x80], port A [0x81] and the interrupt
+// flags [0x8D]: CA1 (0x02) is set when a byte is waiting, CB1 (0x10) once the
+// Pico has taken the last one. The buffer stays in ES:DI or DS:SI for the
+// whole run, the plain loops take four bytes a pass so a 512 byte sector is
+// 128 passes, and only a byte the Pico has not taken yet pays for a timeout.
+extern void via_receive(uint8_t far *data, uint16_t length);
+#pragma aux via_receive = \
+    "push ds" \
+    "mov ax, 0xE800" \
+    "mov ds, ax" \
+    "mov dx, cx" \
+    "shr cx, 1" \
+    "shr cx, 1" \
+    "jcxz rx_tail" \
+    "rx_four:" \
+    "rx_wait0:" "test byte ptr ds:[0x8D], 0x02" "jz rx_wait0" "mov al, ds:[0x81]" "stosb" \
+    "rx_wait1:" "test byte ptr ds:[0x8D], 0x02" "jz rx_wait1" "mov al, ds:[0x81]" "stosb" \
+    "rx_wait2:" "test byte ptr ds:[0x8D], 0x02" "jz rx_wait2" "mov al, ds:[0x81]" "stosb" \
+    "rx_wait3:" "test byte ptr ds:[0x8D], 0x02" "jz rx_wait3" "mov al, ds:[0x81]" "stosb" \
+    "loop rx_four" \
+    "rx_tail:" \
+    "mov cx, dx" \
+    "and cx, 3" \
+    "jcxz rx_done" \
+    "rx_one:" "test byte ptr ds:[0x8D], 0x02" "jz rx_one" "mov al, ds:[0x81]" "stosb" \
+    "loop rx_one" \
+    "rx_done:" \
+    "pop ds" \
+    parm [es di] [cx] \
+    modify [ax cx dx di];
+
+// No wait for CB1 between bytes, the Pico keeps up with the port
+extern void via_burst(uint8_t far *data, uint16_t length);
+#pragma aux via_burst = \
+    "push ds" \
+    "push es" \
+    "pop ds" \
+    "mov ax, 0xE800" \
+    "mov es, ax" \
+    "mov dx, cx" \
+    "shr cx, 1" \
+    "shr cx, 1" \
+    "jcxz burst_tail" \
+    "burst_four:" \
+    "lodsb" "mov es:[0x80], al" \
+    "lodsb" "mov es:[0x80], al" \
+    "lodsb" "mov es:[0x80], al" \
+    "lodsb" "mov es:[0x80], al" \
+    "loop burst_four" \
+    "burst_tail:" \
+    "mov cx, dx" \
+    "and cx, 3" \
+    "jcxz burst_done" \
+    "burst_one:" "lodsb" "mov es:[0x80], al" "loop burst_one" \
+    "burst_done:" \
+    "pop ds" \
+    parm [es si] [cx] \
+    modify [ax cx dx si es];
+
+// Waits for CB1 after each byte, up to MAX_POLLING_ITERATIONS (5000) polls.
+// Returns how many bytes were left when the Pico stopped taking them, 0 when
+// all went.
+extern uint16_t via_send(uint8_t far *data, uint16_t length);
+#pragma aux via_send = \
+    "push ds" \
+    "push es" \
+    "pop ds" \
+    "mov ax, 0xE800" \
+    "mov es, ax" \
+    "jcxz send_done" \
+    "send_next:" \
+    "lodsb" \
+    "mov es:[0x80], al" \
+    "test byte ptr es:[0x8D], 0x10" \
+    "jnz send_taken" \
+    "mov dx, 5000" \
+    "send_slow:" \
+    "test byte ptr es:[0x8D], 0x10" \
+    "jnz send_taken" \
+    "dec dx" \
+    "jnz send_slow" \
+    "jmp send_done" \
+    "send_taken:" \
+    "loop send_next" \
+    "send_done:" \
+    "pop ds" \
+    parm [es si] [cx] \
+    value [cx] \
+    modify [ax dx si es];
+
+// The checked kernels continue a CRC over the bytes as they move, with the
+// table near in DGROUP. DS goes over to the VIA for the port access only, BP
+// holds its segment.
+extern uint16_t via_receive_crc8(uint8_t far *data, uint16_t length, const uint8_t *table, uint16_t crc);
+#pragma aux via_receive_crc8 = \
+    "push bp" \
+    "mov bp, 0xE800" \
+    "jcxz r8_done" \
+    "r8_next:" \
+    "push ds" \
+    "mov ds, bp" \
+    "r8_wait:" "test byte ptr ds:[0x8D], 0x02" "jz r8_wait" \
+    "mov al, ds:[0x81]" \
+    "pop ds" \
+    "stosb" \
+    "xor al, dl" \
+    "xlat" \
+    "mov dl, al" \
+    "loop r8_next" \
+    "r8_done:" \
+    "pop bp" \
+    parm [es di] [cx] [bx] [dx] \
+    value [dx] \
+    modify [ax cx di];
+
+extern uint16_t via_receive_crc16(uint8_t far *data, uint16_t length, const uint16_t *table, uint16_t crc);
+#pragma aux via_receive_crc16 = \
+    "push bp" \
+    "mov bp, 0xE800" \
+    "jcxz r16_done" \
+    "r16_next:" \
+    "push ds" \
+    "mov ds, bp" \
+    "r16_wait:" "test byte ptr ds:[0x8D], 0x02" "jz r16_wait" \
+    "mov al, ds:[0x81]" \
+    "pop ds" \
+    "stosb" \
+    "xor al, dh" \
+    "xor ah, ah" \
+    "shl ax, 1" \
+    "mov bx, ax" \
+    "mov dh, dl" \
+    "xor dl, dl" \
+    "xor dx, [bx+si]" \
+    "loop r16_next" \
+    "r16_done:" \
+    "pop bp" \
+    parm [es di] [cx] [si] [dx] \
+    value [dx] \
+    modify [ax bx cx di];
+
+extern uint16_t via_burst_crc8(uint8_t far *data, uint16_t length, const uint8_t *table, uint16_t crc);
+#pragma aux via_burst_crc8 = \
+    "push bp" \
+    "mov bp, 0xE800" \
+    "jcxz b8_done" \
+    "b8_next:" \
+    "mov al, es:[di]" \
+    "inc di" \
+    "push ds" \
+    "mov ds, bp" \
+    "mov ds:[0x80], al" \
+    "pop ds" \
+    "xor al, dl" \
+    "xlat" \
+    "mov dl, al" \
+    "loop b8_next" \
+    "b8_done:" \
+    "pop bp" \
+    parm [es di] [cx] [bx] [dx] \
+    value [dx] \
+    modify [ax cx di];
+
+extern uint16_t via_burst_crc16(uint8_t far *data, uint16_t length, const uint16_t *table, uint16_t crc);
+#pragma aux via_burst_crc16 = \
+    "push bp" \
+    "mov bp, 0xE800" \
+    "jcxz b16_done" \
+    "b16_next:" \
+    "mov al, es:[di]" \
+    "inc di" \
+    "push ds" \
+    "mov ds, bp" \
+    "mov ds:[0x80], al" \
+    "pop ds" \
+    "xor al, dh" \
+    "xor ah, ah" \
+    "shl ax, 1" \
+    "mov bx, ax" \
+    "mov dh, dl" \
+    "xor dl, dl" \
+    "xor dx, [bx+si]" \
+    "loop b16_next" \
+    "b16_done:" \
+    "pop bp" \
+    parm [es di] [cx] [si] [dx] \
+    value [dx] \
+    modify [ax bx cx di];
+
+// Sector coding, see SECTOR_FILL. A sector is one value when every byte
+// matches its first, and a filled sector is expanded with rep stosb.
+extern uint16_t uniform_sector(uint8_t far *sector);
+#pragma aux uniform_sector = \
+    "cld" \
+    "mov al, es:[di]" \
+    "mov cx, 512" \
+    "repe scasb" \
+    "mov ax, 0" \
+    "jne uniform_done" \
+    "inc ax" \
+    "uniform_done:" \
+    parm [es di] \
+    value [ax] \
+    modify [cx di];
+
+extern void fill_sector(uint8_t far *sector, uint8_t value);
+#pragma aux fill_sector = \
+    "cld" \
+    "mov cx, 512" \
+    "rep stosb" \
+    parm [es di] [al] \
+    modify [cx di];
+
+// Data path accesses to the user port VIA, the host simulator swaps these for its byte FIFOs
+#define VIA_WRITE_DATA(value)  (via3->out_in_reg_b = (value))   // write port B, pulses CB2 data ready
+#define VIA_DATA_TAKEN()       (via3->int_flag_reg & CB1_INTERRUPT_MASK)
+#define VIA_DATA_READY()       (via3->int_flag_reg & CA1_INTERRUPT_MASK)
+#define VIA_READ_DATA()        (via3->out_in_reg_a)             // read port A, clears CA1
+#else
+#include "sim_via.h"    // host simulator stand-ins, see host/
+#endif
+
 #pragma pack( pop )
 
 ResponseStatus initialize_user_port(void);
 void interrupt far userPortISR(void);
 ResponseStatus send_startup_handshake(void);
+void set_link_framing(bool enabled);
+void set_link_integrity(IntegrityKind kind);
+void set_capability_exchange(bool enabled);
+void set_fill_sectors(bool enabled);
+const LinkCapabilities* link_capabilities(void);
+void set_receive_mode(ReceiveMode mode);
 ResponseStatus send_uint16_t(uint16_t data);
 ResponseStatus sendBytes(uint8_t far *data, size_t length);
 ResponseStatus receiveBytes(uint8_t far *data, size_t length);
 ResponseStatus send_command_payload(Payload *payload);
 ResponseStatus send_command(Payload *command);
 ResponseStatus receive_response(Payload *response);
+uint16_t max_request_sectors(void);
+ResponseStatus send_sectors_payload(Payload *request, uint16_t sector_count);
+ResponseStatus receive_sectors_response(Payload *response, uint16_t sector_count);
 ResponseStatus send_command_packet(Payload *payload);
 ResponseStatus send_data_packet(Payload *payload);
+ResponseStatus send_block_batch(BatchEntry *entries, uint8_t count, uint8_t far *write_data,
+                                uint8_t far *read_data, uint8_t *statuses);
 
 #endif
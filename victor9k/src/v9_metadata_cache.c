@@ -0,0 +1,138 @@
+#include <dos.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../common/protocols.h"
+
+#include "v9_metadata_cache.h"
+
+#define NO_UNIT 0xFF
+#define DIRENT_SIZE 32
+
+// A handful of sectors is searched in a straight line, cheaper on an 8088
+// than keeping a hash up to date. Eviction takes the least recently used.
+static uint8_t far *cacheData;
+static uint16_t capacity = 0;
+static uint8_t tagUnit[METADATA_CACHE_MAX_SECTORS];
+static uint16_t tagSector[METADATA_CACHE_MAX_SECTORS];
+static uint16_t tagUsed[METADATA_CACHE_MAX_SECTORS];
+static uint16_t useClock = 0;
+static uint16_t metadataEnd[MAX_IMG_FILES] = {0};   // 0 until the unit is added
+static MetadataCacheStats cacheStats = {0};
+
+uint16_t metadata_cache_init(uint8_t far *buffer, uint16_t sectors) {
+    capacity = (sectors > METADATA_CACHE_MAX_SECTORS) ? METADATA_CACHE_MAX_SECTORS : sectors;
+    cacheData = buffer;
+    for (uint16_t i = 0; i < METADATA_CACHE_MAX_SECTORS; i++) {
+        tagUnit[i] = NO_UNIT;
+    }
+    for (uint8_t unit = 0; unit < MAX_IMG_FILES; unit++) {
+        metadataEnd[unit] = 0;
+    }
+    return capacity;
+}
+
+uint16_t metadata_sectors(uint16_t bytes_per_sector, uint16_t reserved_sectors, uint8_t num_fats,
+                          uint16_t sectors_per_fat, uint16_t root_entries) {
+    if (bytes_per_sector != SECTOR_SIZE) {
+        return 0;   // the cache holds whole link sectors only
+    }
+    uint16_t root_sectors = (uint16_t)(((uint32_t)root_entries * DIRENT_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    return reserved_sectors + num_fats * sectors_per_fat + root_sectors;
+}
+
+void metadata_cache_add_unit(uint8_t unit, uint16_t metadata_end) {
+
+    if (unit < MAX_IMG_FILES) {
+        metadataEnd[unit] = metadata_end;
+    }
+}
+
+static bool is_metadata(uint8_t unit, uint16_t sector) {
+    return capacity > 0 && unit < MAX_IMG_FILES && sector < metadataEnd[unit];
+}
+
+static int16_t find_sector(uint8_t unit, uint16_t sector) {
+    for (uint16_t i = 0; i < capacity; i++) {
+        if (tagUnit[i] == unit && tagSector[i] == sector) {
+            return (int16_t)i;
+        }
+    }
+    return -1;
+}
+
+static void touch(uint16_t slot) {
+    if (++useClock == 0) {
+        // wrapped, start the order over rather than evict the newest
+        for (uint16_t i = 0; i < capacity; i++) {
+            tagUsed[i] = 0;
+        }
+        useClock = 1;
+    }
+    tagUsed[slot] = useClock;
+}
+
+static uint16_t take_slot(void) {
+    uint16_t oldest = 0;
+    for (uint16_t i = 0; i < capacity; i++) {
+        if (tagUnit[i] == NO_UNIT) {
+            return i;
+        }
+        if (tagUsed[i] < tagUsed[oldest]) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+uint16_t metadata_cache_read(uint8_t unit, uint16_t sector, uint16_t count, uint8_t far *dest) {
+    uint16_t served = 0;
+    while (served < count && is_metadata(unit, sector + served)) {
+        int16_t slot = find_sector(unit, sector + served);
+        if (slot < 0) {
+            break;
+        }
+        _fmemcpy(dest + served * SECTOR_SIZE, cacheData + (uint16_t)slot * SECTOR_SIZE, SECTOR_SIZE);
+        touch((uint16_t)slot);
+        cacheStats.hits++;
+        served++;
+    }
+    return served;
+}
+
+uint16_t metadata_cache_misses(uint8_t unit, uint16_t sector, uint16_t count) {
+    uint16_t missed = 0;
+    while (missed < count && is_metadata(unit, sector + missed)) {
+        if (find_sector(unit, sector + missed) >= 0) {
+            return missed;
+        }
+        cacheStats.misses++;
+        missed++;
+    }
+    return count;   // nothing past the metadata is cached
+}
+
+void metadata_cache_fill(uint8_t unit, uint16_t sector, uint16_t count, const uint8_t far *src) {
+    for (uint16_t i = 0; i < count && is_metadata(unit, sector + i); i++) {
+        int16_t found = find_sector(unit, sector + i);
+        uint16_t slot = (found >= 0) ? (uint16_t)found : take_slot();
+        tagUnit[slot] = unit;
+        tagSector[slot] = sector + i;
+        _fmemcpy(cacheData + slot * SECTOR_SIZE, src + i * SECTOR_SIZE, SECTOR_SIZE);
+        touch(slot);
+    }
+}
+
+void metadata_cache_drop(uint8_t unit, uint16_t sector, uint16_t count) {
+    for (uint16_t i = 0; i < count && is_metadata(unit, sector + i); i++) {
+        int16_t slot = find_sector(unit, sector + i);
+        if (slot >= 0) {
+            tagUnit[slot] = NO_UNIT;
+        }
+    }
+}
+
+void metadata_cache_stats(MetadataCacheStats *stats) {
+    *stats = cacheStats;
+}
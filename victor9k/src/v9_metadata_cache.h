@@ -0,0 +1,39 @@
+#ifndef _V9_METADATA_CACHE_H_
+#define _V9_METADATA_CACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../common/protocols.h"
+
+// Driver resident cache of the sectors DOS keeps going back to: the boot
+// sector, the FATs and the root directory. A hit is a memory copy instead of
+// a round trip over the user port. Reads fill it, writes keep it current, and
+// sectors past a unit's root directory are never cached.
+#define METADATA_CACHE_MAX_SECTORS 64   // 32 KB
+#define METADATA_CACHE_MAX_KB (METADATA_CACHE_MAX_SECTORS * SECTOR_SIZE / 1024)
+
+typedef struct {
+    uint32_t hits;      // sectors served from the cache
+    uint32_t misses;    // metadata sectors that went over the link
+} MetadataCacheStats;
+
+// Takes buffer for up to sectors and returns how many it uses, 0 turns the
+// cache off. The buffer is not touched until the first fill, so it can be
+// memory that is still in use until the caller returns.
+uint16_t metadata_cache_init(uint8_t far *buffer, uint16_t sectors);
+// Sectors of a unit before its data area, from the unit's BPB
+uint16_t metadata_sectors(uint16_t bytes_per_sector, uint16_t reserved_sectors, uint8_t num_fats,
+                          uint16_t sectors_per_fat, uint16_t root_entries);
+void metadata_cache_add_unit(uint8_t unit, uint16_t metadata_end);
+// Copies the cached sectors at the start of a run to dest, returns how many
+uint16_t metadata_cache_read(uint8_t unit, uint16_t sector, uint16_t count, uint8_t far *dest);
+// How many sectors at the start of a run have to go over the link
+uint16_t metadata_cache_misses(uint8_t unit, uint16_t sector, uint16_t count);
+// Sectors that went over the link in either direction, src holds what the card has
+void metadata_cache_fill(uint8_t unit, uint16_t sector, uint16_t count, const uint8_t far *src);
+// Sectors whose contents on the card are unknown after a failed write
+void metadata_cache_drop(uint8_t unit, uint16_t sector, uint16_t count);
+void metadata_cache_stats(MetadataCacheStats *stats);
+
+#endif /* _V9_METADATA_CACHE_H_ */